@@ -2,6 +2,26 @@
 #ifndef PURIFY_MEASUREMENT
 #define PURIFY_MEASUREMENT
 
+#include <complex.h>  // Must be before fftw3.h
+#include <fftw3.h>
+#ifdef PURIFY_MPI
+  #include <mpi.h>
+#endif
+#include "purify_sparsemat.h"
+#include "purify_visibility.h"
+#include "purify_image.h"
+
+/*! Interpolation kernels supported by the gridding operator. */
+typedef enum
+  {
+    /*! Nearest grid point interpolation (single cell per visibility). */
+    PURIFY_MEASUREMENT_KERNEL_NGB = 0,
+    /*! Truncated Gaussian kernel, support of kx by ky cells. */
+    PURIFY_MEASUREMENT_KERNEL_GAUSS,
+    /*! Daubechies D20 scaling function tabulated in D20.phi. */
+    PURIFY_MEASUREMENT_KERNEL_WAVELET,
+  } purify_measurement_kernel;
+
 /*!  
  * Structure storing parametrs for the interpolation operator.
  *
@@ -21,11 +41,222 @@ typedef struct {
   int ky; 
   /*! Number of columns in the interpolation kernel. */
   int kx; 
+  /*! Interpolation kernel used to build the gridding matrix. */
+  purify_measurement_kernel kernel;
 
   double umax, vmax;
+
+  /*! Offset of the image centre from the phase centre of the
+      visibilities (direction cosines, radians). */
+  double l0, m0;
   
 } purify_measurement_cparam;
 
+/*!  
+ * Configuration of the gridded continuos Fourier transform operator
+ * selected by \ref purify_measurement_autotune.
+ */
+typedef struct {
+  /*! Interpolation kernel. */
+  purify_measurement_kernel kernel;
+  /*! Support of the kernel in cells (kx = ky). */
+  int support;
+  /*! Oversampling factor (ofx = ofy). */
+  int oversampling;
+  /*! Number of OpenMP threads. */
+  int nthreads;
+  /*! Relative degridding error against the direct DFT. */
+  double error;
+  /*! Time of a forward plus adjoint application in seconds. */
+  double time;
+} purify_measurement_tuneconfig;
+
+/*!  
+ * Elliptical Gaussian fitted to the main lobe of the point spread
+ * function.
+ */
+typedef struct {
+  /*! Full width at half maximum of the major axis in pixels. */
+  double bmaj;
+  /*! Full width at half maximum of the minor axis in pixels. */
+  double bmin;
+  /*! Angle of the major axis from the first image dimension (radians). */
+  double bpa;
+} purify_measurement_beam;
+
+/*!  
+ * Parameters of the operator norm estimator.
+ */
+typedef struct {
+  /*! Maximum number of Lanczos iterations. */
+  int max_iter;
+  /*! Relative change of the estimate below which it has converged. */
+  double rel_tol;
+  /*! Seed of the random starting vector. */
+  unsigned long long seed;
+  /*! Verbosity (0 silent, 1 summary). */
+  int verbose;
+  /*! File caching estimates between runs (NULL to disable). */
+  const char *cachefile;
+  /*! Key of the estimate in the cache, see \ref
+      purify_measurement_fingerprint. */
+  unsigned long long key;
+} purify_measurement_opnormparam;
+
+/*!  
+ * Pool of oversampled grids used as scratch memory by the gridded
+ * measurement operators. Grids are allocated with \ref
+ * purify_utils_malloc (64 byte aligned, freed with purify_utils_free)
+ * the first time they are needed and reused afterwards, one per
+ * concurrent application of an operator.
+ */
+typedef struct {
+  /*! Number of complex elements of each grid. */
+  int size;
+  /*! Number of grids allocated. */
+  int ngrids;
+  /*! Grids of the pool. */
+  complex double **grids;
+  /*! Flag marking the grids currently in use. */
+  int *busy;
+} purify_measurement_workspace;
+
+/*!  
+ * Faceted continuos Fourier transform operator. The image is split
+ * in nfx by nfy facets of equal size, each one imaged with its own
+ * small oversampled grid and FFT. All facets share the gridding matrix,
+ * only the phase rotation of the visibilities to the facet centre
+ * differs.
+ */
+typedef struct {
+  /*! Number of facets along the columns of the image. */
+  int nfx;
+  /*! Number of facets along the rows of the image. */
+  int nfy;
+  /*! Parameters of the whole image operator. */
+  purify_measurement_cparam param;
+  /*! Parameters of the operator of a single facet. */
+  purify_measurement_cparam fparam;
+  /*! Deconvolution kernel of a facet. */
+  double *deconv;
+  /*! Gridding matrix shared by all the facets. */
+  purify_sparsemat_row gmat;
+  /*! Forward FFTW plan of a facet grid. */
+  fftw_plan planfwd;
+  /*! Backward FFTW plan of a facet grid. */
+  fftw_plan planadj;
+  /*! Pool of oversampled facet grids. */
+  purify_measurement_workspace ws;
+  /*! Phase rotation to the centre of each facet (nmeas per facet). */
+  complex double *phasors;
+  /*! Visibilities of each facet. */
+  complex double *ytemp;
+  /*! Image of each facet. */
+  complex double *xtemp;
+} purify_measurement_facets;
+
+/*!  
+ * Continuos Fourier transform operator for a growing set of
+ * visibilities. Visibilities and rows of the gridding matrix are
+ * stored in chunks of fixed capacity, so that appending new
+ * visibilities never copies the existing ones.
+ */
+typedef struct {
+  /*! Parameters of the operator, param.nmeas is the total number of
+      visibilities appended. */
+  purify_measurement_cparam param;
+  /*! Maximum number of visibilities per chunk. */
+  int chunksize;
+  /*! Number of chunks in use. */
+  int nchunks;
+  /*! Number of chunks allocated in the chunk tables. */
+  int maxchunks;
+  /*! Visibilities of each chunk (nmeas is the fill of the chunk). */
+  purify_visibility *vis;
+  /*! Gridding matrix of each chunk. */
+  purify_sparsemat_row *gmat;
+  /*! Deconvolution kernel in image space. */
+  double *deconv;
+} purify_measurement_stream;
+
+#ifdef PURIFY_MPI
+/*!  
+ * Gridded measurement operator with the image and the oversampled
+ * grid distributed in slabs of rows across the ranks of a
+ * communicator. The visibilities are replicated and each rank holds
+ * the columns of the gridding matrix of its slab of the grid.
+ */
+typedef struct {
+  /*! Parameters of the operator. */
+  purify_measurement_cparam param;
+  /*! Communicator. */
+  MPI_Comm comm;
+  /*! Number of ranks. */
+  int nprocs;
+  /*! Rank of the calling process. */
+  int rank;
+  /*! Size of the oversampled grid (columns nx2, rows ny2). */
+  int nx2, ny2;
+  /*! Rows of the grid per rank. */
+  int nr;
+  /*! Columns of the grid per rank after the transpose. */
+  int nc;
+  /*! Rows of the image per rank. */
+  int nimg;
+  /*! Deconvolution kernel of the local image rows. */
+  double *deconv;
+  /*! Columns of the gridding matrix of the local grid rows. */
+  purify_sparsemat_row gmat;
+  /*! Local rows of the grid (nr*nx2). */
+  complex double *grid;
+  /*! Local columns of the transposed grid (nc*ny2). */
+  complex double *gridt;
+  /*! Send and receive buffers of the all-to-all exchanges. */
+  complex double *sbuf, *rbuf;
+  /*! Row and column FFT plans of the local slabs. */
+  fftw_plan rowfwd, rowadj, colfwd, coladj;
+} purify_measurement_slab;
+#endif
+
+/*!  
+ * Out-of-core two dimensional FFT of an oversampled grid held in a
+ * memory mapped file. Rows are transformed in slabs, transposed in
+ * tiles into a mapped scratch file, transformed again and transposed
+ * back, reading the next slab while the current one is processed.
+ */
+typedef struct {
+  /*! Number of rows of the grid. */
+  int nrows;
+  /*! Number of columns of the grid (row length). */
+  int ncols;
+  /*! Number of rows (or columns) per slab. */
+  int slab;
+  /*! Descriptor of the grid file. */
+  int fd;
+  /*! Descriptor of the scratch file holding the transposed grid. */
+  int fdt;
+  /*! Grid mapped in memory (nrows*ncols). */
+  complex double *grid;
+  /*! Transposed grid mapped in memory (ncols*nrows). */
+  complex double *gridt;
+  /*! Slab buffers (two for double buffering). */
+  complex double *buf[2];
+  /*! Forward and backward plans of the row and column slabs. */
+  fftw_plan rowfwd, rowadj, colfwd, coladj;
+} purify_measurement_oocfft;
+
+void purify_measurement_init_cparam(purify_measurement_cparam *param);
+
+void purify_measurement_init_workspace(purify_measurement_workspace *ws,
+                                       int size);
+
+complex double *purify_measurement_workspace_acquire(purify_measurement_workspace *ws);
+
+void purify_measurement_workspace_release(purify_measurement_workspace *ws,
+                                          complex double *grid);
+
+void purify_measurement_free_workspace(purify_measurement_workspace *ws);
+
 void purify_measurement_fft_real(void *out, 
 				 void *in, 
 				 void **data);
@@ -50,6 +281,9 @@ void purify_measurement_init_cft(purify_sparsemat_row *mat,
                                  double *deconv, double *u, double *v, 
                                  purify_measurement_cparam *param);
 
+void purify_measurement_init_deconv(double *deconv, 
+                                    purify_measurement_cparam *param);
+
 void purify_measurement_cftfwd(void *out, void *in, void **data);
 
 void purify_measurement_cftadj(void *out, void *in, void **data);
@@ -57,10 +291,138 @@ void purify_measurement_cftadj(void *out, void *in, void **data);
 double purify_measurement_pow_meth(void (*A)(void *out, void *in, void **data), 
                                    void **A_data,
                                    void (*At)(void *out, void *in, void **data), 
-                                   void **At_data);
+                                   void **At_data,
+                                   int nx, int ny);
+
+void purify_measurement_init_opnormparam(purify_measurement_opnormparam *param);
+
+double purify_measurement_opnorm(void (*A)(void *out, void *in, void **data), 
+                                 void **A_data,
+                                 void (*At)(void *out, void *in, void **data), 
+                                 void **At_data,
+                                 void (*G)(void *out, void *in, void **data), 
+                                 void **G_data,
+                                 int nx, int ny,
+                                 purify_measurement_opnormparam *param);
+
+unsigned long long purify_measurement_fingerprint(purify_sparsemat_row *mat,
+                                                  double *deconv,
+                                                  purify_measurement_cparam *param);
+
+void purify_measurement_init_gram(double *gdiag, purify_sparsemat_row *mat);
+
+void purify_measurement_cftgram(void *out, void *in, void **data);
 
 void purify_measurement_symcftfwd(void *out, void *in, void **data);
 
 void purify_measurement_symcftadj(void *out, void *in, void **data);
 
+void purify_measurement_init_hcft(purify_sparsemat_row *mat, 
+                                  double *deconv, double *u, double *v, 
+                                  purify_measurement_cparam *param);
+
+void purify_measurement_hcftfwd(void *out, void *in, void **data);
+
+void purify_measurement_hcftadj(void *out, void *in, void **data);
+
+void purify_measurement_init_facets(purify_measurement_facets *facets,
+                                    double *u, double *v,
+                                    purify_measurement_cparam *param,
+                                    int nfx, int nfy, unsigned flags);
+
+void purify_measurement_free_facets(purify_measurement_facets *facets);
+
+void purify_measurement_facetfwd(void *out, void *in, void **data);
+
+void purify_measurement_facetadj(void *out, void *in, void **data);
+
+void purify_measurement_init_stream(purify_measurement_stream *stream,
+                                    purify_measurement_cparam *param,
+                                    int chunksize);
+
+void purify_measurement_stream_append(purify_measurement_stream *stream,
+                                      purify_visibility *vis);
+
+void purify_measurement_stream_gather(complex double *y,
+                                      purify_measurement_stream *stream);
+
+void purify_measurement_free_stream(purify_measurement_stream *stream);
+
+void purify_measurement_streamfwd(void *out, void *in, void **data);
+
+void purify_measurement_streamadj(void *out, void *in, void **data);
+
+int purify_measurement_autotune(purify_measurement_tuneconfig *best,
+                                double *u, double *v,
+                                purify_measurement_cparam *param,
+                                double tol, int nsample, int maxthreads,
+                                int verbose);
+
+void purify_measurement_tune_apply(purify_measurement_cparam *param,
+                                   purify_measurement_tuneconfig *cfg);
+
+int purify_measurement_tune_write(purify_measurement_tuneconfig *cfg,
+                                  const char *filename);
+
+int purify_measurement_tune_read(purify_measurement_tuneconfig *cfg,
+                                 const char *filename);
+
+void purify_measurement_cftgrid_add(complex double *grid,
+                                    purify_sparsemat_row *mat,
+                                    complex double *y);
+
+void purify_measurement_cftgrid_image(complex double *xout,
+                                      complex double *grid,
+                                      double *deconv,
+                                      purify_measurement_cparam *param,
+                                      fftw_plan *plan);
+
+void purify_measurement_cftgrid_chunk(purify_visibility *chunk, 
+                                      void **data);
+
+int purify_measurement_psf(purify_image *psf, 
+                           purify_measurement_beam *beam,
+                           double *u, double *v, double *weights,
+                           purify_measurement_cparam *param,
+                           int extend, const char *cachedir);
+
+void purify_measurement_fitbeam(purify_measurement_beam *beam, 
+                                purify_image *psf);
+
+void purify_measurement_init_oocfft(purify_measurement_oocfft *ooc,
+                                    int nrows, int ncols, int slab,
+                                    const char *dir);
+
+void purify_measurement_free_oocfft(purify_measurement_oocfft *ooc);
+
+void purify_measurement_oocfft_execute(purify_measurement_oocfft *ooc,
+                                       int sign);
+
+void purify_measurement_ooccftfwd(void *out, void *in, void **data);
+
+void purify_measurement_ooccftadj(void *out, void *in, void **data);
+
+#ifdef PURIFY_MPI
+void purify_measurement_mpicftfwd(void *out, void *in, void **data);
+
+void purify_measurement_mpicftadj(void *out, void *in, void **data);
+
+void purify_measurement_init_slab(purify_measurement_slab *slab,
+                                  double *u, double *v,
+                                  purify_measurement_cparam *param,
+                                  MPI_Comm comm);
+
+void purify_measurement_free_slab(purify_measurement_slab *slab);
+
+void purify_measurement_slabfft(purify_measurement_slab *slab, int sign);
+
+void purify_measurement_slabcftfwd(void *out, void *in, void **data);
+
+void purify_measurement_slabcftadj(void *out, void *in, void **data);
+#endif
+
+void purify_measurement_dftfwd(void *out, void *in, void **data);
+
+void purify_measurement_dftadj(void *out, void *in, void **data);
+
 #endif
@@ -5,6 +5,8 @@
 double purify_ran_gasdev2(int idum);
 double purify_ran_ran2(int idum);
 int purify_ran_knuthshuffle(int *perm, int nperm, int N, int seed);
+double purify_ran_uniform_r(unsigned long long *state);
+double purify_ran_gasdev_r(unsigned long long *state);
 
 
 #endif
@@ -75,6 +75,7 @@ void purify_sparsemat_fwd_complexr(complex double *y, complex double *x,
           purify_sparsemat_row *A);
 void purify_sparsemat_adj_complexr(complex double *y, complex double *x, 
           purify_sparsemat_row *A);
+void purify_sparsemat_scalerows(purify_sparsemat_row *A, double *s);
 
 
 #endif
@@ -2,6 +2,24 @@
 #ifndef PURIFY_UTILS
 #define PURIFY_UTILS
 
+#include <stddef.h>
+
+/*! Initial value of the hashes computed with \ref purify_utils_hash. */
+#define PURIFY_UTILS_HASH_INIT 0xCBF29CE484222325ULL
+
+/*! Allocation policies of \ref purify_utils_malloc. */
+typedef enum
+  {
+    /*! Plain malloc and calloc. */
+    PURIFY_UTILS_ALLOC_DEFAULT = 0,
+    /*! 64 byte alignment, transparent huge pages and parallel first
+        touch. */
+    PURIFY_UTILS_ALLOC_NUMA,
+    /*! As PURIFY_UTILS_ALLOC_NUMA with explicit huge pages
+        (MAP_HUGETLB), falling back to transparent huge pages. */
+    PURIFY_UTILS_ALLOC_HUGETLB,
+  } purify_utils_alloc_policy;
+
 void purify_utils_fftshift_2d_c(complex double *x, int nx, int ny);
 
 void purify_utils_fftshift_1d(double *out, double *in, int n);
@@ -12,4 +30,17 @@ double purify_utils_maxarray(double *a, int num_elements);
 
 int purify_utils_absearch(double *x, int nx, double key);
 
+unsigned long long purify_utils_hash(unsigned long long hash, 
+                                     const void *buf, size_t nbytes);
+
+void purify_utils_alloc_setpolicy(purify_utils_alloc_policy policy);
+
+purify_utils_alloc_policy purify_utils_alloc_getpolicy(void);
+
+void *purify_utils_malloc(size_t size);
+
+void *purify_utils_calloc(size_t n, size_t size);
+
+void purify_utils_free(void *p);
+
 #endif
@@ -6,7 +6,12 @@
 #ifndef PURIFY_VISIBILITY
 #define PURIFY_VISIBILITY
 
+#include <stdio.h>
+#include <stddef.h>
 #include <complex.h>
+#ifdef PURIFY_MPI
+  #include <mpi.h>
+#endif
 #include "purify_sparsemat.h"
 #include "purify_image.h"
 
@@ -26,6 +31,14 @@ typedef struct {
   complex double *noise_std;
   /*! Measured visibility value. */
   complex double *y;
+  /*! Baseline (antenna pair) identifier, -1 if unknown. */
+  int *baseline;
+  /*! Time of the visibility measurement. */
+  double *time;
+  /*! File mapping the arrays point into, NULL if they were allocated. */
+  void *map;
+  /*! Length in bytes of the file mapping. */
+  size_t maplen;
 } purify_visibility;
 
 
@@ -40,8 +53,169 @@ typedef enum
     PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS,
     // SHAO type
     PURIFY_VISIBILITY_FILETYPE_UV,
+    /*! PURIFY's binary columnar visibility file format. */
+    PURIFY_VISIBILITY_FILETYPE_BIN,
+    /*! PURIFY's compressed quantised visibility file format. */
+    PURIFY_VISIBILITY_FILETYPE_ZVIS,
+    /*! UVFITS random groups file (read only), Stokes I is formed from
+        the correlations. */
+    PURIFY_VISIBILITY_FILETYPE_UVFITS,
   } purify_visibility_filetype;
 
+/*! Magic string at the start of a binary visibility file. */
+#define PURIFY_VISIBILITY_BINMAGIC "PURIFYVB"
+/*! Version of the binary visibility file format. */
+#define PURIFY_VISIBILITY_BINVERSION 1
+/*! Alignment in bytes of the columns of a binary visibility file. */
+#define PURIFY_VISIBILITY_BINALIGN 64
+/*! Number of columns of a binary visibility file. */
+#define PURIFY_VISIBILITY_BINNCOLS 7
+
+/*!  
+ * Header of a binary visibility file. It is followed by the u, v, w,
+ * y, noise_std, baseline and time columns, each one starting at a
+ * multiple of PURIFY_VISIBILITY_BINALIGN bytes. Values are stored in
+ * the byte order of the machine that wrote the file.
+ */
+typedef struct {
+  /*! Magic string PURIFY_VISIBILITY_BINMAGIC (not null terminated). */
+  char magic[8];
+  /*! Version of the file format. */
+  int version;
+  /*! Byte order mark, 0x01020304 in the byte order of the writer. */
+  unsigned int byteorder;
+  /*! Number of visibilities. */
+  long long nmeas;
+  /*! Offsets in bytes of the columns from the start of the file. */
+  long long offset[PURIFY_VISIBILITY_BINNCOLS];
+} purify_visibility_binheader;
+
+/*! Magic string at the start of a compressed visibility file. */
+#define PURIFY_VISIBILITY_ZMAGIC "PURIFYVZ"
+/*! Version of the compressed visibility file format. */
+#define PURIFY_VISIBILITY_ZVERSION 1
+
+/*!  
+ * Error bounds and blocking of a compressed visibility file. The u, v
+ * and w coordinates and the time are quantised to integers and delta
+ * encoded, y and noise_std are stored as half, single or double
+ * floats, and blocks of visibilities are deflated independently.
+ */
+typedef struct {
+  /*! Maximum absolute error of u, v and w (0 for the finest step of
+      each coordinate that fits in 31 bits). */
+  double uvwerr;
+  /*! Maximum relative error of y and noise_std: half floats are used
+      if it is at least 2^-11, single floats if it is at least 2^-24
+      and doubles otherwise. */
+  double yrelerr;
+  /*! Maximum absolute error of the time (0 for the finest step that
+      fits in 53 bits). */
+  double timeerr;
+  /*! Number of visibilities per block. */
+  int blocksize;
+  /*! zlib compression level (0-9). */
+  int level;
+} purify_visibility_zparam;
+
+/*!  
+ * Reader of a visibility file in chunks of rows, to process data sets
+ * that do not fit in memory in a single pass.
+ */
+typedef struct {
+  /*! Type of the file. */
+  purify_visibility_filetype filetype;
+  /*! Number of visibilities per chunk. */
+  int chunksize;
+  /*! Text file (text filetypes only). */
+  FILE *file;
+  /*! Buffer of the text read from the file. */
+  char *buf;
+  /*! Number of characters in the buffer. */
+  size_t buflen;
+  /*! Position of the next line in the buffer. */
+  size_t bufpos;
+  /*! Size of the buffer. */
+  size_t bufcap;
+  /*! End of the text file reached. */
+  int eof;
+  /*! File descriptor (binary filetype only). */
+  int fd;
+  /*! Header of the binary file. */
+  purify_visibility_binheader header;
+  /*! Number of visibilities read so far. */
+  long long nread;
+  /*! Chunks being processed and prefetched. */
+  purify_visibility chunk[2];
+} purify_visibility_reader;
+
+/*! Density weighting schemes of the visibilities. */
+typedef enum
+  {
+    /*! Inverse noise variance weights. */
+    PURIFY_VISIBILITY_WEIGHTING_NATURAL = 0,
+    /*! Natural weights divided by the weight density of the grid cell. */
+    PURIFY_VISIBILITY_WEIGHTING_UNIFORM,
+    /*! Briggs (robust) weights between natural and uniform. */
+    PURIFY_VISIBILITY_WEIGHTING_BRIGGS,
+  } purify_visibility_weighting;
+
+/*! Reasons for flagging a visibility, combined as bits. */
+typedef enum
+  {
+    /*! Non-finite coordinate, value or noise. */
+    PURIFY_VISIBILITY_FLAG_NONFINITE = 1,
+    /*! Zero weight (infinite noise or non-positive weight). */
+    PURIFY_VISIBILITY_FLAG_ZEROWEIGHT = 2,
+    /*! Coordinates outside the uv grid of the operator. */
+    PURIFY_VISIBILITY_FLAG_OUTOFGRID = 4,
+  } purify_visibility_flag;
+
+/*!  
+ * Report of a pass of purify_visibility_filter. A visibility is
+ * counted once for each reason it is flagged.
+ */
+typedef struct {
+  /*! Number of visibilities before filtering. */
+  int nmeas;
+  /*! Number of visibilities not flagged. */
+  int nkept;
+  /*! Number of visibilities with non-finite values. */
+  int nnonfinite;
+  /*! Number of visibilities with zero weight. */
+  int nzeroweight;
+  /*! Number of visibilities outside the uv grid. */
+  int noutofgrid;
+  /*! Run time of the filter in seconds. */
+  double time;
+} purify_visibility_filterreport;
+
+/*!  
+ * Bucketed spatial index of visibilities over a regular grid of cells
+ * (tiles) of the uv plane. The visibilities of cell c = iv * nu + iu
+ * are ind[offset[c]] to ind[offset[c+1]-1].
+ */
+typedef struct {
+  /*! Number of cells along u. */
+  int nu;
+  /*! Number of cells along v. */
+  int nv;
+  /*! Lower u bound of the grid of cells. */
+  double umin;
+  /*! Lower v bound of the grid of cells. */
+  double vmin;
+  /*! Size of a cell along u. */
+  double du;
+  /*! Size of a cell along v. */
+  double dv;
+  /*! Number of indexed visibilities. */
+  int nmeas;
+  /*! Start of each cell in ind (nu * nv + 1 entries). */
+  int *offset;
+  /*! Indices of the visibilities sorted by cell. */
+  int *ind;
+} purify_visibility_index;
+
 
 inline void purify_visibility_iuiv2ind(int *ind, int iu, int iv, 
 				       int nx, int ny);
@@ -93,10 +267,117 @@ void purify_visibility_vis2mask(purify_sparsemat *mask,
 				purify_visibility *vis,
 				purify_image *img);
 
+double purify_visibility_average(purify_visibility *avg,
+				 purify_visibility *vis,
+				 double maxloss, double lmax);
+
+void purify_visibility_weights(double *weights,
+			       purify_visibility *vis,
+			       double umax, double vmax,
+			       int nx2, int ny2,
+			       purify_visibility_weighting weighting,
+			       double robust);
+
+void purify_visibility_init_index(purify_visibility_index *index,
+				  purify_visibility *vis,
+				  double umin, double umax,
+				  double vmin, double vmax,
+				  int nu, int nv);
+
+void purify_visibility_free_index(purify_visibility_index *index);
+
+int purify_visibility_index_cell(purify_visibility_index *index,
+				 double u, double v);
+
+int purify_visibility_index_tile(int **ind,
+				 purify_visibility_index *index,
+				 int iu, int iv);
+
+int purify_visibility_index_range(int **sel,
+				  purify_visibility_index *index,
+				  purify_visibility *vis,
+				  double umin, double umax,
+				  double vmin, double vmax);
+
+int purify_visibility_index_annulus(int **sel,
+				    purify_visibility_index *index,
+				    purify_visibility *vis,
+				    double rmin, double rmax);
+
+void purify_visibility_index_permute(purify_visibility *sorted,
+				     purify_visibility *vis,
+				     purify_visibility_index *index);
+
+int purify_visibility_filter(purify_visibility_filterreport *report,
+			     unsigned char *flags,
+			     purify_visibility *vis,
+			     double *weights,
+			     double umax, double vmax,
+			     int drop);
+
+#ifdef PURIFY_MPI
+void purify_visibility_mpi_scatter(purify_visibility *local,
+				   purify_visibility *vis,
+				   int root, MPI_Comm comm);
+#endif
+
+int purify_visibility_fold(purify_visibility *vis);
+
+void purify_visibility_coalesce(purify_visibility *coal,
+				int **count,
+				purify_visibility *vis,
+				double umax, double vmax,
+				int nx2, int ny2, int nsub);
+
+void purify_visibility_parseline(purify_visibility *vis, int i,
+				 const char *line,
+				 purify_visibility_filetype filetype);
+
 int purify_visibility_readfile(purify_visibility *vis, 
 			       const char *filename, 
 			       purify_visibility_filetype filetype);
 
+int purify_visibility_mapfile(purify_visibility *vis, 
+			      const char *filename, 
+			      purify_visibility_filetype filetype,
+			      double *throughput);
+
+int purify_visibility_mapbin(purify_visibility *vis, 
+			     const char *filename, 
+			     int writable);
+
+void purify_visibility_init_zparam(purify_visibility_zparam *zparam);
+
+int purify_visibility_writez(purify_visibility *vis, 
+			     const char *filename, 
+			     purify_visibility_zparam *zparam);
+
+int purify_visibility_readz(purify_visibility *vis, 
+			    const char *filename);
+
+int purify_visibility_readuvfits(purify_visibility *vis, 
+				 const char *filename);
+
+void purify_visibility_init_reader(purify_visibility_reader *reader,
+				   const char *filename,
+				   purify_visibility_filetype filetype,
+				   int chunksize);
+
+void purify_visibility_free_reader(purify_visibility_reader *reader);
+
+int purify_visibility_reader_next(purify_visibility_reader *reader,
+				  purify_visibility *chunk);
+
+long long purify_visibility_reader_pass(purify_visibility_reader *reader,
+					void (*fn)(purify_visibility *chunk, 
+						   void **data),
+					void **data);
+
+void purify_visibility_histogram_add(double *hist,
+				     purify_visibility *vis,
+				     double umax, double vmax,
+				     int nx2, int ny2);
+
 int purify_visibility_writefile(purify_visibility *vis, 
 				const char *filename, 
 				purify_visibility_filetype filetype);
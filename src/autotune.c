@@ -0,0 +1,97 @@
+/*!
+ * \file autotune.c
+ * Select the interpolation kernel, support, oversampling and number of
+ * threads of the gridded continuos Fourier transform operator for a
+ * visibility coverage, and save the configuration for later runs (see
+ * \ref purify_measurement_tune_read).
+ *
+ * Usage: autotune [visibility file (.uv)] [image size] 
+ *                 [target relative error] [number of samples]
+ *                 [maximum number of threads] [output file]
+ *
+ * The output file defaults to the visibility file with its extension
+ * replaced by .tune (bk.uv gives bk.tune), which is the file read by
+ * the reconstruct programs.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>  // Must be before fftw3.h
+#include <fftw3.h>
+#include <math.h>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+#include "purify_visibility.h"
+#include "purify_sparsemat.h"
+#include "purify_measurement.h"
+#include "purify_types.h"
+#include "purify_error.h"
+
+int main(int argc, char *argv[]) {
+
+  char filename[PURIFY_STRLEN];
+  char outfile[PURIFY_STRLEN];
+  char *ext;
+  int dim, nsample, maxthreads, notfound;
+  double tol, res_mas, res_rad;
+  purify_visibility vis;
+  purify_measurement_cparam param;
+  purify_measurement_tuneconfig cfg;
+
+  strcpy(filename, argc > 1 ? argv[1] : "bk.uv");
+  dim = argc > 2 ? atoi(argv[2]) : 256;
+  tol = argc > 3 ? atof(argv[3]) : 1e-2;
+  nsample = argc > 4 ? atoi(argv[4]) : 1000;
+  #ifdef _OPENMP
+    maxthreads = omp_get_max_threads();
+  #else
+    maxthreads = 1;
+  #endif
+  if (argc > 5) maxthreads = atoi(argv[5]);
+  if (argc > 6) {
+    strcpy(outfile, argv[6]);
+  }
+  else {
+    strcpy(outfile, filename);
+    ext = strrchr(outfile, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL) *ext = '\0';
+    strcat(outfile, ".tune");
+  }
+
+  purify_visibility_readfile(&vis, filename, PURIFY_VISIBILITY_FILETYPE_UV);
+  printf("Number of visibilities: %i \n\n", vis.nmeas);
+
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * PURIFY_PI;
+
+  purify_measurement_init_cparam(&param);
+  param.nmeas = vis.nmeas;
+  param.nx1 = dim;
+  param.ny1 = dim;
+  param.umax = 1.0 / res_rad / 2.;
+  param.vmax = param.umax;
+
+  printf("%-8s %3s %3s %4s %12s %10s\n",
+         "kernel", "sup", "of", "thr", "relerr", "time[s]");
+  notfound = purify_measurement_autotune(&cfg, vis.u, vis.v, &param, tol,
+                                         nsample, maxthreads, 1);
+
+  if (notfound)
+    printf("\nNo configuration meets the target error %e, "
+           "keeping the most accurate one\n", tol);
+  printf("\nSelected: kernel %d, support %d, oversampling %d, "
+         "threads %d, error %e\n", (int)cfg.kernel, cfg.support, 
+         cfg.oversampling, cfg.nthreads, cfg.error);
+
+  if (purify_measurement_tune_write(&cfg, outfile))
+    PURIFY_ERROR_GENERIC("Failed to write the configuration file");
+  printf("Configuration written to %s\n", outfile);
+
+  purify_visibility_free(&vis);
+
+  return notfound;
+
+}
@@ -0,0 +1,58 @@
+/*!
+ * \file average_vis.c
+ * Baseline dependent averaging of visibilities (see \ref
+ * purify_visibility_average). The input and output are visibility
+ * files of type UV whose seventh and eighth columns hold the baseline
+ * identifier and the time of each visibility.
+ *
+ * Usage: average_vis [input file (.uv)] [output file (.uv)]
+ *                    [maximum smearing loss] [image size]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+#include "purify_visibility.h"
+#include "purify_types.h"
+#include "purify_error.h"
+
+int main(int argc, char *argv[]) {
+
+  char filename[PURIFY_STRLEN];
+  char outfile[PURIFY_STRLEN];
+  int dim;
+  double maxloss, mbps, ratio, res_mas, res_rad, lmax;
+  purify_visibility vis, avg;
+
+  strcpy(filename, argc > 1 ? argv[1] : "bk.uv");
+  strcpy(outfile, argc > 2 ? argv[2] : "bk_avg.uv");
+  maxloss = argc > 3 ? atof(argv[3]) : 0.01;
+  dim = argc > 4 ? atoi(argv[4]) : 256;
+
+  purify_visibility_mapfile(&vis, filename, PURIFY_VISIBILITY_FILETYPE_UV, 
+                            &mbps);
+  printf("Number of visibilities: %i \n", vis.nmeas);
+  printf("Parsing throughput: %f MB/s \n", mbps);
+
+  //Bound the smearing loss at the edge of the image.
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * PURIFY_PI;
+  lmax = 0.5 * dim * res_rad;
+
+  ratio = purify_visibility_average(&avg, &vis, maxloss, lmax);
+  printf("Number of averaged visibilities: %i \n", avg.nmeas);
+  printf("Compression ratio: %f \n", ratio);
+
+  if (purify_visibility_writefile(&avg, outfile, 
+                                  PURIFY_VISIBILITY_FILETYPE_UV))
+    PURIFY_ERROR_GENERIC("Failed to write the averaged visibilities");
+
+  purify_visibility_free(&vis);
+  purify_visibility_free(&avg);
+
+  return 0;
+
+}
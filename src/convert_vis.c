@@ -0,0 +1,104 @@
+/*!
+ * \file convert_vis.c
+ * Conversion between the visibility file formats, in particular from
+ * the text formats to the binary columnar format that is loaded by
+ * mapping the file (see \ref purify_visibility_mapbin).
+ *
+ * Usage: convert_vis [input file] [input type] [output file]
+ *                    [output type] [u, v, w error] [y relative error]
+ *
+ * where the types are vis, profile_vis, profile_wis, uv, bin or zvis,
+ * and the input type may also be uvfits.
+ * The error bounds only apply to zvis output (see \ref
+ * purify_visibility_zparam for their defaults).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>
+#include <time.h>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+#include "purify_visibility.h"
+#include "purify_types.h"
+#include "purify_error.h"
+
+double convert_vis_time(void) {
+  #ifdef _OPENMP
+    return omp_get_wtime();
+  #else
+    return (double)clock()/CLOCKS_PER_SEC;
+  #endif
+}
+
+purify_visibility_filetype convert_vis_filetype(const char *name) {
+
+  char buffer[PURIFY_STRLEN];
+
+  if (strcmp(name, "vis") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_VIS;
+  if (strcmp(name, "profile_vis") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS;
+  if (strcmp(name, "profile_wis") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS;
+  if (strcmp(name, "uv") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_UV;
+  if (strcmp(name, "bin") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_BIN;
+  if (strcmp(name, "zvis") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_ZVIS;
+  if (strcmp(name, "uvfits") == 0)
+    return PURIFY_VISIBILITY_FILETYPE_UVFITS;
+
+  sprintf(buffer, "Unknown visibility file type %.64s", name);
+  PURIFY_ERROR_GENERIC(buffer);
+  return PURIFY_VISIBILITY_FILETYPE_VIS;
+
+}
+
+int main(int argc, char *argv[]) {
+
+  char infile[PURIFY_STRLEN];
+  char outfile[PURIFY_STRLEN];
+  purify_visibility_filetype intype, outtype;
+  double t0, tread, twrite;
+  purify_visibility vis;
+  purify_visibility_zparam zparam;
+
+  if (argc < 5) {
+    printf("Usage: convert_vis [input file] [input type] [output file] "
+           "[output type]\n");
+    return 1;
+  }
+  strcpy(infile, argv[1]);
+  intype = convert_vis_filetype(argv[2]);
+  strcpy(outfile, argv[3]);
+  outtype = convert_vis_filetype(argv[4]);
+  purify_visibility_init_zparam(&zparam);
+  if (argc > 5) zparam.uvwerr = atof(argv[5]);
+  if (argc > 6) zparam.yrelerr = atof(argv[6]);
+
+  t0 = convert_vis_time();
+  purify_visibility_readfile(&vis, infile, intype);
+  tread = convert_vis_time() - t0;
+  printf("Number of visibilities: %i \n", vis.nmeas);
+  printf("Time reading %s: %f \n", infile, tread);
+
+  t0 = convert_vis_time();
+  if (outtype == PURIFY_VISIBILITY_FILETYPE_ZVIS) {
+    if (purify_visibility_writez(&vis, outfile, &zparam))
+      PURIFY_ERROR_GENERIC("Failed to write the visibilities");
+  }
+  else if (purify_visibility_writefile(&vis, outfile, outtype))
+    PURIFY_ERROR_GENERIC("Failed to write the visibilities");
+  twrite = convert_vis_time() - t0;
+  printf("Time writing %s: %f \n", outfile, twrite);
+
+  purify_visibility_free(&vis);
+
+  return 0;
+
+}
@@ -0,0 +1,240 @@
+/*!
+ * \file degrid_error.c
+ * Accuracy and runtime of the gridded continuos Fourier transform
+ * operator for the different interpolation kernels and oversampling
+ * factors. The reference is the direct DFT operator evaluated on a
+ * sample of the visibilities.
+ *
+ * Usage: degrid_error [visibility file (.uv)] [number of samples]
+ *                     [image size]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>  // Must be before fftw3.h
+#include <fftw3.h>
+#include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+#include "purify_visibility.h"
+#include "purify_sparsemat.h"
+#include "purify_image.h"
+#include "purify_measurement.h"
+#include "purify_types.h"
+#include "purify_error.h"
+#include "purify_ran.h"
+
+#define NKERNEL 3
+#define NOVERSAMPLING 2
+
+double degrid_error_time(void) {
+  #ifdef _OPENMP
+    return omp_get_wtime();
+  #else
+    return (double)clock()/CLOCKS_PER_SEC;
+  #endif
+}
+
+double degrid_error_relerr(complex double *a, complex double *ref, int n,
+                           double *maxerr) {
+
+  int i;
+  double num = 0.0, den = 0.0, e;
+
+  *maxerr = 0.0;
+  for (i = 0; i < n; i++) {
+    e = cabs(a[i] - ref[i]);
+    num += e*e;
+    den += cabs(ref[i])*cabs(ref[i]);
+    if (e > *maxerr) *maxerr = e;
+  }
+
+  return sqrt(num/den);
+
+}
+
+int main(int argc, char *argv[]) {
+
+  char filename[PURIFY_STRLEN];
+  int i, j, k, o, nsample, stride, dim, Nx, seed = 13;
+  double res_mas, res_rad;
+  double t0, tinit, tfwd, tadj, tdftfwd, tdftadj;
+  double errfwd, erradj, maxfwd, maxadj;
+  purify_visibility vis;
+  purify_measurement_cparam param;
+  purify_sparsemat_row gmat;
+  double *u, *v, *deconv, *deconv_dft;
+  complex double *xin, *xdft, *xgrid;
+  complex double *ydft, *ygrid;
+  complex double *fft_temp;
+  purify_measurement_workspace fft_ws;
+  fftw_plan planfwd, planadj;
+  void *datafwd[5];
+  void *dataadj[5];
+  void *datadft[4];
+
+  purify_measurement_kernel kernels[NKERNEL] = {
+    PURIFY_MEASUREMENT_KERNEL_NGB,
+    PURIFY_MEASUREMENT_KERNEL_GAUSS,
+    PURIFY_MEASUREMENT_KERNEL_WAVELET };
+  const char *kernel_names[NKERNEL] = {"ngb", "gauss", "wavelet"};
+  int kernel_support[NKERNEL] = {1, 5, 10};
+  int oversampling[NOVERSAMPLING] = {2, 4};
+
+  strcpy(filename, argc > 1 ? argv[1] : "bk.uv");
+  nsample = argc > 2 ? atoi(argv[2]) : 1000;
+  dim = argc > 3 ? atoi(argv[3]) : 256;
+
+  //Read coverage and keep a regular sample of it.
+  purify_visibility_readfile(&vis, filename, PURIFY_VISIBILITY_FILETYPE_UV);
+  printf("Number of visibilities: %i \n", vis.nmeas);
+  if (nsample > vis.nmeas) nsample = vis.nmeas;
+  stride = vis.nmeas / nsample;
+  printf("Number of sampled visibilities: %i \n\n", nsample);
+
+  u = (double*)malloc(nsample * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(u);
+  v = (double*)malloc(nsample * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(v);
+  for (i = 0; i < nsample; i++) {
+    u[i] = vis.u[i*stride];
+    v[i] = vis.v[i*stride];
+  }
+
+  Nx = dim*dim;
+  deconv = (double*)malloc(Nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  deconv_dft = (double*)malloc(Nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv_dft);
+  xin = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xin);
+  xdft = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xdft);
+  xgrid = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xgrid);
+  ydft = (complex double*)malloc(nsample * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ydft);
+  ygrid = (complex double*)malloc(nsample * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ygrid);
+
+  //Test image: extended Gaussian plus a few point sources.
+  for (j = 0; j < dim; j++) {
+    for (i = 0; i < dim; i++) {
+      double dx = (i - dim/2) / (0.05*dim);
+      double dy = (j - dim/2) / (0.08*dim);
+      xin[j*dim + i] = exp(-0.5*(dx*dx + dy*dy)) + 0.0*I;
+    }
+  }
+  purify_ran_ran2(-seed);
+  for (k = 0; k < 8; k++) {
+    i = dim/4 + (int)(purify_ran_ran2(seed) * dim/2);
+    j = dim/4 + (int)(purify_ran_ran2(seed) * dim/2);
+    xin[j*dim + i] += 2.0;
+  }
+  for (i = 0; i < Nx; i++) deconv_dft[i] = 1.0;
+
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * PURIFY_PI;
+
+  printf("%-8s %3s %4s %10s %10s %10s %12s %12s %12s\n",
+         "kernel", "of", "supp", "init[s]", "fwd[s]", "adj[s]",
+         "fwd relerr", "fwd maxerr", "adj relerr");
+
+  for (o = 0; o < NOVERSAMPLING; o++) {
+
+    purify_measurement_init_cparam(&param);
+    param.nmeas = nsample;
+    param.nx1 = dim;
+    param.ny1 = dim;
+    param.ofx = oversampling[o];
+    param.ofy = oversampling[o];
+    param.umax = 1.0 / res_rad / 2.;
+    param.vmax = param.umax;
+
+    //Reference visibilities and image.
+    datadft[0] = (void*)&param;
+    datadft[1] = (void*)deconv_dft;
+    datadft[2] = (void*)u;
+    datadft[3] = (void*)v;
+    t0 = degrid_error_time();
+    purify_measurement_dftfwd((void*)ydft, (void*)xin, datadft);
+    tdftfwd = degrid_error_time() - t0;
+    t0 = degrid_error_time();
+    purify_measurement_dftadj((void*)xdft, (void*)ydft, datadft);
+    tdftadj = degrid_error_time() - t0;
+
+    purify_measurement_init_workspace(&fft_ws, Nx * param.ofx * param.ofy);
+    fft_temp = purify_measurement_workspace_acquire(&fft_ws);
+    planfwd = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy,
+                               fft_temp, fft_temp,
+                               FFTW_FORWARD, FFTW_ESTIMATE);
+    planadj = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy,
+                               fft_temp, fft_temp,
+                               FFTW_BACKWARD, FFTW_ESTIMATE);
+    purify_measurement_workspace_release(&fft_ws, fft_temp);
+
+    for (k = 0; k < NKERNEL; k++) {
+
+      param.kernel = kernels[k];
+      param.kx = kernel_support[k];
+      param.ky = kernel_support[k];
+
+      t0 = degrid_error_time();
+      purify_measurement_init_cft(&gmat, deconv, u, v, &param);
+      tinit = degrid_error_time() - t0;
+
+      datafwd[0] = (void*)&param;
+      datafwd[1] = (void*)deconv;
+      datafwd[2] = (void*)&gmat;
+      datafwd[3] = (void*)&planfwd;
+      datafwd[4] = (void*)&fft_ws;
+
+      dataadj[0] = (void*)&param;
+      dataadj[1] = (void*)deconv;
+      dataadj[2] = (void*)&gmat;
+      dataadj[3] = (void*)&planadj;
+      dataadj[4] = (void*)&fft_ws;
+
+      t0 = degrid_error_time();
+      purify_measurement_cftfwd((void*)ygrid, (void*)xin, datafwd);
+      tfwd = degrid_error_time() - t0;
+      t0 = degrid_error_time();
+      purify_measurement_cftadj((void*)xgrid, (void*)ydft, dataadj);
+      tadj = degrid_error_time() - t0;
+
+      errfwd = degrid_error_relerr(ygrid, ydft, nsample, &maxfwd);
+      erradj = degrid_error_relerr(xgrid, xdft, Nx, &maxadj);
+
+      printf("%-8s %3d %4d %10.4f %10.4f %10.4f %12.4e %12.4e %12.4e\n",
+             kernel_names[k], param.ofx, kernel_support[k],
+             tinit, tfwd, tadj, errfwd, maxfwd, erradj);
+
+      purify_sparsemat_freer(&gmat);
+    }
+
+    printf("%-8s %3d %4s %10s %10.4f %10.4f\n",
+           "dft", param.ofx, "-", "-", tdftfwd, tdftadj);
+
+    fftw_destroy_plan(planfwd);
+    fftw_destroy_plan(planadj);
+    purify_measurement_free_workspace(&fft_ws);
+  }
+
+  purify_visibility_free(&vis);
+  free(u);
+  free(v);
+  free(deconv);
+  free(deconv_dft);
+  free(xin);
+  free(xdft);
+  free(xgrid);
+  free(ydft);
+  free(ygrid);
+
+  return 0;
+
+}
@@ -0,0 +1,226 @@
+/*!
+ * \file mpi_scaling.c
+ * Strong scaling benchmark of the MPI distributed operators: the
+ * operator with the visibilities partitioned across the ranks (see
+ * \ref purify_measurement_mpicftadj) and the operator with the image
+ * and grid distributed in slabs (see \ref purify_measurement_slabcftadj).
+ * The time per forward plus adjoint application of each is reported
+ * together with the time of the threaded single process operator and
+ * the relative difference to it. Run with increasing numbers of ranks,
+ * e.g. mpirun -np 4 mpi_scaling bk.uv 256 10.
+ *
+ * Usage: mpi_scaling [visibility file (.uv)] [image size]
+ *                    [number of iterations]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>  // Must be before fftw3.h
+#include <fftw3.h>
+#include <math.h>
+#include "purify_visibility.h"
+#include "purify_sparsemat.h"
+#include "purify_measurement.h"
+#include "purify_types.h"
+#include "purify_error.h"
+
+int main(int argc, char *argv[]) {
+
+#ifdef PURIFY_MPI
+
+  char filename[PURIFY_STRLEN];
+  int i, k, rank, nprocs, dim, niter, Nx, nmeas;
+  double res_mas, res_rad, t0, t, tmax, tslab, tref, num, den, errslab;
+  double *u, *v;
+  MPI_Comm comm;
+  purify_visibility vis, local;
+  purify_measurement_cparam param, fparam;
+  purify_sparsemat_row gmat, fgmat;
+  purify_measurement_slab slab;
+  purify_measurement_workspace fft_ws;
+  fftw_plan planfwd, planadj;
+  double *deconv;
+  complex double *xin, *xout, *xref, *y, *yref, *fft_temp;
+  complex double *xmpi, *xslab, *yslab;
+  void *datafwd[6];
+  void *dataslab[1];
+  void *dataadj[6];
+
+  MPI_Init(&argc, &argv);
+  comm = MPI_COMM_WORLD;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nprocs);
+
+  strcpy(filename, argc > 1 ? argv[1] : "bk.uv");
+  dim = argc > 2 ? atoi(argv[2]) : 256;
+  niter = argc > 3 ? atoi(argv[3]) : 10;
+
+  //Read on rank 0 and partition the visibilities.
+  if (rank == 0)
+    purify_visibility_readfile(&vis, filename, 
+                               PURIFY_VISIBILITY_FILETYPE_UV);
+  purify_visibility_mpi_scatter(&local, &vis, 0, comm);
+
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * PURIFY_PI;
+  purify_measurement_init_cparam(&param);
+  param.nmeas = local.nmeas;
+  param.nx1 = dim;
+  param.ny1 = dim;
+  param.umax = 1.0 / res_rad / 2.;
+  param.vmax = param.umax;
+  param.kernel = PURIFY_MEASUREMENT_KERNEL_GAUSS;
+  param.kx = 4;
+  param.ky = 4;
+
+  Nx = dim*dim;
+  deconv = (double*)malloc(Nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  xin = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xin);
+  xout = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
+  xmpi = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xmpi);
+  y = (complex double*)malloc((local.nmeas + 1) * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(y);
+  for (i = 0; i < Nx; i++)
+    xin[i] = exp(-0.5 * pow((i % dim - dim/2) / (0.05*dim), 2) 
+                 - 0.5 * pow((i / dim - dim/2) / (0.08*dim), 2));
+
+  purify_measurement_init_cft(&gmat, deconv, local.u, local.v, &param);
+  purify_measurement_init_workspace(&fft_ws, Nx*param.ofx*param.ofy);
+  fft_temp = purify_measurement_workspace_acquire(&fft_ws);
+  planfwd = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy,
+                             fft_temp, fft_temp, 
+                             FFTW_FORWARD, FFTW_MEASURE);
+  planadj = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy,
+                             fft_temp, fft_temp, 
+                             FFTW_BACKWARD, FFTW_MEASURE);
+  purify_measurement_workspace_release(&fft_ws, fft_temp);
+
+  datafwd[0] = (void*)&param;
+  datafwd[1] = (void*)deconv;
+  datafwd[2] = (void*)&gmat;
+  datafwd[3] = (void*)&planfwd;
+  datafwd[4] = (void*)&fft_ws;
+  datafwd[5] = (void*)&comm;
+  for (k = 0; k < 6; k++) dataadj[k] = datafwd[k];
+  dataadj[3] = (void*)&planadj;
+
+  //Timed applications of the distributed operators.
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  for (k = 0; k < niter; k++) {
+    purify_measurement_mpicftfwd((void*)y, (void*)xin, datafwd);
+    purify_measurement_mpicftadj((void*)xout, (void*)y, dataadj);
+  }
+  t = (MPI_Wtime() - t0) / niter;
+  MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  memcpy(xmpi, xout, Nx * sizeof(complex double));
+
+  //All visibilities on every rank for the slab operator.
+  if (rank == 0)
+    nmeas = vis.nmeas;
+  MPI_Bcast(&nmeas, 1, MPI_INT, 0, comm);
+  u = rank == 0 ? vis.u : (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(u);
+  v = rank == 0 ? vis.v : (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(v);
+  MPI_Bcast(u, nmeas, MPI_DOUBLE, 0, comm);
+  MPI_Bcast(v, nmeas, MPI_DOUBLE, 0, comm);
+
+  fparam = param;
+  fparam.nmeas = nmeas;
+  purify_measurement_init_slab(&slab, u, v, &fparam, comm);
+  dataslab[0] = (void*)&slab;
+  xslab = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xslab);
+  yslab = (complex double*)malloc(nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(yslab);
+
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  for (k = 0; k < niter; k++) {
+    purify_measurement_slabcftfwd((void*)yslab, 
+                                  (void*)(xin + rank*slab.nimg*dim), 
+                                  dataslab);
+    purify_measurement_slabcftadj((void*)xout, (void*)yslab, dataslab);
+  }
+  t = (MPI_Wtime() - t0) / niter;
+  MPI_Reduce(&t, &tslab, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Gather(xout, 2*slab.nimg*dim, MPI_DOUBLE, 
+             xslab, 2*slab.nimg*dim, MPI_DOUBLE, 0, comm);
+  if (rank != 0) {
+    free(u);
+    free(v);
+  }
+
+  //Single process reference on rank 0.
+  if (rank == 0) {
+    fparam = param;
+    fparam.nmeas = vis.nmeas;
+    xref = (complex double*)malloc(Nx * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(xref);
+    yref = (complex double*)malloc(vis.nmeas * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(yref);
+    purify_measurement_init_cft(&fgmat, deconv, vis.u, vis.v, &fparam);
+    datafwd[0] = (void*)&fparam;
+    datafwd[2] = (void*)&fgmat;
+    dataadj[0] = (void*)&fparam;
+    dataadj[2] = (void*)&fgmat;
+    t0 = MPI_Wtime();
+    for (k = 0; k < niter; k++) {
+      purify_measurement_cftfwd((void*)yref, (void*)xin, datafwd);
+      purify_measurement_cftadj((void*)xref, (void*)yref, dataadj);
+    }
+    tref = (MPI_Wtime() - t0) / niter;
+    num = 0.0;
+    errslab = 0.0;
+    den = 0.0;
+    for (i = 0; i < Nx; i++) {
+      num += pow(cabs(xmpi[i] - xref[i]), 2);
+      errslab += pow(cabs(xslab[i] - xref[i]), 2);
+      den += pow(cabs(xref[i]), 2);
+    }
+
+    printf("%6s %10s %14s %12s %14s %12s %14s\n", "ranks", "vis/rank", 
+           "partition[s]", "relerr", "slab[s]", "relerr", "single[s]");
+    printf("%6d %10d %14.6f %12.4e %14.6f %12.4e %14.6f\n", nprocs, 
+           vis.nmeas / nprocs, tmax, sqrt(num / den), 
+           tslab, sqrt(errslab / den), tref);
+
+    purify_sparsemat_freer(&fgmat);
+    purify_visibility_free(&vis);
+    free(xref);
+    free(yref);
+  }
+
+  fftw_destroy_plan(planfwd);
+  fftw_destroy_plan(planadj);
+  purify_measurement_free_workspace(&fft_ws);
+  purify_sparsemat_freer(&gmat);
+  purify_measurement_free_slab(&slab);
+  purify_visibility_free(&local);
+  free(deconv);
+  free(xmpi);
+  free(xslab);
+  free(yslab);
+  free(xin);
+  free(xout);
+  free(y);
+
+  MPI_Finalize();
+
+  return 0;
+
+#else
+
+  printf("mpi_scaling requires a build with PURIFY_MPI (see makefile)\n");
+  return 1;
+
+#endif
+
+}
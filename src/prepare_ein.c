@@ -80,7 +80,7 @@ int main(int argc, char *argv[]) {
   purify_measurement_cparam param_m1;
   purify_measurement_cparam param_m2;
   complex double *fft_temp1;
-  complex double *fft_temp2;
+  purify_measurement_workspace fft_ws;
   void *datafwd[5];
   void *dataadj[5];
   fftw_plan planfwd;
@@ -137,6 +137,7 @@ int main(int argc, char *argv[]) {
   printf("Image dimension: %i, %i \n\n", img.nx, img.ny); 
 //  purify_image_writefile(&img, "data/test/Einstein_double.fits", filetype_img);
 
+  purify_measurement_init_cparam(&param_m1);
   param_m1.nmeas = vis_test.nmeas;
   param_m1.ny1 = dimy;
   param_m1.nx1 = dimx;
@@ -144,7 +145,9 @@ int main(int argc, char *argv[]) {
   param_m1.ofx = 2;
   param_m1.ky = 1;
   param_m1.kx = 1;
+  param_m1.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
+  purify_measurement_init_cparam(&param_m2);
   param_m2.nmeas = vis_test.nmeas;
   param_m2.ny1 = dimy;
   param_m2.nx1 = dimx;
@@ -152,6 +155,7 @@ int main(int argc, char *argv[]) {
   param_m2.ofx = 2;
   param_m2.ky = 1;
   param_m2.kx = 1;
+  param_m2.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
   Nb = 9;
   Nx=param_m2.ny1*param_m2.nx1;
@@ -214,12 +218,10 @@ int main(int argc, char *argv[]) {
     deconv[i] = 1.0;
   }
   
-  //Memory allocation for the fft
+  //Pool of grids for the fft, shared by both operators
   i = Nx*param_m1.ofy*param_m1.ofx;
-  fft_temp1 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp1);
-  fft_temp2 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp2);
+  purify_measurement_init_workspace(&fft_ws, i);
+  fft_temp1 = purify_measurement_workspace_acquire(&fft_ws);
 
   //FFT plan  
   planfwd = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
@@ -227,21 +229,23 @@ int main(int argc, char *argv[]) {
               FFTW_FORWARD, FFTW_MEASURE);
 
   planadj = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
-              fft_temp2, fft_temp2, 
+              fft_temp1, fft_temp1, 
               FFTW_BACKWARD, FFTW_MEASURE);
 
+  purify_measurement_workspace_release(&fft_ws, fft_temp1);
+
 
   datafwd[0] = (void*)&param_m1;
   datafwd[1] = (void*)deconv;
   datafwd[2] = (void*)&gmat;
   datafwd[3] = (void*)&planfwd;
-  datafwd[4] = (void*)fft_temp1;
+  datafwd[4] = (void*)&fft_ws;
 
   dataadj[0] = (void*)&param_m2;
   dataadj[1] = (void*)deconv;
   dataadj[2] = (void*)&gmat;
   dataadj[3] = (void*)&planadj;
-  dataadj[4] = (void*)fft_temp2;
+  dataadj[4] = (void*)&fft_ws;
 
 
   printf("FFT plan done \n\n");
@@ -260,25 +264,20 @@ int main(int argc, char *argv[]) {
   a = cblas_dznrm2(Ny, (void*)y0, 1);
   sigma = a*pow(10.0,-(snr/20.0))/sqrt(Ny);
 
-  FILE *fout = fopen("ein.uv", "w");
-  FILE *fvis = fopen("ein.vis", "w");
-    
   for (i=0; i < Ny; i++) {
 //      noise[i] = (sopt_ran_gasdev2(seedn) + sopt_ran_gasdev2(seedn)*I)*(sigma/sqrt(2));
       noise[i] = 0;
       y[i] = y0[i] + noise[i];
-
-    fprintf(fout, "%14.5e%14.5e%14.5e%14.5e%14.5e%14.5e\n", 
-            vis_test.u[i], vis_test.v[i], vis_test.w[i],
-            creal(y[i]), cimag(y[i]), 1.0);
-
-    fprintf(fvis, "%6d  %14.5e%14.5e%14.5e%14.5e%14.5e%14.5e%14.5e\n", 
-            i, vis_test.u[i], vis_test.v[i], vis_test.w[i],
-            creal(y[i]), cimag(y[i]), 1.0, 0.0);
+      vis_test.y[i] = y[i];
+      vis_test.noise_std[i] = 1.0;
   }
 
-  fclose(fout);
-  fclose(fvis);
+  purify_visibility_writefile(&vis_test, "ein.uv", 
+                              PURIFY_VISIBILITY_FILETYPE_UV);
+  purify_visibility_writefile(&vis_test, "ein.vis", 
+                              PURIFY_VISIBILITY_FILETYPE_VIS);
+  purify_visibility_writefile(&vis_test, "ein.bin", 
+                              PURIFY_VISIBILITY_FILETYPE_BIN);
 
   //Rescaling the measurements
 
@@ -1032,8 +1031,7 @@ int main(int argc, char *argv[]) {
   free(dict_types1);
   free(dict_types2);
 
-  free(fft_temp1);
-  free(fft_temp2);
+  purify_measurement_free_workspace(&fft_ws);
   fftw_destroy_plan(planfwd);
   fftw_destroy_plan(planadj);
   purify_sparsemat_freer(&gmat);
@@ -5,9 +5,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h> 
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
 #include <complex.h>  // Must be before fftw3.h
 #include <fftw3.h>
+#ifdef _OPENMP 
+  #include <omp.h>
+#endif 
 #ifdef __APPLE__
   #include <Accelerate/Accelerate.h>
 #elif __unix__
@@ -24,6 +33,13 @@
 #include "purify_measurement.h" 
 #include "purify_ran.h"  
 
+#define NGCF 301
+
+// Lanes rotated together when generating DFT phasors and interval
+// (in samples) between direct evaluations of the phasors.
+#define PURIFY_MEASUREMENT_DFT_BLOCK 8
+#define PURIFY_MEASUREMENT_DFT_SYNC 256
+
 
 /*!
  * Compute forward Fouier transform of real signal.  A real-to-complex
@@ -228,79 +244,442 @@ void purify_measurement_opfwd(void *out, void *in, void **data) {
 
 }
 
+/*!
+ * Set the parameters of the continuos Fourier transform operator to
+ * their default values (no oversampling, nearest neighbour kernel).
+ * Callers fill in the image size, number of measurements and band
+ * limits afterwards.
+ *
+ * \param[out] param structure storing information for the operator
+ */
+void purify_measurement_init_cparam(purify_measurement_cparam *param) {
+
+  param->nmeas = 0;
+  param->ny1 = 0;
+  param->nx1 = 0;
+  param->ofy = 2;
+  param->ofx = 2;
+  param->ky = 1;
+  param->kx = 1;
+  param->kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
+  param->umax = 0.0;
+  param->vmax = 0.0;
+  param->l0 = 0.0;
+  param->m0 = 0.0;
+
+}
+
+/*!
+ * Initialise an empty pool of grids.
+ *
+ * \param[out] ws Workspace pool.
+ * \param[in] size Number of complex elements of each grid.
+ */
+void purify_measurement_init_workspace(purify_measurement_workspace *ws,
+                                       int size) {
+
+  ws->size = size;
+  ws->ngrids = 0;
+  ws->grids = NULL;
+  ws->busy = NULL;
+
+}
+
+/*!
+ * Take a free grid from the pool, allocating a new one if all of them
+ * are in use. Safe to call from several threads.
+ *
+ * \param[in,out] ws Workspace pool.
+ * \retval grid Grid of ws->size elements, aligned as required by FFTW
+ * plans created on grids of the same pool.
+ */
+complex double *purify_measurement_workspace_acquire(purify_measurement_workspace *ws) {
+
+  int i;
+  complex double *grid = NULL;
+
+  #pragma omp critical (purify_measurement_workspace)
+  {
+    for (i = 0; i < ws->ngrids && grid == NULL; i++) {
+      if (!ws->busy[i]) {
+        ws->busy[i] = 1;
+        grid = ws->grids[i];
+      }
+    }
+    if (grid == NULL) {
+      ws->grids = (complex double**)realloc(ws->grids, (ws->ngrids + 1)
+                                            * sizeof(complex double*));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(ws->grids);
+      ws->busy = (int*)realloc(ws->busy, (ws->ngrids + 1) * sizeof(int));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(ws->busy);
+      grid = (complex double*)purify_utils_malloc((size_t)ws->size 
+                                                  * sizeof(complex double));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(grid);
+      ws->grids[ws->ngrids] = grid;
+      ws->busy[ws->ngrids] = 1;
+      ws->ngrids++;
+    }
+  }
+
+  return grid;
+
+}
+
+/*!
+ * Return a grid to the pool.
+ *
+ * \param[in,out] ws Workspace pool.
+ * \param[in] grid Grid obtained from \ref
+ * purify_measurement_workspace_acquire.
+ */
+void purify_measurement_workspace_release(purify_measurement_workspace *ws,
+                                          complex double *grid) {
+
+  int i;
+
+  #pragma omp critical (purify_measurement_workspace)
+  {
+    for (i = 0; i < ws->ngrids; i++) {
+      if (ws->grids[i] == grid)
+        ws->busy[i] = 0;
+    }
+  }
+
+}
+
+/*!
+ * Free all the grids of a pool.
+ *
+ * \param[in,out] ws Workspace pool.
+ */
+void purify_measurement_free_workspace(purify_measurement_workspace *ws) {
+
+  int i;
+
+  for (i = 0; i < ws->ngrids; i++)
+    purify_utils_free(ws->grids[i]);
+  if (ws->grids != NULL) free(ws->grids);
+  if (ws->busy != NULL) free(ws->busy);
+  ws->ngrids = 0;
+  ws->grids = NULL;
+  ws->busy = NULL;
+
+}
+
 /*!
  * Initialization for the continuos Fourier transform operator.
  * 
  * \param[out] mat (purify_sparsemat_row*) Sparse matrix containing
  * the interpolation kernels for each visibility. The matrix is 
  * stored in compressed row storage format.
- * \param[out] deconv (double*) Deconvolution kernel in real space
+ * \param[out] deconv (double*) Deconvolution kernel in real space,
+ * see \ref purify_measurement_init_deconv (NULL to skip).
  * \param[in] u (double*) u coodinates between -pi and pi
  * \param[in] v (double*) v coodinates between -pi and pi
  * \param[in] param structure storing information for the operator
  *
+ * \note The kernel is selected with param->kernel. The Gaussian
+ * kernel uses kx by ky cells (rounded up to odd sizes), the D20
+ * wavelet kernel has a fixed support of 10 by 10 cells and is read
+ * from D20.phi in the working directory. If param->l0 or param->m0 is
+ * not zero, the phase factor \f$e^{-2\pi i(u l_0 + v m_0)}\f$ of each
+ * visibility is folded into its row, so the matrix is complex and the
+ * operators re-point the image at no extra cost per application.
+ *
  * \authors Rafael Carrillo
  */
 void purify_measurement_init_cft(purify_sparsemat_row *mat, 
                                  double *deconv, double *u, double *v, 
                                  purify_measurement_cparam *param) {
 
-    int i, j, k, l;
+    int i, j;
     int nx2, ny2;
     int row, numel;
+    int nmaskx, nmasky;
     double uinc, vinc;
+    double *convfn = NULL;
+    double tgtocgx = 0.0, tgtocgy = 0.0;
+    char buffer[PURIFY_STRLEN];
  
     //Sparse matrix initialization
     nx2 = param->ofx*param->nx1;
     ny2 = param->ofy*param->ny1;
 
+    //Kernel tables
+    switch (param->kernel) {
+
+    case PURIFY_MEASUREMENT_KERNEL_NGB:
+      nmaskx = 0;
+      nmasky = 0;
+      numel = 1;
+      break;
+
+    case PURIFY_MEASUREMENT_KERNEL_GAUSS:
+      // initialize gauss kernel, according to difmap
+      nmaskx = param->kx / 2;
+      nmasky = param->ky / 2;
+      numel = (2 * nmaskx + 1) * (2 * nmasky + 1);
+      convfn = (double*)malloc(NGCF * sizeof(double));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(convfn);
+      {
+        double hwhm = 0.7;
+        double recvar = log(2.0) / hwhm / hwhm;
+        // Table sampled in units of 1/tgtocg cells.
+        tgtocgx = (NGCF - 1) / (purify_max(nmaskx, nmasky) + 0.5);
+        tgtocgy = tgtocgx;
+        for (i = 0; i < NGCF; ++i) {
+          convfn[i] = exp(-recvar * i * i / tgtocgx / tgtocgx);
+        }
+      }
+      break;
+
+    case PURIFY_MEASUREMENT_KERNEL_WAVELET:
+      // initialize wavelet kernel
+      nmaskx = 9;
+      nmasky = 9;
+      numel = (nmaskx + 1) * (nmasky + 1);
+      {
+        int D = 20, dummy, q, len;
+        FILE *fwav;
+        sprintf(buffer, "D%d.phi", D);
+        fwav = fopen(buffer, "rb");
+        if (fwav == NULL) {
+          sprintf(buffer, "Failed to open wavelet kernel file D%d.phi", D);
+          PURIFY_ERROR_GENERIC(buffer);
+        }
+        if (fread(&dummy, sizeof(int), 1, fwav) != 1 || dummy != D)
+          PURIFY_ERROR_GENERIC("Wrong wavelet number in kernel file");
+        if (fread(&q, sizeof(int), 1, fwav) != 1)
+          PURIFY_ERROR_GENERIC("Failed to read wavelet kernel file");
+        len = (1 << q) * (D - 1);
+        tgtocgx = 1 << q;
+        tgtocgy = 1 << q;
+        convfn = (double*)malloc(len * sizeof(double));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(convfn);
+        if (fread(convfn, sizeof(double), len, fwav) != len)
+          PURIFY_ERROR_GENERIC("Failed to read wavelet kernel file");
+        fclose(fwav);
+      }
+      break;
+
+    default:
+      sprintf(buffer, "Interpolation kernel with id %d is not supported", 
+              param->kernel);
+      PURIFY_ERROR_GENERIC(buffer);
+      return;
+    }
+
     mat->nrows = param->nmeas;
     mat->ncols = nx2*ny2;
-    mat->nvals = param->kx*param->ky*param->nmeas;
+    mat->nvals = numel*param->nmeas;
     mat->real = 1;
     mat->cvals = NULL;
-    numel = param->kx*param->ky;
  
-    mat->vals = (double*)malloc(mat->nvals * sizeof(double));
+    mat->vals = (double*)purify_utils_malloc(mat->nvals * sizeof(double));
     PURIFY_ERROR_MEM_ALLOC_CHECK(mat->vals);
-    mat->colind = (int*)malloc(mat->nvals * sizeof(int));
+    mat->colind = (int*)purify_utils_malloc(mat->nvals * sizeof(int));
     PURIFY_ERROR_MEM_ALLOC_CHECK(mat->colind);
-    mat->rowptr = (int*)malloc((mat->nrows + 1) * sizeof(int));
+    mat->rowptr = (int*)purify_utils_malloc((mat->nrows + 1) * sizeof(int));
     PURIFY_ERROR_MEM_ALLOC_CHECK(mat->rowptr);
 
     uinc = param->umax / (nx2 / 2);
     vinc = param->vmax / (ny2 / 2);
 
-//    uinc = 4.0 * M_PI / nx2;
-//    vinc = 4.0 * M_PI / ny2;
-
 // Row pointer vector
     for (j = 0; j < mat->nrows + 1; j++){
         mat->rowptr[j] = j*numel;
     }
 
-    int idu, idv;
+    int idu, idv, iv, iu, iv2, iu2, counter; 
+    int iu0, iv0;
+    double ufrc, vfrc;
+    double fv, fu;
   //Main loop
     for (i=0; i < param->nmeas; i++){
 
-    //Row pointer
-        row = i*numel;
+        ufrc = u[i] / uinc;
+        vfrc = v[i] / vinc;
+        row = i * numel;
+
+        if (param->kernel == PURIFY_MEASUREMENT_KERNEL_WAVELET) {
+          // always the smaller pixel:
+          idu = floor(ufrc);
+          idv = floor(vfrc);
+          iu0 = idu - nmaskx;
+          iv0 = idv - nmasky;
+        }
+        else {
+          idu = floor(ufrc + 0.5);
+          idv = floor(vfrc + 0.5);
+          iu0 = idu - nmaskx;
+          iv0 = idv - nmasky;
+          idu += nmaskx;
+          idv += nmasky;
+        }
+
+        counter = 0;
+        for(iv = iv0; iv <= idv; ++iv){
+            fv = (convfn == NULL) ? 1.0 :
+              convfn[(int) (tgtocgy * fabs(iv - vfrc) + 0.5)];
+            for(iu = iu0; iu <= idu; ++iu){
+                fu = (convfn == NULL) ? 1.0 :
+                  convfn[(int) (tgtocgx * fabs(iu - ufrc) + 0.5)];
+
+                iu2 = iu; iv2 = iv;
+                if(iu2 < 0) iu2 += nx2;
+                if(iu2 >= nx2) iu2 -= nx2;
+
+                if(iv2 < 0) iv2 += ny2;
+                if(iv2 >= ny2) iv2 -= ny2;
+
+                mat->vals[row + counter] = fv * fu;
+                mat->colind[row + counter] = iv2 * nx2 + iu2;
+
+                counter++;
+            } // for iu
+        } // for iv
+    } // for nmeas
+
+    //Phase centre shift folded into the interpolation weights.
+    if (param->l0 != 0.0 || param->m0 != 0.0) {
+        mat->cvals = (complex double*)purify_utils_malloc(mat->nvals * sizeof(complex double));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(mat->cvals);
+        #pragma omp parallel for private(j)
+        for (i = 0; i < param->nmeas; i++){
+            complex double phasor = cexp(-2.0 * PURIFY_PI * I 
+                                         * (u[i] * param->l0 + v[i] * param->m0));
+            for (j = mat->rowptr[i]; j < mat->rowptr[i+1]; j++)
+                mat->cvals[j] = mat->vals[j] * phasor;
+        }
+        purify_utils_free(mat->vals);
+        mat->vals = NULL;
+        mat->real = 0;
+    }
+
+    if (deconv != NULL)
+      purify_measurement_init_deconv(deconv, param);
+
+    if (convfn != NULL) free(convfn);
+}
+
+/*!
+ * Deconvolution kernel in image space of the continuos Fourier
+ * transform operator. It only depends on the image size and the
+ * kernel, so it can be set before any visibility is read.
+ *
+ * \param[out] deconv Deconvolution kernel (nx1*ny1).
+ * \param[in] param Parameters of the operator.
+ */
+void purify_measurement_init_deconv(double *deconv, 
+                                    purify_measurement_cparam *param) {
+
+  int i;
+
+  for (i = 0; i < param->nx1 * param->ny1; i++)
+    deconv[i] = 1.0;
 
-        idu = floor(u[i] / uinc + 0.5);
-        if(idu < 0) idu += nx2;
-        if(idu >= nx2) idu -= nx2;
+}
+
+/*!
+ * Zero pad, deconvolve and Fourier transform an image onto the
+ * oversampled grid (first stage of \ref purify_measurement_cftfwd).
+ *
+ * \param[out] temp Oversampled grid.
+ * \param[in] xin Input image.
+ * \param[in] deconv Deconvolution kernel in image space.
+ * \param[in] param Parameters of the operator.
+ * \param[in] plan Forward complex-to-complex FFTW plan (the FFT is
+ * left to the caller if NULL).
+ */
+static void purify_measurement_cft_grid(complex double *temp, 
+                                        complex double *xin,
+                                        double *deconv,
+                                        purify_measurement_cparam *param,
+                                        fftw_plan *plan) {
+
+  int i, j, nx2, ny2;
+  int st1, st2;
+  double scale;
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+  
+  //Zero padding and decovoluntion. 
+  //Original image in the center.
+  for (i=0; i < nx2*ny2; i++){
+    *(temp + i) = 0.0 + 0.0*I;
+  }
+
+  //Scaling
+  scale = 1/sqrt((double)(nx2*ny2));
 
-        idv = floor(v[i] / vinc + 0.5);
-        if(idv < 0) idv += ny2;
-        if(idv >= ny2) idv -= ny2;
+  int npadx = (nx2 - param->nx1) / 2;
+  int npady = (ny2 - param->ny1) / 2;
 
-        mat->vals[row] = 1.0;
-        mat->colind[row] = idv * nx2 + idu;
+  for (j=0; j < param->ny1; j++){
+    st1 = j * param->nx1;
+    st2 = (j + npady) * nx2;
+    for (i=0; i < param->nx1; i++){
+        *(temp + st2 + i + npadx) = *(xin + st1 + i) * scale;
+        *(temp + st2 + i + npadx) *= *(deconv + st1 + i);
     }
+  }
+
+  purify_utils_fftshift_2d_c(temp, nx2, ny2);
+
+  //FFT
+  if (plan != NULL)
+    fftw_execute_dft(*plan, temp, temp);
+
+}
+
+/*!
+ * Inverse Fourier transform the oversampled grid, crop and deconvolve
+ * (last stage of \ref purify_measurement_cftadj).
+ *
+ * \param[out] xout Output image.
+ * \param[in,out] temp Oversampled grid (overwritten).
+ * \param[in] deconv Deconvolution kernel in image space.
+ * \param[in] param Parameters of the operator.
+ * \param[in] plan Backward complex-to-complex FFTW plan (the grid is
+ * already transformed if NULL).
+ */
+static void purify_measurement_cft_image(complex double *xout, 
+                                         complex double *temp,
+                                         double *deconv,
+                                         purify_measurement_cparam *param,
+                                         fftw_plan *plan) {
+
+  int i, j, nx2, ny2;
+  int st1, st2;
+  double scale;
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+
+  //Inverse FFT
+  if (plan != NULL)
+    fftw_execute_dft(*plan, temp, temp);
+  //Scaling
+  scale = 1/sqrt((double)(nx2*ny2));
 
-    for(i = 0; i < param->nx1 * param->ny1; ++i){
-        deconv[i] = 1.0;
+  purify_utils_fftshift_2d_c(temp, nx2, ny2);
+  
+  //Cropping and decovoluntion. 
+  //Top left corner of the image corresponf to the original image.
+
+  int npadx = (nx2 - param->nx1) / 2;
+  int npady = (ny2 - param->ny1) / 2;
+
+  for (j=0; j < param->ny1; j++){
+    st1 = j * param->nx1;
+    st2 = (j + npady) * nx2;
+    for (i=0; i < param->nx1; i++){
+      *(xout + st1 + i) = *(temp + st2 + i + npadx) * scale;
+      *(xout + st1 + i) *= *(deconv + st1 + i);
     }
+  }
+
 }
 
 /*!
@@ -319,69 +698,44 @@ void purify_measurement_init_cft(purify_sparsemat_row *mat,
  * - data[3] (fftw_plan*): The complex-to-complex FFTW plan to use when
  *      computing the Fourier transform (passed as an input so that the
  *      FFTW can be FFTW_MEASUREd beforehand).
- * - data[4] (complex double*) Temporal memory for the zero padding.
+ * - data[4] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding. A grid is taken from the pool for the duration
+ *            of the call, so that the operator can be applied
+ *            concurrently from several threads.
  *
  * \authors Rafael Carrillo
  */
 
 void purify_measurement_cftfwd(void *out, void *in, void **data){
 
-  int i, j, nx2, ny2;
-  int st1, st2;
-  double scale;
   purify_measurement_cparam *param;
   double *deconv;
   purify_sparsemat_row *mat;
   fftw_plan *plan;
+  purify_measurement_workspace *ws;
   complex double *temp;
   complex double *xin;
   complex double *yout;
-  complex double alpha;
 
   //Cast input pointers
   param = (purify_measurement_cparam*)data[0];
   deconv = (double*)data[1];
   mat = (purify_sparsemat_row*)data[2];
   plan = (fftw_plan*)data[3];
-  temp = (complex double*)data[4];
+  ws = (purify_measurement_workspace*)data[4];
+  temp = purify_measurement_workspace_acquire(ws);
 
   xin = (complex double*)in;
   yout = (complex double*)out;
 
-  nx2 = param->ofx*param->nx1;
-  ny2 = param->ofy*param->ny1;
-  
-  alpha = 0.0 + 0.0*I;
-  //Zero padding and decovoluntion. 
-  //Original image in the center.
-  for (i=0; i < nx2*ny2; i++){
-    *(temp + i) = alpha;
-  }
-
-  //Scaling
-  scale = 1/sqrt((double)(nx2*ny2));
-
-  int npadx = nx2 / 4;
-  int npady = ny2 / 4;
-
-  for (j=0; j < param->ny1; j++){
-    st1 = j * param->nx1;
-    st2 = (j + npady) * nx2;
-    for (i=0; i < param->nx1; i++){
-//      *(temp + st2 + i) = *(xin + st1 + i)**(deconv + st1 + i)*scale;
-        *(temp + st2 + i + npadx) = *(xin + st1 + i) * scale;
-        *(temp + st2 + i + npadx) *= *(deconv + st1 + i);
-    }
-  }
-
-  purify_utils_fftshift_2d_c(temp, nx2, ny2);
-
-  //FFT
-  fftw_execute_dft(*plan, temp, temp);
+  //Zero padding, decovoluntion and FFT
+  purify_measurement_cft_grid(temp, xin, deconv, param, plan);
 
   //Multiplication by the sparse matrix storing the interpolation kernel
   purify_sparsemat_fwd_complexr(yout, temp, mat);
 
+  purify_measurement_workspace_release(ws, temp);
+
 }
 
 /*!
@@ -400,20 +754,19 @@ void purify_measurement_cftfwd(void *out, void *in, void **data){
  * - data[3] (fftw_plan*): The complex-to-complex FFTW plan to use when
  *            computing the inverse Fourier transform (passed as an input so 
  *            that the FFTW can be FFTW_MEASUREd beforehand).
- * - data[4] (complex double*) Temporal memory for the zero padding.
+ * - data[4] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding (see \ref purify_measurement_cftfwd).
  *
  * \authors Rafael Carrillo
  */
 
 void purify_measurement_cftadj(void *out, void *in, void **data){
 
-  int i, j, nx2, ny2;
-  int st1, st2;
-  double scale;
   purify_measurement_cparam *param;
   double *deconv;
   purify_sparsemat_row *mat;
   fftw_plan *plan;
+  purify_measurement_workspace *ws;
   complex double *temp;
   complex double *yin;
   complex double *xout;
@@ -423,40 +776,20 @@ void purify_measurement_cftadj(void *out, void *in, void **data){
   deconv = (double*)data[1];
   mat = (purify_sparsemat_row*)data[2];
   plan = (fftw_plan*)data[3];
-  temp = (complex double*)data[4];
+  ws = (purify_measurement_workspace*)data[4];
+  temp = purify_measurement_workspace_acquire(ws);
 
   yin = (complex double*)in;
   xout = (complex double*)out;
 
-  nx2 = param->ofx*param->nx1;
-  ny2 = param->ofy*param->ny1;
-
   //Multiplication by the adjoint of the 
   //sparse matrix storing the interpolation kernel
   purify_sparsemat_adj_complexr(temp, yin, mat);
 
-  //Inverse FFT
-  fftw_execute_dft(*plan, temp, temp);
-  //Scaling
-  scale = 1/sqrt((double)(nx2*ny2));
-
-  purify_utils_fftshift_2d_c(temp, nx2, ny2);
-  
-  //Cropping and decovoluntion. 
-  //Top left corner of the image corresponf to the original image.
+  //Inverse FFT, cropping and decovoluntion
+  purify_measurement_cft_image(xout, temp, deconv, param, plan);
 
-  int npadx = nx2 / 4;
-  int npady = ny2 / 4;
-
-  for (j=0; j < param->ny1; j++){
-    st1 = j * param->nx1;
-    st2 = (j + npady) * nx2;
-    for (i=0; i < param->nx1; i++){
-//      *(xout + st1 + i) = *(temp + st2 + i)**(deconv + st1 + i)*scale;
-      *(xout + st1 + i) = *(temp + st2 + i + npadx) * scale;
-      *(xout + st1 + i) *= *(deconv + st1 + i);
-    }
-  }
+  purify_measurement_workspace_release(ws, temp);
 
 }
 
@@ -469,117 +802,419 @@ void purify_measurement_cftadj(void *out, void *in, void **data){
  * \param[in] A_data Data structure associated to A.
  * \param[in] At Pointer to the the adjoint of the measurement operator.
  * \param[in] At_data Data structure associated to At.
+ * \param[in] nx Dimension of the input of A.
+ * \param[in] ny Dimension of the output of A.
+ *
+ * \deprecated Use \ref purify_measurement_opnorm (Lanczos iterations,
+ * optional cache), which this function calls with the default
+ * parameters.
  *
  * \authors Rafael Carrillo
  */
 double purify_measurement_pow_meth(void (*A)(void *out, void *in, void **data), 
                                    void **A_data,
                                    void (*At)(void *out, void *in, void **data), 
-                                   void **At_data) {
+                                   void **At_data,
+                                   int nx, int ny) {
 
-  int i, iter, nx, ny;
-  int seedn = 51;
-  double bound, norm, rel_ob;
-  purify_measurement_cparam *param;
-  complex double *y;
-  complex double *x;
+  purify_measurement_opnormparam opparam;
 
-  
-  //Cast input pointers
-  param = (purify_measurement_cparam*)A_data[0];
-  nx = param->nx1*param->ny1;
-  ny = param->nmeas;
-  iter = 0;
+  purify_measurement_init_opnormparam(&opparam);
 
-  y = (complex double*)malloc((ny) * sizeof( complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(y);
-  x = (complex double*)malloc((nx) * sizeof( complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(x);
-
-  if (param->nmeas > nx){
-    for (i=0; i < nx; i++) {
-        x[i] = purify_ran_gasdev2(seedn) + purify_ran_gasdev2(seedn)*I;
-    }
-    norm = cblas_dznrm2(nx, (void*)x, 1);
-    for (i=0; i < nx; i++) {
-        x[i] = x[i]/norm;
-    }
-    norm = 1.0;
-
-    //main loop
-    while (iter < 200){
-      A((void*)y, (void*)x, A_data);
-      At((void*)x, (void*)y, At_data);
-      bound = cblas_dznrm2(nx, (void*)x, 1);
-      rel_ob = (bound - norm)/norm;
-      if (rel_ob <= 0.001)
-        break;
-      norm = bound;
-      for (i=0; i < nx; i++) {
-          x[i] = x[i]/norm;
+  return purify_measurement_opnorm(A, A_data, At, At_data, NULL, NULL,
+                                   nx, ny, &opparam);
+
+}
+
+/*!
+ * Set the parameters of the operator norm estimator to their default
+ * values (no cache).
+ *
+ * \param[out] param Parameters of the estimator.
+ */
+void purify_measurement_init_opnormparam(purify_measurement_opnormparam *param) {
+
+  param->max_iter = 50;
+  param->rel_tol = 1e-4;
+  param->seed = 51;
+  param->verbose = 0;
+  param->cachefile = NULL;
+  param->key = 0;
+
+}
+
+/*!
+ * Largest eigenvalue of a real symmetric tridiagonal matrix computed
+ * by bisection with Sturm sequence counts.
+ *
+ * \param[in] a Diagonal of the matrix (n elements).
+ * \param[in] b Off diagonal of the matrix (n-1 elements).
+ * \param[in] n Size of the matrix.
+ * \retval lambda Largest eigenvalue.
+ */
+static double purify_measurement_tridiag_maxeig(double *a, double *b, int n) {
+
+  int i, k, count;
+  double lo, hi, mid, r, q;
+
+  //Gershgorin bounds.
+  lo = a[0];
+  hi = a[0];
+  for (i = 0; i < n; i++) {
+    r = (i > 0 ? fabs(b[i-1]) : 0.0) + (i < n-1 ? fabs(b[i]) : 0.0);
+    lo = purify_min(lo, a[i] - r);
+    hi = purify_max(hi, a[i] + r);
+  }
+
+  for (k = 0; k < 200 && hi - lo > 1e-15 * fabs(hi); k++) {
+    mid = 0.5 * (lo + hi);
+    //Number of eigenvalues smaller than mid.
+    count = 0;
+    q = a[0] - mid;
+    for (i = 0; i < n; i++) {
+      if (i > 0)
+        q = a[i] - mid - b[i-1] * b[i-1] / q;
+      if (q == 0.0)
+        q = -1e-300;
+      if (q < 0.0)
+        count++;
+    }
+    if (count == n)
+      hi = mid;
+    else
+      lo = mid;
+  }
+
+  return hi;
+
+}
+
+/*!
+ * Estimate the squared norm of the operator A (largest eigenvalue of
+ * \f$A^H A\f$) with Lanczos iterations. Compared to the power method
+ * the estimate converges in far fewer operator applications.
+ * 
+ * \retval bound Estimate of the squared norm of A (same quantity as
+ * returned by \ref purify_measurement_pow_meth).
+ * \param[in] A Pointer to the measurement operator.
+ * \param[in] A_data Data structure associated to A.
+ * \param[in] At Pointer to the the adjoint of the measurement operator.
+ * \param[in] At_data Data structure associated to At.
+ * \param[in] G Pointer to the Gram operator \f$A^H A\f$, used instead
+ * of A and At if not NULL.
+ * \param[in] G_data Data structure associated to G.
+ * \param[in] nx Dimension of the input of A.
+ * \param[in] ny Dimension of the output of A.
+ * \param[in] param Parameters of the estimator. If param->cachefile is
+ * not NULL the estimate stored under param->key is returned without
+ * applying the operators, and new estimates are added to the cache.
+ *
+ * \note The starting vector is drawn with a re-entrant generator so
+ * that the routine can run concurrently for different operators.
+ */
+double purify_measurement_opnorm(void (*A)(void *out, void *in, void **data), 
+                                 void **A_data,
+                                 void (*At)(void *out, void *in, void **data), 
+                                 void **At_data,
+                                 void (*G)(void *out, void *in, void **data), 
+                                 void **G_data,
+                                 int nx, int ny,
+                                 purify_measurement_opnormparam *param) {
+
+  int i, iter, n, ntemp;
+  unsigned long long state, key;
+  double theta, theta_old, beta, norm;
+  double *alpha, *betas;
+  complex double dot;
+  complex double *v, *vprev, *w, *temp, *swap;
+  FILE *file;
+
+  //Look for the estimate in the cache.
+  if (param->cachefile != NULL) {
+    file = fopen(param->cachefile, "r");
+    if (file != NULL) {
+      while (fscanf(file, "%llx %lf", &key, &theta) == 2) {
+        if (key == param->key) {
+          fclose(file);
+          if (param->verbose > 0)
+            printf("Operator norm read from %s: %e\n", 
+                   param->cachefile, theta);
+          return theta;
+        }
       }
-      iter++;
+      fclose(file);
     }
+  }
+
+  //Work on the smallest of A^H A and A A^H.
+  if (G != NULL || ny >= nx) {
+    n = nx;
+    ntemp = ny;
+  }
+  else {
+    n = ny;
+    ntemp = nx;
+  }
 
+  v = (complex double*)malloc(n * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(v);
+  vprev = (complex double*)calloc(n, sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(vprev);
+  w = (complex double*)malloc(n * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(w);
+  temp = NULL;
+  if (G == NULL) {
+    temp = (complex double*)malloc(ntemp * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(temp);
   }
-  else{
-    for (i=0; i < ny; i++) {
-        y[i] = purify_ran_gasdev2(seedn) + purify_ran_gasdev2(seedn)*I;
+  alpha = (double*)malloc(param->max_iter * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(alpha);
+  betas = (double*)malloc(param->max_iter * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(betas);
+
+  //Random starting vector.
+  state = param->seed;
+  for (i = 0; i < n; i++)
+    v[i] = purify_ran_gasdev_r(&state) + purify_ran_gasdev_r(&state)*I;
+  norm = cblas_dznrm2(n, (void*)v, 1);
+  for (i = 0; i < n; i++)
+    v[i] = v[i]/norm;
+
+  beta = 0.0;
+  theta = 0.0;
+  theta_old = 0.0;
+  for (iter = 0; iter < param->max_iter; iter++) {
+
+    //w = A^H A v (or A A^H v).
+    if (G != NULL)
+      G((void*)w, (void*)v, G_data);
+    else if (n == nx) {
+      A((void*)temp, (void*)v, A_data);
+      At((void*)w, (void*)temp, At_data);
     }
-    norm = cblas_dznrm2(ny, (void*)y, 1);
-    for (i=0; i < ny; i++) {
-        y[i] = y[i]/norm;
+    else {
+      At((void*)temp, (void*)v, At_data);
+      A((void*)w, (void*)temp, A_data);
     }
-    norm = 1.0;
 
-    //main loop
-    while (iter < 200){
-      At((void*)x, (void*)y, At_data);
-      A((void*)y, (void*)x, A_data);
-      bound = cblas_dznrm2(ny, (void*)y, 1);
-      rel_ob = (bound - norm)/norm;
-      if (rel_ob <= 0.001)
-        break;
-      norm = bound;
-      for (i=0; i < ny; i++) {
-          y[i] = y[i]/norm;
-      }
-      iter++;
-    }
+    cblas_zdotc_sub(n, (void*)v, 1, (void*)w, 1, (void*)&dot);
+    alpha[iter] = creal(dot);
+    for (i = 0; i < n; i++)
+      w[i] -= alpha[iter]*v[i] + beta*vprev[i];
+
+    //Local reorthogonalisation against v.
+    cblas_zdotc_sub(n, (void*)v, 1, (void*)w, 1, (void*)&dot);
+    for (i = 0; i < n; i++)
+      w[i] -= dot*v[i];
+
+    beta = cblas_dznrm2(n, (void*)w, 1);
+    betas[iter] = beta;
+
+    theta = purify_measurement_tridiag_maxeig(alpha, betas, iter + 1);
+    if (iter > 0 && fabs(theta - theta_old) <= param->rel_tol*theta)
+      break;
+    if (beta <= 1e-14*theta)
+      break;
+    theta_old = theta;
+
+    swap = vprev;
+    vprev = v;
+    v = w;
+    w = swap;
+    for (i = 0; i < n; i++)
+      v[i] = v[i]/beta;
 
   }
 
-  free(y);
-  free(x);
+  if (param->verbose > 0)
+    printf("Operator norm: %e (%d Lanczos iterations)\n", 
+           theta, purify_min(iter + 1, param->max_iter));
+
+  //Add the estimate to the cache.
+  if (param->cachefile != NULL) {
+    file = fopen(param->cachefile, "a");
+    if (file != NULL) {
+      fprintf(file, "%016llx %.17e\n", param->key, theta);
+      fclose(file);
+    }
+  }
+
+  free(v);
+  free(vprev);
+  free(w);
+  if (temp != NULL) free(temp);
+  free(alpha);
+  free(betas);
 
-  return bound;
+  return theta;
 
 }
 
 /*!
- * Define forward measurement operator for continuos visibilities
- * It takes advantage of signal reality and conjugate symmetry.
- * (currently includes adjoint continuos Fourier transform only).
+ * Fingerprint of a continuos Fourier transform operator, i.e. a hash
+ * of its parameters, gridding matrix (hence of the coverage) and
+ * deconvolution kernel. Used as key of on-disk caches.
  *
- * \param[out] out (complex double*) Output visibilities. 
- * \param[in] in (complex double*) Input image. Assumed real. Imaginary part
- *             set to zero.
+ * \retval key 64 bit fingerprint.
+ * \param[in] mat Sparse matrix with the interpolation kernels.
+ * \param[in] deconv Deconvolution kernel in real space (may be NULL).
+ * \param[in] param Parameters of the operator.
+ */
+unsigned long long purify_measurement_fingerprint(purify_sparsemat_row *mat,
+                                                  double *deconv,
+                                                  purify_measurement_cparam *param) {
+
+  unsigned long long h = PURIFY_UTILS_HASH_INIT;
+  int kernel = param->kernel;
+
+  h = purify_utils_hash(h, &param->nmeas, sizeof(int));
+  h = purify_utils_hash(h, &param->nx1, sizeof(int));
+  h = purify_utils_hash(h, &param->ny1, sizeof(int));
+  h = purify_utils_hash(h, &param->ofx, sizeof(int));
+  h = purify_utils_hash(h, &param->ofy, sizeof(int));
+  h = purify_utils_hash(h, &param->kx, sizeof(int));
+  h = purify_utils_hash(h, &param->ky, sizeof(int));
+  h = purify_utils_hash(h, &kernel, sizeof(int));
+  h = purify_utils_hash(h, &param->umax, sizeof(double));
+  h = purify_utils_hash(h, &param->vmax, sizeof(double));
+  h = purify_utils_hash(h, &param->l0, sizeof(double));
+  h = purify_utils_hash(h, &param->m0, sizeof(double));
+
+  h = purify_utils_hash(h, &mat->nrows, sizeof(int));
+  h = purify_utils_hash(h, &mat->ncols, sizeof(int));
+  h = purify_utils_hash(h, &mat->nvals, sizeof(int));
+  h = purify_utils_hash(h, mat->rowptr, (mat->nrows + 1) * sizeof(int));
+  h = purify_utils_hash(h, mat->colind, mat->nvals * sizeof(int));
+  if (mat->real == 1)
+    h = purify_utils_hash(h, mat->vals, mat->nvals * sizeof(double));
+  else
+    h = purify_utils_hash(h, mat->cvals, 
+                          mat->nvals * sizeof(complex double));
+
+  if (deconv != NULL)
+    h = purify_utils_hash(h, deconv, 
+                          param->nx1 * param->ny1 * sizeof(double));
+
+  return h;
+
+}
+
+/*!
+ * Diagonal of \f$G^H G\f$ on the oversampled grid, where G is the
+ * gridding matrix. It defines the Gram operator \ref
+ * purify_measurement_cftgram.
+ *
+ * \param[out] gdiag (double*) Diagonal, of length mat->ncols (space
+ * allocated by the calling routine).
+ * \param[in] mat Sparse matrix with the interpolation kernels. Each
+ * row must have a single non-zero entry (nearest neighbour kernel), so
+ * that \f$G^H G\f$ is diagonal.
+ */
+void purify_measurement_init_gram(double *gdiag, purify_sparsemat_row *mat) {
+
+  int r, rr;
+
+  for (r = 0; r < mat->ncols; r++)
+    gdiag[r] = 0.0;
+
+  for (r = 0; r < mat->nrows; r++) {
+    if (mat->rowptr[r+1] - mat->rowptr[r] > 1)
+      PURIFY_ERROR_GENERIC("Gram operator requires one grid cell per visibility");
+    for (rr = mat->rowptr[r]; rr < mat->rowptr[r+1]; rr++) {
+      if (mat->real == 1)
+        gdiag[mat->colind[rr]] += mat->vals[rr] * mat->vals[rr];
+      else
+        gdiag[mat->colind[rr]] += creal(mat->cvals[rr] * conj(mat->cvals[rr]));
+    }
+  }
+
+}
+
+/*!
+ * Gram operator \f$A^H A\f$ of the continuos Fourier transform
+ * operator. Equivalent to \ref purify_measurement_cftfwd followed by
+ * \ref purify_measurement_cftadj but its cost does not depend on the
+ * number of visibilities.
+ *
+ * \param[out] out (complex double*) Output image.
+ * \param[in] in (complex double*) Input image.
  * \param[in] data 
  * - data[0] (purify_measurement_cparam*): Parameters for the continuos
  *            Fourier transform.
  * - data[1] (double*): Matrix with the deconvolution kernel in image
  *            space.
- * - data[2] (purify_sparsemat_row*): The sparse matrix defining the
- *            convolution operator for the the interpolation.
- * - data[3] (fftw_plan*): The complex-to-complex FFTW plan to use when
- *            computing the inverse Fourier transform (passed as an input so 
- *            that the FFTW can be FFTW_MEASUREd beforehand).
- * - data[4] (complex double*) Temporal memory for the zero padding.
+ * - data[2] (double*): Diagonal computed by \ref
+ *            purify_measurement_init_gram.
+ * - data[3] (fftw_plan*): Forward complex-to-complex FFTW plan.
+ * - data[4] (fftw_plan*): Backward complex-to-complex FFTW plan.
+ * - data[5] (purify_measurement_workspace*) Pool of grids for the
+ *            zero padding.
  *
- * \authors Rafael Carrillo
+ * \note Both plans are executed on grids of data[5], so they must be
+ * created on a grid of the same pool.
  */
+void purify_measurement_cftgram(void *out, void *in, void **data){
 
-void purify_measurement_symcftfwd(void *out, void *in, void **data){
+  int i, nx2, ny2;
+  purify_measurement_cparam *param;
+  double *deconv;
+  double *gdiag;
+  fftw_plan *planfwd;
+  fftw_plan *planadj;
+  purify_measurement_workspace *ws;
+  complex double *temp;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  gdiag = (double*)data[2];
+  planfwd = (fftw_plan*)data[3];
+  planadj = (fftw_plan*)data[4];
+  ws = (purify_measurement_workspace*)data[5];
+  temp = purify_measurement_workspace_acquire(ws);
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+
+  purify_measurement_cft_grid(temp, (complex double*)in, deconv, param, 
+                              planfwd);
+
+  for (i=0; i < nx2*ny2; i++){
+    temp[i] *= gdiag[i];
+  }
+
+  purify_measurement_cft_image((complex double*)out, temp, deconv, param, 
+                               planadj);
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Define forward measurement operator for continuos visibilities
+ * It takes advantage of signal reality and conjugate symmetry.
+ * (currently includes adjoint continuos Fourier transform only).
+ *
+ * \param[out] out (complex double*) Output visibilities. 
+ * \param[in] in (complex double*) Input image. Assumed real. Imaginary part
+ *             set to zero.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (purify_sparsemat_row*): The sparse matrix defining the
+ *            convolution operator for the the interpolation.
+ * - data[3] (fftw_plan*): The complex-to-complex FFTW plan to use when
+ *            computing the inverse Fourier transform (passed as an input so 
+ *            that the FFTW can be FFTW_MEASUREd beforehand).
+ * - data[4] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding.
+ *
+ * \authors Rafael Carrillo
+ */
+
+void purify_measurement_symcftfwd(void *out, void *in, void **data){
 
   int i, ny;
   purify_measurement_cparam *param;
@@ -620,7 +1255,8 @@ void purify_measurement_symcftfwd(void *out, void *in, void **data){
  * - data[3] (fftw_plan*): The complex-to-complex FFTW plan to use when
  *            computing the inverse Fourier transform (passed as an input so 
  *            that the FFTW can be FFTW_MEASUREd beforehand).
- * - data[4] (complex double*) Temporal memory for the zero padding.
+ * - data[4] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding.
  *
  * \authors Rafael Carrillo
  */
@@ -648,5 +1284,2421 @@ void purify_measurement_symcftadj(void *out, void *in, void **data){
 
 }
 
+/*!
+ * Initialise the gridding matrix of the half-plane continuos Fourier
+ * transform operator (\ref purify_measurement_hcftfwd and \ref
+ * purify_measurement_hcftadj). The matrix indexes the non-redundant
+ * half of the oversampled grid, of size ny2 by (nx2/2 + 1), produced by
+ * a real-to-complex FFT. Kernel cells falling on the other half are
+ * read as the complex conjugate of their mirror cell, which is encoded
+ * with a negative column index: -(c + 1) refers to conj(grid[c]).
+ *
+ * \param[out] mat Sparse matrix with the interpolation kernels. Each
+ * row corresponds to a visibility.
+ * \param[out] deconv Deconvolution kernel in real space.
+ * \param[in] u u coodinates of the visibilities, expected to be folded
+ * onto u >= 0 (see \ref purify_visibility_fold).
+ * \param[in] v v coodinates of the visibilities.
+ * \param[in] param structure storing information for the operator.
+ *
+ * \note The grid sizes nx2 and ny2 must be even. The wavelet kernel
+ * is not symmetric, so with it folded visibilities are interpolated
+ * differently (not conjugated) from the unfolded ones.
+ */
+void purify_measurement_init_hcft(purify_sparsemat_row *mat, 
+                                  double *deconv, double *u, double *v, 
+                                  purify_measurement_cparam *param) {
+
+  int i, iu, iv, nx2, ny2, nh;
+
+  purify_measurement_init_cft(mat, deconv, u, v, param);
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+  nh = nx2/2 + 1;
+
+  for (i = 0; i < mat->nvals; i++) {
+    iu = mat->colind[i] % nx2;
+    iv = mat->colind[i] / nx2;
+    if (iu < nh)
+      mat->colind[i] = iv * nh + iu;
+    else
+      mat->colind[i] = -(((ny2 - iv) % ny2) * nh + nx2 - iu) - 1;
+  }
+  mat->ncols = ny2 * nh;
+
+}
+
+/*!
+ * Forward continuos Fourier transform operator for real images working
+ * on the half of the oversampled grid with u >= 0. It is equivalent to
+ * \ref purify_measurement_cftfwd for a real image, with half the grid
+ * memory and a real-to-complex FFT.
+ *
+ * \param[out] out (complex double*) Output visibilities. 
+ * \param[in] in (complex double*) Input image. Assumed real, the
+ *            imaginary part is ignored.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (purify_sparsemat_row*): The sparse matrix computed by
+ *            \ref purify_measurement_init_hcft.
+ * - data[3] (fftw_plan*): In place real-to-complex FFTW plan of size
+ *            ny2 by nx2.
+ * - data[4] (purify_measurement_workspace*) Pool of half grids, of
+ *            ny2*(nx2/2 + 1) elements.
+ */
+void purify_measurement_hcftfwd(void *out, void *in, void **data){
+
+  int i, j, ii, jj, r, rr, c, nx2, ny2, nh;
+  int npadx, npady;
+  double scale;
+  purify_measurement_cparam *param;
+  double *deconv;
+  purify_sparsemat_row *mat;
+  fftw_plan *plan;
+  purify_measurement_workspace *ws;
+  complex double *temp;
+  double *rtemp;
+  complex double *xin;
+  complex double *yout;
+  complex double g;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  mat = (purify_sparsemat_row*)data[2];
+  plan = (fftw_plan*)data[3];
+  ws = (purify_measurement_workspace*)data[4];
+  temp = purify_measurement_workspace_acquire(ws);
+  rtemp = (double*)temp;
+
+  xin = (complex double*)in;
+  yout = (complex double*)out;
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+  nh = nx2/2 + 1;
+  npadx = (nx2 - param->nx1) / 2;
+  npady = (ny2 - param->ny1) / 2;
+  scale = 1/sqrt((double)(nx2*ny2));
+
+  //Zero padding, decovolution and fftshift in a single pass.
+  //Rows of the real array are 2*nh long for the in place transform.
+  for (i=0; i < ny2*nh; i++){
+    temp[i] = 0.0 + 0.0*I;
+  }
+  for (j=0; j < param->ny1; j++){
+    jj = (j + npady + ny2/2) % ny2;
+    for (i=0; i < param->nx1; i++){
+      ii = (i + npadx + nx2/2) % nx2;
+      rtemp[jj*2*nh + ii] = creal(xin[j*param->nx1 + i]) * scale 
+        * deconv[j*param->nx1 + i];
+    }
+  }
+
+  //FFT
+  fftw_execute_dft_r2c(*plan, rtemp, temp);
+
+  //Interpolation, reading the mirrored half as conjugates.
+  for (r = 0; r < mat->nrows; r++) {
+    yout[r] = 0.0 + 0.0*I;
+    for (rr = mat->rowptr[r]; rr < mat->rowptr[r+1]; rr++) {
+      c = mat->colind[rr];
+      g = c >= 0 ? temp[c] : conj(temp[-c-1]);
+      yout[r] += (mat->real == 1 ? mat->vals[rr] : mat->cvals[rr]) * g;
+    }
+  }
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Adjoint of \ref purify_measurement_hcftfwd, i.e. the real part of
+ * the adjoint continuos Fourier transform computed on the half grid
+ * with a complex-to-real FFT.
+ *
+ * \param[out] out (complex double*) Output image. Imaginary part
+ *             set to zero.
+ * \param[in] in (complex double*) Input visibilities.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (purify_sparsemat_row*): The sparse matrix computed by
+ *            \ref purify_measurement_init_hcft.
+ * - data[3] (fftw_plan*): In place complex-to-real FFTW plan of size
+ *            ny2 by nx2.
+ * - data[4] (purify_measurement_workspace*) Pool of half grids, of
+ *            ny2*(nx2/2 + 1) elements.
+ */
+void purify_measurement_hcftadj(void *out, void *in, void **data){
+
+  int i, j, ii, jj, r, rr, c, nx2, ny2, nh;
+  int npadx, npady;
+  double scale;
+  purify_measurement_cparam *param;
+  double *deconv;
+  purify_sparsemat_row *mat;
+  fftw_plan *plan;
+  purify_measurement_workspace *ws;
+  complex double *temp;
+  double *rtemp;
+  complex double *yin;
+  complex double *xout;
+  complex double g, gm;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  mat = (purify_sparsemat_row*)data[2];
+  plan = (fftw_plan*)data[3];
+  ws = (purify_measurement_workspace*)data[4];
+  temp = purify_measurement_workspace_acquire(ws);
+  rtemp = (double*)temp;
+
+  yin = (complex double*)in;
+  xout = (complex double*)out;
+
+  nx2 = param->ofx*param->nx1;
+  ny2 = param->ofy*param->ny1;
+  nh = nx2/2 + 1;
+  npadx = (nx2 - param->nx1) / 2;
+  npady = (ny2 - param->ny1) / 2;
+  scale = 1/sqrt((double)(nx2*ny2));
+
+  //Adjoint interpolation, conjugating onto the mirrored cells.
+  for (i=0; i < ny2*nh; i++){
+    temp[i] = 0.0 + 0.0*I;
+  }
+  for (r = 0; r < mat->nrows; r++) {
+    for (rr = mat->rowptr[r]; rr < mat->rowptr[r+1]; rr++) {
+      c = mat->colind[rr];
+      g = (mat->real == 1 ? mat->vals[rr] : conj(mat->cvals[rr])) * yin[r];
+      if (c >= 0)
+        temp[c] += g;
+      else
+        temp[-c-1] += conj(g);
+    }
+  }
+
+  //Hermitian part of the grid: interior columns appear once in the
+  //half grid, columns u = 0 and u = nx2/2 hold both k and -k.
+  for (j = 0; j < ny2; j++) {
+    for (i = 1; i < nh - 1; i++)
+      temp[j*nh + i] *= 0.5;
+  }
+  for (i = 0; i < nh; i += nh - 1) {
+    for (j = 0; j <= ny2/2; j++) {
+      jj = (ny2 - j) % ny2;
+      g = temp[j*nh + i];
+      gm = temp[jj*nh + i];
+      temp[j*nh + i] = 0.5 * (g + conj(gm));
+      temp[jj*nh + i] = 0.5 * (gm + conj(g));
+    }
+  }
+
+  //Inverse FFT
+  fftw_execute_dft_c2r(*plan, temp, rtemp);
+
+  //Cropping, fftshift and decovolution.
+  for (j=0; j < param->ny1; j++){
+    jj = (j + npady + ny2/2) % ny2;
+    for (i=0; i < param->nx1; i++){
+      ii = (i + npadx + nx2/2) % nx2;
+      xout[j*param->nx1 + i] = rtemp[jj*2*nh + ii] * scale 
+        * deconv[j*param->nx1 + i] + 0.0*I;
+    }
+  }
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Initialise a faceted continuos Fourier transform operator.
+ *
+ * \param[out] facets Faceted operator.
+ * \param[in] u u coodinates of the visibilities.
+ * \param[in] v v coodinates of the visibilities.
+ * \param[in] param Parameters of the operator for the whole image. The
+ * oversampling factors and interpolation kernel are used for every
+ * facet.
+ * \param[in] nfx Number of facets along the columns, must divide
+ * param->nx1.
+ * \param[in] nfy Number of facets along the rows, must divide
+ * param->ny1.
+ * \param[in] flags FFTW planner flags.
+ *
+ * \note The uv grid of a facet is nfx (nfy) times coarser than the one
+ * of the whole image, so the interpolation error of a given kernel is
+ * larger. Memory allocated herein is freed with \ref
+ * purify_measurement_free_facets.
+ */
+void purify_measurement_init_facets(purify_measurement_facets *facets,
+                                    double *u, double *v,
+                                    purify_measurement_cparam *param,
+                                    int nfx, int nfy, unsigned flags) {
+
+  int f, i, fx, fy, nf, ng;
+  double dx, dy, scale;
+  complex double *grid;
+
+  if (param->nx1 % nfx != 0 || param->ny1 % nfy != 0)
+    PURIFY_ERROR_GENERIC("Number of facets must divide the image size");
+
+  facets->nfx = nfx;
+  facets->nfy = nfy;
+  facets->param = *param;
+  facets->fparam = *param;
+  facets->fparam.nx1 = param->nx1 / nfx;
+  facets->fparam.ny1 = param->ny1 / nfy;
+  nf = nfx * nfy;
+  ng = facets->fparam.nx1 * facets->fparam.ofx 
+    * facets->fparam.ny1 * facets->fparam.ofy;
+
+  facets->deconv = (double*)malloc(facets->fparam.nx1 * facets->fparam.ny1
+                                   * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(facets->deconv);
+  purify_measurement_init_cft(&facets->gmat, facets->deconv, u, v, 
+                              &facets->fparam);
+
+  facets->phasors = (complex double*)malloc((size_t)nf * param->nmeas
+                                            * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(facets->phasors);
+  facets->ytemp = (complex double*)malloc((size_t)nf * param->nmeas
+                                          * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(facets->ytemp);
+  facets->xtemp = (complex double*)malloc((size_t)nf * facets->fparam.nx1
+                                          * facets->fparam.ny1
+                                          * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(facets->xtemp);
+
+  //Plans are created on a grid of the pool and executed on all of them.
+  purify_measurement_init_workspace(&facets->ws, ng);
+  grid = purify_measurement_workspace_acquire(&facets->ws);
+  facets->planfwd = fftw_plan_dft_2d(facets->fparam.nx1*facets->fparam.ofx, 
+                                     facets->fparam.ny1*facets->fparam.ofy, 
+                                     grid, grid, FFTW_FORWARD, flags);
+  facets->planadj = fftw_plan_dft_2d(facets->fparam.nx1*facets->fparam.ofx, 
+                                     facets->fparam.ny1*facets->fparam.ofy, 
+                                     grid, grid, FFTW_BACKWARD, flags);
+  purify_measurement_workspace_release(&facets->ws, grid);
+
+  //Offset (in pixels) of the centre of each facet from the centre of
+  //the image, and the corresponding phase rotation. The phasors also
+  //correct the FFT normalisation of the smaller facet grids.
+  scale = 1.0 / sqrt((double)nf);
+  for (f = 0; f < nf; f++) {
+    fx = f % nfx;
+    fy = f / nfx;
+    dx = fx * facets->fparam.nx1 + facets->fparam.nx1 / 2 - param->nx1 / 2;
+    dy = fy * facets->fparam.ny1 + facets->fparam.ny1 / 2 - param->ny1 / 2;
+    #pragma omp parallel for
+    for (i = 0; i < param->nmeas; i++)
+      facets->phasors[(size_t)f * param->nmeas + i] = 
+        scale * cexp(-I * PURIFY_PI * (u[i] / param->umax * dx 
+                                       + v[i] / param->vmax * dy));
+  }
+
+}
+
+/*!
+ * Free the memory of a faceted continuos Fourier transform operator.
+ *
+ * \param[in,out] facets Faceted operator.
+ */
+void purify_measurement_free_facets(purify_measurement_facets *facets) {
+
+  fftw_destroy_plan(facets->planfwd);
+  fftw_destroy_plan(facets->planadj);
+  purify_sparsemat_freer(&facets->gmat);
+  free(facets->deconv);
+  purify_measurement_free_workspace(&facets->ws);
+  free(facets->phasors);
+  free(facets->ytemp);
+  free(facets->xtemp);
+
+}
+
+/*!
+ * Forward faceted continuos Fourier transform operator. The
+ * visibilities of every facet are computed in parallel and summed
+ * after the phase rotation to the facet centre.
+ *
+ * \param[out] out (complex double*) Output visibilities. 
+ * \param[in] in (complex double*) Input image.
+ * \param[in] data 
+ * - data[0] (purify_measurement_facets*): Faceted operator computed
+ *            by \ref purify_measurement_init_facets.
+ */
+void purify_measurement_facetfwd(void *out, void *in, void **data){
+
+  int f, i, j, k, nf, nxf, nyf, nmeas, nx1;
+  purify_measurement_facets *facets;
+  complex double *xin;
+  complex double *yout;
+  complex double *xf;
+  complex double sum;
+  void *datafwd[5];
+
+  facets = (purify_measurement_facets*)data[0];
+  xin = (complex double*)in;
+  yout = (complex double*)out;
+
+  nf = facets->nfx * facets->nfy;
+  nxf = facets->fparam.nx1;
+  nyf = facets->fparam.ny1;
+  nx1 = facets->param.nx1;
+  nmeas = facets->param.nmeas;
+
+  #pragma omp parallel for private(i, j, xf, datafwd)
+  for (f = 0; f < nf; f++) {
+    //Cut the facet out of the image.
+    xf = facets->xtemp + (size_t)f * nxf * nyf;
+    for (j = 0; j < nyf; j++)
+      for (i = 0; i < nxf; i++)
+        xf[j*nxf + i] = xin[((f / facets->nfx)*nyf + j)*nx1 
+                            + (f % facets->nfx)*nxf + i];
+
+    datafwd[0] = (void*)&facets->fparam;
+    datafwd[1] = (void*)facets->deconv;
+    datafwd[2] = (void*)&facets->gmat;
+    datafwd[3] = (void*)&facets->planfwd;
+    datafwd[4] = (void*)&facets->ws;
+    purify_measurement_cftfwd((void*)(facets->ytemp + (size_t)f * nmeas),
+                              (void*)xf, datafwd);
+  }
+
+  #pragma omp parallel for private(f, sum)
+  for (k = 0; k < nmeas; k++) {
+    sum = 0.0 + 0.0*I;
+    for (f = 0; f < nf; f++)
+      sum += facets->phasors[(size_t)f * nmeas + k] 
+        * facets->ytemp[(size_t)f * nmeas + k];
+    yout[k] = sum;
+  }
+
+}
+
+/*!
+ * Adjoint faceted continuos Fourier transform operator. The image of
+ * every facet is computed in parallel from the visibilities rotated to
+ * its centre and stitched into the output image.
+ *
+ * \param[out] out (complex double*) Output image.
+ * \param[in] in (complex double*) Input visibilities.
+ * \param[in] data 
+ * - data[0] (purify_measurement_facets*): Faceted operator computed
+ *            by \ref purify_measurement_init_facets.
+ */
+void purify_measurement_facetadj(void *out, void *in, void **data){
+
+  int f, i, j, k, nf, nxf, nyf, nmeas, nx1;
+  purify_measurement_facets *facets;
+  complex double *yin;
+  complex double *xout;
+  complex double *xf;
+  complex double *yf;
+  void *dataadj[5];
+
+  facets = (purify_measurement_facets*)data[0];
+  yin = (complex double*)in;
+  xout = (complex double*)out;
+
+  nf = facets->nfx * facets->nfy;
+  nxf = facets->fparam.nx1;
+  nyf = facets->fparam.ny1;
+  nx1 = facets->param.nx1;
+  nmeas = facets->param.nmeas;
+
+  #pragma omp parallel for private(i, j, k, xf, yf, dataadj)
+  for (f = 0; f < nf; f++) {
+    yf = facets->ytemp + (size_t)f * nmeas;
+    for (k = 0; k < nmeas; k++)
+      yf[k] = conj(facets->phasors[(size_t)f * nmeas + k]) * yin[k];
+
+    xf = facets->xtemp + (size_t)f * nxf * nyf;
+    dataadj[0] = (void*)&facets->fparam;
+    dataadj[1] = (void*)facets->deconv;
+    dataadj[2] = (void*)&facets->gmat;
+    dataadj[3] = (void*)&facets->planadj;
+    dataadj[4] = (void*)&facets->ws;
+    purify_measurement_cftadj((void*)xf, (void*)yf, dataadj);
+
+    //Facets do not overlap, stitch without synchronisation.
+    for (j = 0; j < nyf; j++)
+      for (i = 0; i < nxf; i++)
+        xout[((f / facets->nfx)*nyf + j)*nx1 + (f % facets->nfx)*nxf + i] =
+          xf[j*nxf + i];
+  }
+
+}
+
+/*!
+ * Initialise an empty streaming continuos Fourier transform operator.
+ *
+ * \param[out] stream Streaming operator.
+ * \param[in] param Parameters of the operator (param->nmeas is
+ * ignored).
+ * \param[in] chunksize Maximum number of visibilities stored per
+ * chunk.
+ */
+void purify_measurement_init_stream(purify_measurement_stream *stream,
+                                    purify_measurement_cparam *param,
+                                    int chunksize) {
+
+  int i;
+
+  stream->param = *param;
+  stream->param.nmeas = 0;
+  stream->chunksize = chunksize;
+  stream->nchunks = 0;
+  stream->maxchunks = 0;
+  stream->vis = NULL;
+  stream->gmat = NULL;
+  stream->deconv = (double*)malloc(param->nx1 * param->ny1 * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(stream->deconv);
+  for (i = 0; i < param->nx1 * param->ny1; i++)
+    stream->deconv[i] = 1.0;
+
+}
+
+/*!
+ * Append visibilities to a streaming operator. The visibilities are
+ * copied to the last chunk (new chunks are created when it is full)
+ * and only the rows of the gridding matrix for the new visibilities
+ * are computed, so the cost is proportional to vis->nmeas.
+ *
+ * \param[in,out] stream Streaming operator.
+ * \param[in] vis New visibilities.
+ */
+void purify_measurement_stream_append(purify_measurement_stream *stream,
+                                      purify_visibility *vis) {
+
+  int i, k, n, done, numel;
+  purify_measurement_cparam param;
+  purify_sparsemat_row tmp;
+  purify_visibility *chunk;
+  purify_sparsemat_row *g;
+
+  done = 0;
+  while (done < vis->nmeas) {
+
+    //Open a new chunk if the last one is full.
+    if (stream->nchunks == 0 
+        || stream->vis[stream->nchunks-1].nmeas == stream->chunksize) {
+      if (stream->nchunks == stream->maxchunks) {
+        stream->maxchunks = purify_max(2 * stream->maxchunks, 4);
+        stream->vis = (purify_visibility*)realloc(stream->vis, 
+                                                  stream->maxchunks 
+                                                  * sizeof(purify_visibility));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(stream->vis);
+        stream->gmat = (purify_sparsemat_row*)realloc(stream->gmat, 
+                                                      stream->maxchunks 
+                                                      * sizeof(purify_sparsemat_row));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(stream->gmat);
+      }
+      k = stream->nchunks;
+      purify_visibility_alloc(&stream->vis[k], stream->chunksize);
+      stream->vis[k].nmeas = 0;
+      stream->gmat[k].nrows = 0;
+      stream->gmat[k].ncols = 0;
+      stream->gmat[k].nvals = 0;
+      stream->gmat[k].real = 1;
+      stream->gmat[k].vals = NULL;
+      stream->gmat[k].cvals = NULL;
+      stream->gmat[k].colind = NULL;
+      stream->gmat[k].rowptr = NULL;
+      stream->nchunks++;
+    }
+    chunk = &stream->vis[stream->nchunks-1];
+    g = &stream->gmat[stream->nchunks-1];
+    n = purify_min(stream->chunksize - chunk->nmeas, vis->nmeas - done);
+
+    //Copy the visibilities.
+    memcpy(chunk->u + chunk->nmeas, vis->u + done, n * sizeof(double));
+    memcpy(chunk->v + chunk->nmeas, vis->v + done, n * sizeof(double));
+    memcpy(chunk->w + chunk->nmeas, vis->w + done, n * sizeof(double));
+    memcpy(chunk->noise_std + chunk->nmeas, vis->noise_std + done, 
+           n * sizeof(complex double));
+    memcpy(chunk->y + chunk->nmeas, vis->y + done, 
+           n * sizeof(complex double));
+    memcpy(chunk->baseline + chunk->nmeas, vis->baseline + done, 
+           n * sizeof(int));
+    memcpy(chunk->time + chunk->nmeas, vis->time + done, 
+           n * sizeof(double));
+
+    //Rows of the gridding matrix for the new visibilities.
+    param = stream->param;
+    param.nmeas = n;
+    purify_measurement_init_cft(&tmp, stream->deconv, vis->u + done, 
+                                vis->v + done, &param);
+    numel = tmp.nvals / n;
+    if (g->rowptr == NULL) {
+      g->rowptr = (int*)purify_utils_malloc((stream->chunksize + 1) * sizeof(int));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(g->rowptr);
+      g->colind = (int*)purify_utils_malloc(stream->chunksize * numel * sizeof(int));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(g->colind);
+      g->real = tmp.real;
+      if (g->real == 1) {
+        g->vals = (double*)purify_utils_malloc(stream->chunksize * numel * sizeof(double));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(g->vals);
+      }
+      else {
+        g->cvals = (complex double*)purify_utils_malloc(stream->chunksize * numel 
+                                           * sizeof(complex double));
+        PURIFY_ERROR_MEM_ALLOC_CHECK(g->cvals);
+      }
+      g->rowptr[0] = 0;
+      g->ncols = tmp.ncols;
+    }
+    memcpy(g->colind + g->nvals, tmp.colind, tmp.nvals * sizeof(int));
+    if (g->real == 1)
+      memcpy(g->vals + g->nvals, tmp.vals, tmp.nvals * sizeof(double));
+    else
+      memcpy(g->cvals + g->nvals, tmp.cvals, 
+             tmp.nvals * sizeof(complex double));
+    for (i = 0; i < n; i++)
+      g->rowptr[g->nrows + i + 1] = g->nvals + tmp.rowptr[i+1];
+    g->nrows += n;
+    g->nvals += tmp.nvals;
+    purify_sparsemat_freer(&tmp);
+
+    chunk->nmeas += n;
+    stream->param.nmeas += n;
+    done += n;
+  }
+
+}
+
+/*!
+ * Copy the measured visibilities of all the chunks of a streaming
+ * operator into a single vector.
+ *
+ * \param[out] y (complex double*) Visibilities, of length
+ * stream->param.nmeas (space allocated by the calling routine).
+ * \param[in] stream Streaming operator.
+ */
+void purify_measurement_stream_gather(complex double *y,
+                                      purify_measurement_stream *stream) {
+
+  int k;
+
+  for (k = 0; k < stream->nchunks; k++) {
+    memcpy(y, stream->vis[k].y, stream->vis[k].nmeas * sizeof(complex double));
+    y += stream->vis[k].nmeas;
+  }
+
+}
+
+/*!
+ * Free the memory of a streaming operator.
+ *
+ * \param[in,out] stream Streaming operator.
+ */
+void purify_measurement_free_stream(purify_measurement_stream *stream) {
+
+  int k;
+
+  for (k = 0; k < stream->nchunks; k++) {
+    purify_visibility_free(&stream->vis[k]);
+    purify_sparsemat_freer(&stream->gmat[k]);
+  }
+  if (stream->vis != NULL) free(stream->vis);
+  if (stream->gmat != NULL) free(stream->gmat);
+  free(stream->deconv);
+  stream->nchunks = 0;
+  stream->maxchunks = 0;
+  stream->param.nmeas = 0;
+
+}
+
+/*!
+ * Forward streaming continuos Fourier transform operator. Equivalent
+ * to \ref purify_measurement_cftfwd on all the visibilities appended
+ * so far, in order of arrival.
+ *
+ * \param[out] out (complex double*) Output visibilities, of length
+ *            stream->param.nmeas.
+ * \param[in] in (complex double*) Input image.
+ * \param[in] data 
+ * - data[0] (purify_measurement_stream*): Streaming operator.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (fftw_plan*): Forward complex-to-complex FFTW plan.
+ * - data[3] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding.
+ */
+void purify_measurement_streamfwd(void *out, void *in, void **data){
+
+  int k;
+  purify_measurement_stream *stream;
+  double *deconv;
+  fftw_plan *plan;
+  purify_measurement_workspace *ws;
+  complex double *temp;
+  complex double *yout;
 
+  //Cast input pointers
+  stream = (purify_measurement_stream*)data[0];
+  deconv = (double*)data[1];
+  plan = (fftw_plan*)data[2];
+  ws = (purify_measurement_workspace*)data[3];
+  temp = purify_measurement_workspace_acquire(ws);
+
+  yout = (complex double*)out;
 
+  purify_measurement_cft_grid(temp, (complex double*)in, deconv, 
+                              &stream->param, plan);
+
+  for (k = 0; k < stream->nchunks; k++) {
+    purify_sparsemat_fwd_complexr(yout, temp, &stream->gmat[k]);
+    yout += stream->gmat[k].nrows;
+  }
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Adjoint streaming continuos Fourier transform operator.
+ *
+ * \param[out] out (complex double*) Output image.
+ * \param[in] in (complex double*) Input visibilities, of length
+ *            stream->param.nmeas.
+ * \param[in] data 
+ * - data[0] (purify_measurement_stream*): Streaming operator.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (fftw_plan*): Backward complex-to-complex FFTW plan.
+ * - data[3] (purify_measurement_workspace*) Pool of grids for the zero
+ *            padding.
+ */
+void purify_measurement_streamadj(void *out, void *in, void **data){
+
+  int i, k, r, rr;
+  purify_measurement_stream *stream;
+  purify_sparsemat_row *g;
+  double *deconv;
+  fftw_plan *plan;
+  purify_measurement_workspace *ws;
+  complex double *temp;
+  complex double *yin;
+
+  //Cast input pointers
+  stream = (purify_measurement_stream*)data[0];
+  deconv = (double*)data[1];
+  plan = (fftw_plan*)data[2];
+  ws = (purify_measurement_workspace*)data[3];
+  temp = purify_measurement_workspace_acquire(ws);
+
+  yin = (complex double*)in;
+
+  for (i = 0; i < ws->size; i++)
+    temp[i] = 0.0 + 0.0*I;
+
+  //Accumulate the adjoint interpolation of every chunk.
+  for (k = 0; k < stream->nchunks; k++) {
+    g = &stream->gmat[k];
+    for (r = 0; r < g->nrows; r++)
+      for (rr = g->rowptr[r]; rr < g->rowptr[r+1]; rr++)
+        temp[g->colind[rr]] += (g->real == 1 ? g->vals[rr] 
+                                : conj(g->cvals[rr])) * yin[r];
+    yin += g->nrows;
+  }
+
+  purify_measurement_cft_image((complex double*)out, temp, deconv, 
+                               &stream->param, plan);
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Wall clock time in seconds.
+ */
+static double purify_measurement_wtime(void) {
+  #ifdef _OPENMP
+    return omp_get_wtime();
+  #else
+    return (double)clock()/CLOCKS_PER_SEC;
+  #endif
+}
+
+/*!
+ * Benchmark configurations of the gridded continuos Fourier transform
+ * operator (interpolation kernel, support, oversampling and number of
+ * threads) and select the fastest one meeting a degridding accuracy.
+ * The accuracy is the relative error of \ref purify_measurement_cftfwd
+ * against \ref purify_measurement_dftfwd on a sample of the
+ * visibilities for a test image of extended emission and point
+ * sources, the time is that of a forward plus adjoint application on
+ * all the visibilities.
+ *
+ * \param[out] best Selected configuration.
+ * \param[in] u u coodinates of the visibilities.
+ * \param[in] v v coodinates of the visibilities.
+ * \param[in] param Parameters of the operator. Image size, umax, vmax
+ * and nmeas are used, the tuned fields are ignored.
+ * \param[in] tol Target relative degridding error.
+ * \param[in] nsample Number of visibilities used to measure the error.
+ * \param[in] maxthreads Maximum number of threads tried (powers of two
+ * up to maxthreads are benchmarked).
+ * \param[in] verbose Print every configuration if greater than zero.
+ * \retval error Zero if a configuration meets the target, otherwise
+ * best holds the most accurate configuration.
+ *
+ * \note The number of OpenMP threads of the caller is restored on
+ * return; best->nthreads is only a recommendation.
+ */
+int purify_measurement_autotune(purify_measurement_tuneconfig *best,
+                                double *u, double *v,
+                                purify_measurement_cparam *param,
+                                double tol, int nsample, int maxthreads,
+                                int verbose) {
+
+  const purify_measurement_kernel kernels[] = {
+    PURIFY_MEASUREMENT_KERNEL_NGB,
+    PURIFY_MEASUREMENT_KERNEL_GAUSS, PURIFY_MEASUREMENT_KERNEL_GAUSS,
+    PURIFY_MEASUREMENT_KERNEL_GAUSS, PURIFY_MEASUREMENT_KERNEL_GAUSS,
+    PURIFY_MEASUREMENT_KERNEL_WAVELET };
+  const int supports[] = {1, 2, 4, 6, 8, 10};
+  const int oversampling[] = {2, 4};
+  const int nkernel = 6, nover = 2;
+  const char *names[] = {"ngb", "gauss", "wavelet"};
+  int i, j, k, o, nt, stride, nx, found, nthreads;
+  unsigned long long state = 13;
+  double err, num, den, t0, t;
+  double *us, *vs, *deconv, *one;
+  complex double *xin, *xout, *yref, *ys, *y, *temp;
+  purify_measurement_cparam tparam;
+  purify_measurement_tuneconfig cfg;
+  purify_sparsemat_row gmat;
+  purify_measurement_workspace ws;
+  fftw_plan planfwd, planadj;
+  void *datadft[4];
+  void *datafwd[5];
+  void *dataadj[5];
+
+  #ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+  #else
+    nthreads = 1;
+  #endif
+  nx = param->nx1 * param->ny1;
+  if (nsample > param->nmeas) nsample = param->nmeas;
+  stride = param->nmeas / nsample;
+
+  us = (double*)malloc(nsample * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(us);
+  vs = (double*)malloc(nsample * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(vs);
+  for (i = 0; i < nsample; i++) {
+    us[i] = u[i*stride];
+    vs[i] = v[i*stride];
+  }
+  deconv = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  one = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(one);
+  xin = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xin);
+  xout = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
+  yref = (complex double*)malloc(nsample * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(yref);
+  ys = (complex double*)malloc(nsample * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ys);
+  y = (complex double*)malloc(param->nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(y);
+
+  //Test image: extended Gaussian plus a few point sources.
+  for (j = 0; j < param->ny1; j++) {
+    for (i = 0; i < param->nx1; i++) {
+      double dx = (i - param->nx1/2) / (0.05*param->nx1);
+      double dy = (j - param->ny1/2) / (0.08*param->ny1);
+      xin[j*param->nx1 + i] = exp(-0.5*(dx*dx + dy*dy));
+    }
+  }
+  for (k = 0; k < 8; k++) {
+    i = param->nx1/4 + (int)(purify_ran_uniform_r(&state) * param->nx1/2);
+    j = param->ny1/4 + (int)(purify_ran_uniform_r(&state) * param->ny1/2);
+    xin[j*param->nx1 + i] += 2.0;
+  }
+  for (i = 0; i < nx; i++) one[i] = 1.0;
+
+  //Reference visibilities.
+  tparam = *param;
+  tparam.nmeas = nsample;
+  datadft[0] = (void*)&tparam;
+  datadft[1] = (void*)one;
+  datadft[2] = (void*)us;
+  datadft[3] = (void*)vs;
+  purify_measurement_dftfwd((void*)yref, (void*)xin, datadft);
+
+  found = 0;
+  best->error = -1.0;
+  best->time = -1.0;
+  for (o = 0; o < nover; o++) {
+
+    tparam = *param;
+    tparam.ofx = oversampling[o];
+    tparam.ofy = oversampling[o];
+    purify_measurement_init_workspace(&ws, nx * tparam.ofx * tparam.ofy);
+    temp = purify_measurement_workspace_acquire(&ws);
+    planfwd = fftw_plan_dft_2d(tparam.nx1*tparam.ofx, tparam.ny1*tparam.ofy,
+                               temp, temp, FFTW_FORWARD, FFTW_MEASURE);
+    planadj = fftw_plan_dft_2d(tparam.nx1*tparam.ofx, tparam.ny1*tparam.ofy,
+                               temp, temp, FFTW_BACKWARD, FFTW_MEASURE);
+    purify_measurement_workspace_release(&ws, temp);
+
+    for (k = 0; k < nkernel; k++) {
+
+      tparam.kernel = kernels[k];
+      tparam.kx = supports[k];
+      tparam.ky = supports[k];
+
+      datafwd[0] = (void*)&tparam;
+      datafwd[1] = (void*)deconv;
+      datafwd[2] = (void*)&gmat;
+      datafwd[3] = (void*)&planfwd;
+      datafwd[4] = (void*)&ws;
+      dataadj[0] = (void*)&tparam;
+      dataadj[1] = (void*)deconv;
+      dataadj[2] = (void*)&gmat;
+      dataadj[3] = (void*)&planadj;
+      dataadj[4] = (void*)&ws;
+
+      //Accuracy on the sample.
+      tparam.nmeas = nsample;
+      purify_measurement_init_cft(&gmat, deconv, us, vs, &tparam);
+      purify_measurement_cftfwd((void*)ys, (void*)xin, datafwd);
+      purify_sparsemat_freer(&gmat);
+      num = 0.0;
+      den = 0.0;
+      for (i = 0; i < nsample; i++) {
+        num += creal((ys[i] - yref[i]) * conj(ys[i] - yref[i]));
+        den += creal(yref[i] * conj(yref[i]));
+      }
+      err = sqrt(num / den);
+
+      cfg.kernel = kernels[k];
+      cfg.support = supports[k];
+      cfg.oversampling = oversampling[o];
+      cfg.nthreads = 1;
+      cfg.error = err;
+      cfg.time = -1.0;
+
+      if (err > tol) {
+        if (verbose > 0)
+          printf("%-8s %3d %3d    - %12.4e %10s\n", names[cfg.kernel], 
+                 cfg.support, cfg.oversampling, err, "-");
+        if (!found && (best->error < 0.0 || err < best->error))
+          *best = cfg;
+        continue;
+      }
+
+      //Speed on all the visibilities.
+      tparam.nmeas = param->nmeas;
+      purify_measurement_init_cft(&gmat, deconv, u, v, &tparam);
+      for (nt = 1; nt <= purify_max(maxthreads, 1); nt *= 2) {
+        #ifdef _OPENMP
+          omp_set_num_threads(nt);
+        #endif
+        purify_measurement_cftfwd((void*)y, (void*)xin, datafwd);
+        t0 = purify_measurement_wtime();
+        purify_measurement_cftfwd((void*)y, (void*)xin, datafwd);
+        purify_measurement_cftadj((void*)xout, (void*)y, dataadj);
+        t = purify_measurement_wtime() - t0;
+        cfg.nthreads = nt;
+        cfg.time = t;
+        if (verbose > 0)
+          printf("%-8s %3d %3d %4d %12.4e %10.4f\n", names[cfg.kernel], 
+                 cfg.support, cfg.oversampling, nt, err, t);
+        if (!found || t < best->time) {
+          *best = cfg;
+          found = 1;
+        }
+      }
+      purify_sparsemat_freer(&gmat);
+    }
+
+    fftw_destroy_plan(planfwd);
+    fftw_destroy_plan(planadj);
+    purify_measurement_free_workspace(&ws);
+  }
+
+  #ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+  #endif
+
+  free(us);
+  free(vs);
+  free(deconv);
+  free(one);
+  free(xin);
+  free(xout);
+  free(yref);
+  free(ys);
+  free(y);
+
+  return found ? 0 : 1;
+
+}
+
+/*!
+ * Set the parameters of the operator from a tuned configuration. The
+ * number of threads is left to the caller (cfg->nthreads).
+ *
+ * \param[in,out] param Parameters of the operator.
+ * \param[in] cfg Configuration, see \ref purify_measurement_autotune.
+ */
+void purify_measurement_tune_apply(purify_measurement_cparam *param,
+                                   purify_measurement_tuneconfig *cfg) {
+
+  param->kernel = cfg->kernel;
+  param->kx = cfg->support;
+  param->ky = cfg->support;
+  param->ofx = cfg->oversampling;
+  param->ofy = cfg->oversampling;
+
+}
+
+/*!
+ * Write a tuned configuration to a key=value text file.
+ *
+ * \param[in] cfg Configuration.
+ * \param[in] filename Name of the file.
+ * \retval error Zero return indicates no errors.
+ */
+int purify_measurement_tune_write(purify_measurement_tuneconfig *cfg,
+                                  const char *filename) {
+
+  FILE *file;
+
+  file = fopen(filename, "w");
+  if (file == NULL)
+    return 1;
+
+  fprintf(file, "kernel=%d\n", (int)cfg->kernel);
+  fprintf(file, "support=%d\n", cfg->support);
+  fprintf(file, "oversampling=%d\n", cfg->oversampling);
+  fprintf(file, "threads=%d\n", cfg->nthreads);
+  fprintf(file, "error=%.17g\n", cfg->error);
+  fprintf(file, "time=%.17g\n", cfg->time);
+  fclose(file);
+
+  return 0;
+
+}
+
+/*!
+ * Read a tuned configuration written by \ref
+ * purify_measurement_tune_write. Unknown keys are ignored.
+ *
+ * \param[out] cfg Configuration.
+ * \param[in] filename Name of the file.
+ * \retval error Zero return indicates no errors (non-zero if the file
+ * cannot be opened or misses a required key).
+ */
+int purify_measurement_tune_read(purify_measurement_tuneconfig *cfg,
+                                 const char *filename) {
+
+  FILE *file;
+  char buffer[PURIFY_STRLEN];
+  char *val;
+  int nkeys = 0;
+
+  file = fopen(filename, "r");
+  if (file == NULL)
+    return 1;
+
+  cfg->nthreads = 1;
+  cfg->error = -1.0;
+  cfg->time = -1.0;
+  while (fgets(buffer, PURIFY_STRLEN, file) != NULL) {
+    val = strchr(buffer, '=');
+    if (val == NULL)
+      continue;
+    *val++ = '\0';
+    if (strcmp(buffer, "kernel") == 0) {
+      cfg->kernel = (purify_measurement_kernel)atoi(val);
+      nkeys++;
+    }
+    else if (strcmp(buffer, "support") == 0) {
+      cfg->support = atoi(val);
+      nkeys++;
+    }
+    else if (strcmp(buffer, "oversampling") == 0) {
+      cfg->oversampling = atoi(val);
+      nkeys++;
+    }
+    else if (strcmp(buffer, "threads") == 0)
+      cfg->nthreads = atoi(val);
+    else if (strcmp(buffer, "error") == 0)
+      cfg->error = atof(val);
+    else if (strcmp(buffer, "time") == 0)
+      cfg->time = atof(val);
+  }
+  fclose(file);
+
+  return nkeys == 3 ? 0 : 1;
+
+}
+
+/*!
+ * Accumulate visibilities on the oversampled grid, i.e. compute
+ * \f$g = g + G^H y\f$ for a block of rows G of the gridding matrix.
+ * Together with \ref purify_measurement_cftgrid_image it computes the
+ * adjoint operator incrementally, e.g. while the visibilities are read.
+ *
+ * \param[in,out] grid Oversampled grid.
+ * \param[in] mat Rows of the gridding matrix of the visibilities.
+ * \param[in] y Visibilities.
+ *
+ * \note Each thread owns a contiguous range of grid cells (a tile of
+ * grid rows) and adds only the entries falling in it, so no two threads
+ * write the same cell and the sums are those of the serial loop.
+ */
+void purify_measurement_cftgrid_add(complex double *grid,
+                                    purify_sparsemat_row *mat,
+                                    complex double *y) {
+
+  int i, j, c, t, nt, lo, hi;
+
+  #pragma omp parallel private(i, j, c, t, nt, lo, hi)
+  {
+    #ifdef _OPENMP
+      t = omp_get_thread_num();
+      nt = omp_get_num_threads();
+    #else
+      t = 0;
+      nt = 1;
+    #endif
+    lo = (long long)mat->ncols * t / nt;
+    hi = (long long)mat->ncols * (t + 1) / nt;
+    if (mat->real == 1) {
+      for (i = 0; i < mat->nrows; i++)
+        for (j = mat->rowptr[i]; j < mat->rowptr[i+1]; j++) {
+          c = mat->colind[j];
+          if (c >= lo && c < hi)
+            grid[c] += mat->vals[j] * y[i];
+        }
+    }
+    else {
+      for (i = 0; i < mat->nrows; i++)
+        for (j = mat->rowptr[i]; j < mat->rowptr[i+1]; j++) {
+          c = mat->colind[j];
+          if (c >= lo && c < hi)
+            grid[c] += conj(mat->cvals[j]) * y[i];
+        }
+    }
+  }
+
+}
+
+/*!
+ * Image of an oversampled grid accumulated with \ref
+ * purify_measurement_cftgrid_add (last stage of the adjoint operator).
+ *
+ * \param[out] xout Output image.
+ * \param[in,out] grid Oversampled grid (overwritten).
+ * \param[in] deconv Deconvolution kernel in image space.
+ * \param[in] param Parameters of the operator.
+ * \param[in] plan Backward complex-to-complex FFTW plan.
+ */
+void purify_measurement_cftgrid_image(complex double *xout,
+                                      complex double *grid,
+                                      double *deconv,
+                                      purify_measurement_cparam *param,
+                                      fftw_plan *plan) {
+
+  purify_measurement_cft_image(xout, grid, deconv, param, plan);
+
+}
+
+/*!
+ * Grid a chunk of visibilities, as read by \ref
+ * purify_visibility_reader_pass, to compute the dirty image, the PSF
+ * and the weight histogram of a data set in a single pass over it.
+ *
+ * \param[in] chunk Visibilities of the chunk.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters of the operator.
+ * - data[1] (double*): Deconvolution kernel in image space, set by the
+ *   caller with \ref purify_measurement_init_deconv (not used herein).
+ * - data[2] (complex double*): Oversampled grid of the visibilities,
+ *   see \ref purify_measurement_cftgrid_add (NULL to skip).
+ * - data[3] (complex double*): Oversampled grid of the unit
+ *   visibilities, i.e. of the PSF (NULL to skip).
+ * - data[4] (double*): Histogram of the natural weights on the
+ *   oversampled grid, see \ref purify_visibility_histogram_add (NULL
+ *   to skip).
+ */
+void purify_measurement_cftgrid_chunk(purify_visibility *chunk, 
+                                      void **data) {
+
+  int i;
+  purify_measurement_cparam param;
+  purify_sparsemat_row gmat;
+  double *hist;
+  complex double *grid, *psf, *ones;
+
+  param = *(purify_measurement_cparam*)data[0];
+  grid = (complex double*)data[2];
+  psf = (complex double*)data[3];
+  hist = (double*)data[4];
+
+  param.nmeas = chunk->nmeas;
+  purify_measurement_init_cft(&gmat, NULL, chunk->u, chunk->v, &param);
+  if (grid != NULL)
+    purify_measurement_cftgrid_add(grid, &gmat, chunk->y);
+  if (psf != NULL) {
+    ones = (complex double*)malloc(chunk->nmeas * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(ones);
+    for (i = 0; i < chunk->nmeas; i++) 
+      ones[i] = 1.0;
+    purify_measurement_cftgrid_add(psf, &gmat, ones);
+    free(ones);
+  }
+  if (hist != NULL)
+    purify_visibility_histogram_add(hist, chunk, param.umax, param.vmax,
+                                    param.nx1*param.ofx, 
+                                    param.ny1*param.ofy);
+  purify_sparsemat_freer(&gmat);
+
+}
+
+/*!
+ * Compute the point spread function (dirty beam) of a coverage, i.e.
+ * the adjoint of the gridded operator applied to the (weighted) unit
+ * visibilities, normalised to unit peak, and fit a Gaussian to its
+ * main lobe. The PSF is cached on disk in a fits file keyed by the
+ * coverage, the weights and the operator parameters, and read back
+ * instead of recomputed when the same key is requested again.
+ *
+ * \param[out] psf Point spread function (memory for the pixels is
+ * allocated herein and must be freed by the calling routine).
+ * \param[out] beam Gaussian fitted to the main lobe (not computed if
+ * NULL).
+ * \param[in] u Vector with the u coordinates of the visibilities.
+ * \param[in] v Vector with the v coordinates of the visibilities.
+ * \param[in] weights Imaging weights of the visibilities (unit
+ * weights if NULL).
+ * \param[in] param Parameters of the operator (pixel size, kernel
+ * and oversampling).
+ * \param[in] extend Factor by which the field of the PSF is extended
+ * with respect to the image (1 or 2). A 2x extended PSF covers the
+ * sidelobes at every separation of two pixels of the image.
+ * \param[in] cachedir Directory of the cache (NULL to disable).
+ * \retval cached One if the PSF was read from the cache, zero if it
+ * was computed.
+ */
+int purify_measurement_psf(purify_image *psf, 
+                           purify_measurement_beam *beam,
+                           double *u, double *v, double *weights,
+                           purify_measurement_cparam *param,
+                           int extend, const char *cachedir) {
+
+  char filename[PURIFY_STRLEN];
+  FILE *file;
+  int i, nx, kernel, cached = 0;
+  unsigned long long key = PURIFY_UTILS_HASH_INIT;
+  double peak;
+  double *deconv;
+  complex double *y, *xout, *temp;
+  purify_measurement_cparam pparam;
+  purify_sparsemat_row gmat;
+  purify_measurement_workspace ws;
+  fftw_plan planadj;
+  void *dataadj[5];
+
+  pparam = *param;
+  pparam.nx1 = param->nx1 * extend;
+  pparam.ny1 = param->ny1 * extend;
+  nx = pparam.nx1 * pparam.ny1;
+
+  //Key of the PSF in the cache.
+  if (cachedir != NULL) {
+    kernel = pparam.kernel;
+    key = purify_utils_hash(key, &pparam.nmeas, sizeof(int));
+    key = purify_utils_hash(key, &pparam.nx1, sizeof(int));
+    key = purify_utils_hash(key, &pparam.ny1, sizeof(int));
+    key = purify_utils_hash(key, &pparam.ofx, sizeof(int));
+    key = purify_utils_hash(key, &pparam.ofy, sizeof(int));
+    key = purify_utils_hash(key, &pparam.kx, sizeof(int));
+    key = purify_utils_hash(key, &pparam.ky, sizeof(int));
+    key = purify_utils_hash(key, &kernel, sizeof(int));
+    key = purify_utils_hash(key, &pparam.umax, sizeof(double));
+    key = purify_utils_hash(key, &pparam.vmax, sizeof(double));
+    key = purify_utils_hash(key, &pparam.l0, sizeof(double));
+    key = purify_utils_hash(key, &pparam.m0, sizeof(double));
+    key = purify_utils_hash(key, u, pparam.nmeas * sizeof(double));
+    key = purify_utils_hash(key, v, pparam.nmeas * sizeof(double));
+    if (weights != NULL)
+      key = purify_utils_hash(key, weights, pparam.nmeas * sizeof(double));
+    sprintf(filename, "%s/psf_%016llx.fits", cachedir, key);
+    file = fopen(filename, "r");
+    if (file != NULL) {
+      fclose(file);
+      purify_image_readfile(psf, filename, PURIFY_IMAGE_FILETYPE_FITS);
+      cached = psf->nx == pparam.nx1 && psf->ny == pparam.ny1;
+      if (!cached)
+        free(psf->pix);
+    }
+  }
+
+  if (!cached) {
+    deconv = (double*)malloc(nx * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+    xout = (complex double*)malloc(nx * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
+    y = (complex double*)malloc(pparam.nmeas * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(y);
+    for (i = 0; i < pparam.nmeas; i++)
+      y[i] = weights != NULL ? weights[i] : 1.0;
+
+    purify_measurement_init_cft(&gmat, deconv, u, v, &pparam);
+    purify_measurement_init_workspace(&ws, nx * pparam.ofx * pparam.ofy);
+    temp = purify_measurement_workspace_acquire(&ws);
+    planadj = fftw_plan_dft_2d(pparam.nx1*pparam.ofx, pparam.ny1*pparam.ofy,
+                               temp, temp, FFTW_BACKWARD, FFTW_ESTIMATE);
+    purify_measurement_workspace_release(&ws, temp);
+
+    dataadj[0] = (void*)&pparam;
+    dataadj[1] = (void*)deconv;
+    dataadj[2] = (void*)&gmat;
+    dataadj[3] = (void*)&planadj;
+    dataadj[4] = (void*)&ws;
+    purify_measurement_cftadj((void*)xout, (void*)y, dataadj);
+
+    psf->nx = pparam.nx1;
+    psf->ny = pparam.ny1;
+    psf->fov_x = pparam.nx1 / (2.0 * pparam.umax);
+    psf->fov_y = pparam.ny1 / (2.0 * pparam.vmax);
+    psf->pix = (double*)malloc(nx * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(psf->pix);
+    peak = 0.0;
+    for (i = 0; i < nx; i++) {
+      psf->pix[i] = creal(xout[i]);
+      if (psf->pix[i] > peak) peak = psf->pix[i];
+    }
+    if (peak > 0.0)
+      for (i = 0; i < nx; i++)
+        psf->pix[i] /= peak;
+
+    if (cachedir != NULL)
+      purify_image_writefile(psf, filename, PURIFY_IMAGE_FILETYPE_FITS);
+
+    fftw_destroy_plan(planadj);
+    purify_measurement_free_workspace(&ws);
+    purify_sparsemat_freer(&gmat);
+    free(deconv);
+    free(xout);
+    free(y);
+  }
+  else {
+    psf->fov_x = pparam.nx1 / (2.0 * pparam.umax);
+    psf->fov_y = pparam.ny1 / (2.0 * pparam.vmax);
+  }
+
+  if (beam != NULL)
+    purify_measurement_fitbeam(beam, psf);
+
+  return cached;
+
+}
+
+/*!
+ * Fit an elliptical Gaussian to the main lobe of a point spread
+ * function. The logarithm of the pixels above 35% of the peak that
+ * are connected to the peak is fitted in the least squares
+ * sense by a quadratic form centred on the peak,
+ * \f$\log p = a + d x^2 + e x y + f y^2\f$, with weights \f$p^2\f$.
+ *
+ * \param[out] beam Fitted Gaussian.
+ * \param[in] psf Point spread function.
+ */
+void purify_measurement_fitbeam(purify_measurement_beam *beam, 
+                                purify_image *psf) {
+
+  int i, j, k, l, n, ic, jc, ipk, piv, nstack;
+  int *stack;
+  char *seen;
+  double p, lp, wt, b[4], ata[4][4], atb[4], t;
+  double a11, a12, a22, tr, det, disc, lmin, lmax;
+
+  n = psf->nx * psf->ny;
+  stack = (int*)malloc(n * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(stack);
+  seen = (char*)calloc(n, sizeof(char));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(seen);
+
+  //Peak of the PSF.
+  ipk = 0;
+  for (i = 1; i < n; i++)
+    if (psf->pix[i] > psf->pix[ipk]) ipk = i;
+  ic = ipk % psf->nx;
+  jc = ipk / psf->nx;
+
+  //Normal equations of the weighted log fit, accumulated over the
+  //main lobe found by flood fill from the peak.
+  for (k = 0; k < 4; k++) {
+    atb[k] = 0.0;
+    for (l = 0; l < 4; l++) ata[k][l] = 0.0;
+  }
+  nstack = 0;
+  stack[nstack++] = ipk;
+  seen[ipk] = 1;
+  while (nstack > 0) {
+    k = stack[--nstack];
+    i = k % psf->nx;
+    j = k / psf->nx;
+    p = psf->pix[k] / psf->pix[ipk];
+    b[0] = 1.0;
+    b[1] = (double)(i - ic) * (i - ic);
+    b[2] = (double)(i - ic) * (j - jc);
+    b[3] = (double)(j - jc) * (j - jc);
+    lp = log(p);
+    wt = p * p;
+    for (k = 0; k < 4; k++) {
+      atb[k] += wt * b[k] * lp;
+      for (l = 0; l < 4; l++) ata[k][l] += wt * b[k] * b[l];
+    }
+    for (l = 0; l < 4; l++) {
+      if ((l == 0 && i == 0) || (l == 1 && i == psf->nx - 1) 
+          || (l == 2 && j == 0) || (l == 3 && j == psf->ny - 1))
+        continue;
+      k = j * psf->nx + i + (l == 0 ? -1 : l == 1 ? 1 : 
+                             l == 2 ? -psf->nx : psf->nx);
+      if (!seen[k] && psf->pix[k] >= 0.35 * psf->pix[ipk]) {
+        seen[k] = 1;
+        stack[nstack++] = k;
+      }
+    }
+  }
+  free(stack);
+  free(seen);
+
+  //Solve by Gaussian elimination with partial pivoting.
+  for (k = 0; k < 4; k++) {
+    piv = k;
+    for (l = k + 1; l < 4; l++)
+      if (fabs(ata[l][k]) > fabs(ata[piv][k])) piv = l;
+    for (l = 0; l < 4; l++) {
+      t = ata[k][l]; ata[k][l] = ata[piv][l]; ata[piv][l] = t;
+    }
+    t = atb[k]; atb[k] = atb[piv]; atb[piv] = t;
+    if (ata[k][k] == 0.0) {
+      //Degenerate lobe (e.g. a single pixel).
+      beam->bmaj = 0.0;
+      beam->bmin = 0.0;
+      beam->bpa = 0.0;
+      return;
+    }
+    for (l = k + 1; l < 4; l++) {
+      t = ata[l][k] / ata[k][k];
+      for (i = k; i < 4; i++) ata[l][i] -= t * ata[k][i];
+      atb[l] -= t * atb[k];
+    }
+  }
+  for (k = 3; k >= 0; k--) {
+    for (l = k + 1; l < 4; l++) atb[k] -= ata[k][l] * atb[l];
+    atb[k] /= ata[k][k];
+  }
+
+  //Inverse covariance of the Gaussian and its eigenvalues.
+  a11 = -2.0 * atb[1];
+  a12 = -atb[2];
+  a22 = -2.0 * atb[3];
+  tr = a11 + a22;
+  det = a11 * a22 - a12 * a12;
+  disc = sqrt(purify_max(0.0, 0.25 * tr * tr - det));
+  lmin = 0.5 * tr - disc;
+  lmax = 0.5 * tr + disc;
+  beam->bmaj = lmin > 0.0 ? 2.0 * sqrt(2.0 * log(2.0) / lmin) : 0.0;
+  beam->bmin = lmax > 0.0 ? 2.0 * sqrt(2.0 * log(2.0) / lmax) : 0.0;
+  beam->bpa = 0.5 * atan2(2.0 * a12, a11 - a22) + PURIFY_PION2;
+  if (beam->bpa > PURIFY_PION2) beam->bpa -= PURIFY_PI;
+
+}
+
+/*!
+ * Read nbytes at an offset of a file, retrying partial transfers.
+ */
+static void purify_measurement_oocfft_io(int fd, void *buf, size_t nbytes,
+                                         off_t offset) {
+
+  ssize_t r;
+  char *p = (char*)buf;
+
+  while (nbytes > 0) {
+    r = pread(fd, p, nbytes, offset);
+    if (r <= 0)
+      PURIFY_ERROR_GENERIC("Out-of-core FFT file access failed");
+    p += r;
+    offset += r;
+    nbytes -= r;
+  }
+
+}
+
+/*!
+ * Create an out-of-core FFT of an nrows x ncols grid. The grid is a
+ * temporary file mapped in memory (ooc->grid), so that the operating
+ * system can evict it from RAM, and the transpose goes through a
+ * second mapped temporary file. Both files are removed when closed.
+ *
+ * \param[out] ooc Out-of-core FFT.
+ * \param[in] nrows Number of rows of the grid.
+ * \param[in] ncols Number of columns of the grid.
+ * \param[in] slab Number of rows per slab held in memory (reduced to
+ * a common divisor of nrows and ncols).
+ * \param[in] dir Directory of the temporary files.
+ *
+ * \note The slabs are read with pread from the mapped files, which
+ * relies on the unified buffer cache of Linux and the BSDs.
+ */
+void purify_measurement_init_oocfft(purify_measurement_oocfft *ooc,
+                                    int nrows, int ncols, int slab,
+                                    const char *dir) {
+
+  char filename[PURIFY_STRLEN];
+  size_t size, nbuf;
+  int i;
+
+  ooc->nrows = nrows;
+  ooc->ncols = ncols;
+  slab = purify_min(slab, purify_min(nrows, ncols));
+  while (slab > 1 && (nrows % slab != 0 || ncols % slab != 0))
+    slab--;
+  ooc->slab = slab;
+  size = (size_t)nrows * ncols * sizeof(complex double);
+
+  sprintf(filename, "%s/purify_grid_XXXXXX", dir);
+  ooc->fd = mkstemp(filename);
+  if (ooc->fd < 0)
+    PURIFY_ERROR_GENERIC("Failed to create the out-of-core grid file");
+  unlink(filename);
+  sprintf(filename, "%s/purify_gridt_XXXXXX", dir);
+  ooc->fdt = mkstemp(filename);
+  if (ooc->fdt < 0)
+    PURIFY_ERROR_GENERIC("Failed to create the out-of-core scratch file");
+  unlink(filename);
+  if (ftruncate(ooc->fd, size) != 0 || ftruncate(ooc->fdt, size) != 0)
+    PURIFY_ERROR_GENERIC("Failed to size the out-of-core files");
+
+  ooc->grid = (complex double*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, ooc->fd, 0);
+  if (ooc->grid == MAP_FAILED)
+    PURIFY_ERROR_GENERIC("Failed to map the out-of-core grid file");
+  ooc->gridt = (complex double*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, ooc->fdt, 0);
+  if (ooc->gridt == MAP_FAILED)
+    PURIFY_ERROR_GENERIC("Failed to map the out-of-core scratch file");
+
+  nbuf = (size_t)slab * purify_max(nrows, ncols);
+  for (i = 0; i < 2; i++) {
+    ooc->buf[i] = (complex double*)purify_utils_malloc(nbuf 
+                                                       * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(ooc->buf[i]);
+  }
+
+  ooc->rowfwd = fftw_plan_many_dft(1, &ooc->ncols, slab, 
+                                   ooc->buf[0], NULL, 1, ncols,
+                                   ooc->buf[0], NULL, 1, ncols,
+                                   FFTW_FORWARD, FFTW_MEASURE);
+  ooc->rowadj = fftw_plan_many_dft(1, &ooc->ncols, slab, 
+                                   ooc->buf[0], NULL, 1, ncols,
+                                   ooc->buf[0], NULL, 1, ncols,
+                                   FFTW_BACKWARD, FFTW_MEASURE);
+  ooc->colfwd = fftw_plan_many_dft(1, &ooc->nrows, slab, 
+                                   ooc->buf[0], NULL, 1, nrows,
+                                   ooc->buf[0], NULL, 1, nrows,
+                                   FFTW_FORWARD, FFTW_MEASURE);
+  ooc->coladj = fftw_plan_many_dft(1, &ooc->nrows, slab, 
+                                   ooc->buf[0], NULL, 1, nrows,
+                                   ooc->buf[0], NULL, 1, nrows,
+                                   FFTW_BACKWARD, FFTW_MEASURE);
+
+}
+
+/*!
+ * Free an out-of-core FFT and remove its files.
+ *
+ * \param[in,out] ooc Out-of-core FFT.
+ */
+void purify_measurement_free_oocfft(purify_measurement_oocfft *ooc) {
+
+  int i;
+
+  munmap(ooc->grid, 
+         (size_t)ooc->nrows * ooc->ncols * sizeof(complex double));
+  munmap(ooc->gridt, 
+         (size_t)ooc->nrows * ooc->ncols * sizeof(complex double));
+  close(ooc->fd);
+  close(ooc->fdt);
+  for (i = 0; i < 2; i++)
+    purify_utils_free(ooc->buf[i]);
+  fftw_destroy_plan(ooc->rowfwd);
+  fftw_destroy_plan(ooc->rowadj);
+  fftw_destroy_plan(ooc->colfwd);
+  fftw_destroy_plan(ooc->coladj);
+
+}
+
+/*!
+ * One pass of the out-of-core FFT: transform the rows of the src file
+ * slab by slab and copy them transposed, in slab x slab tiles, to the
+ * mapped dst file. The next slab is read while the current one is
+ * transformed and copied.
+ */
+static void purify_measurement_oocfft_pass(purify_measurement_oocfft *ooc,
+                                           int src, complex double *dst, 
+                                           int nrows, int ncols,
+                                           fftw_plan plan) {
+
+  int k, r, c, cb, s, nslab;
+  size_t bytes;
+  complex double *cur, *run;
+
+  s = ooc->slab;
+  nslab = nrows / s;
+  bytes = (size_t)s * ncols * sizeof(complex double);
+
+  purify_measurement_oocfft_io(src, ooc->buf[0], bytes, 0);
+  for (k = 0; k < nslab; k++) {
+    cur = ooc->buf[k % 2];
+    #pragma omp parallel sections num_threads(2) private(r, c, cb, run)
+    {
+      #pragma omp section
+      {
+        //Transform the current slab and copy it transposed tile by
+        //tile; column c of the slab is a contiguous run of the dst row c.
+        fftw_execute_dft(plan, cur, cur);
+        for (cb = 0; cb < ncols; cb += s)
+          for (c = cb; c < cb + s; c++) {
+            run = dst + (size_t)c*nrows + (size_t)k*s;
+            for (r = 0; r < s; r++)
+              run[r] = cur[(size_t)r*ncols + c];
+          }
+      }
+      #pragma omp section
+      {
+        //Read the next slab.
+        if (k + 1 < nslab)
+          purify_measurement_oocfft_io(src, ooc->buf[(k + 1) % 2], bytes,
+                                       (off_t)(k + 1) * bytes);
+      }
+    }
+  }
+
+}
+
+/*!
+ * Execute the out-of-core FFT in place on ooc->grid (unnormalised,
+ * as FFTW).
+ *
+ * \param[in,out] ooc Out-of-core FFT.
+ * \param[in] sign FFTW_FORWARD or FFTW_BACKWARD.
+ */
+void purify_measurement_oocfft_execute(purify_measurement_oocfft *ooc,
+                                       int sign) {
+
+  //Rows of the grid to the transposed scratch file, then rows of the
+  //scratch file (columns of the grid) back to the grid.
+  purify_measurement_oocfft_pass(ooc, ooc->fd, ooc->gridt, 
+                                 ooc->nrows, ooc->ncols,
+                                 sign == FFTW_FORWARD ? 
+                                 ooc->rowfwd : ooc->rowadj);
+  purify_measurement_oocfft_pass(ooc, ooc->fdt, ooc->grid, 
+                                 ooc->ncols, ooc->nrows,
+                                 sign == FFTW_FORWARD ? 
+                                 ooc->colfwd : ooc->coladj);
+
+}
+
+/*!
+ * Measurement operator for continuos visibilities with the grid out
+ * of core (see \ref purify_measurement_cftfwd).
+ *
+ * \param[out] out (complex double*) Measured visibilities.
+ * \param[in] in (complex double*) Input image.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Deconvolution kernel in image space.
+ * - data[2] (purify_sparsemat_row*): Sparse matrix storing the
+ *            interpolation kernel.
+ * - data[3] (purify_measurement_oocfft*): Out-of-core FFT of the
+ *            oversampled grid (ncols = nx1*ofx, nrows = ny1*ofy).
+ *
+ * \note The grid is shared, so the operator is not re-entrant.
+ */
+void purify_measurement_ooccftfwd(void *out, void *in, void **data){
+
+  purify_measurement_cparam *param;
+  double *deconv;
+  purify_sparsemat_row *mat;
+  purify_measurement_oocfft *ooc;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  mat = (purify_sparsemat_row*)data[2];
+  ooc = (purify_measurement_oocfft*)data[3];
+
+  //Zero padding and decovoluntion on the mapped grid, then FFT
+  purify_measurement_cft_grid(ooc->grid, (complex double*)in, deconv, 
+                              param, NULL);
+  purify_measurement_oocfft_execute(ooc, FFTW_FORWARD);
+
+  //Multiplication by the sparse matrix storing the interpolation kernel
+  purify_sparsemat_fwd_complexr((complex double*)out, ooc->grid, mat);
+
+}
+
+/*!
+ * Adjoint measurement operator for continuos visibilities with the
+ * grid out of core (see \ref purify_measurement_cftadj).
+ *
+ * \param[out] out (complex double*) Output image.
+ * \param[in] in (complex double*) Input visibilities.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Deconvolution kernel in image space.
+ * - data[2] (purify_sparsemat_row*): Sparse matrix storing the
+ *            interpolation kernel.
+ * - data[3] (purify_measurement_oocfft*): Out-of-core FFT of the
+ *            oversampled grid (ncols = nx1*ofx, nrows = ny1*ofy).
+ *
+ * \note The grid is shared, so the operator is not re-entrant.
+ */
+void purify_measurement_ooccftadj(void *out, void *in, void **data){
+
+  purify_measurement_cparam *param;
+  double *deconv;
+  purify_sparsemat_row *mat;
+  purify_measurement_oocfft *ooc;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  mat = (purify_sparsemat_row*)data[2];
+  ooc = (purify_measurement_oocfft*)data[3];
+
+  //Multiplication by the adjoint of the 
+  //sparse matrix storing the interpolation kernel
+  purify_sparsemat_adj_complexr(ooc->grid, (complex double*)in, mat);
+
+  //Inverse FFT, cropping and decovoluntion
+  purify_measurement_oocfft_execute(ooc, FFTW_BACKWARD);
+  purify_measurement_cft_image((complex double*)out, ooc->grid, deconv, 
+                               param, NULL);
+
+}
+
+#ifdef PURIFY_MPI
+/*!
+ * Measurement operator for continuos visibilities partitioned across
+ * the ranks of a communicator (see \ref purify_visibility_mpi_scatter).
+ * The image is replicated on every rank and each rank degrids its own
+ * visibilities, so no communication is needed.
+ *
+ * \param[out] out (complex double*) Visibilities of the calling rank.
+ * \param[in] in (complex double*) Input image (same on every rank).
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform (nmeas is the local number of
+ *            visibilities).
+ * - data[1] (double*): Deconvolution kernel in image space.
+ * - data[2] (purify_sparsemat_row*): Rows of the gridding matrix of
+ *            the local visibilities.
+ * - data[3] (fftw_plan*): Plan for computing the FFT.
+ * - data[4] (purify_measurement_workspace*): Pool of oversampled grids.
+ * - data[5] (MPI_Comm*): Communicator.
+ */
+void purify_measurement_mpicftfwd(void *out, void *in, void **data){
+
+  purify_measurement_cftfwd(out, in, data);
+
+}
+
+/*!
+ * Adjoint measurement operator for continuos visibilities partitioned
+ * across the ranks of a communicator. Each rank scatters its
+ * visibilities onto the oversampled grid, the grids are summed with
+ * MPI_Allreduce, and every rank computes the same image.
+ *
+ * \param[out] out (complex double*) Output image (same on every rank).
+ * \param[in] in (complex double*) Visibilities of the calling rank.
+ * \param[in] data See \ref purify_measurement_mpicftfwd.
+ */
+void purify_measurement_mpicftadj(void *out, void *in, void **data){
+
+  purify_measurement_cparam *param;
+  double *deconv;
+  purify_sparsemat_row *mat;
+  fftw_plan *plan;
+  purify_measurement_workspace *ws;
+  MPI_Comm *comm;
+  complex double *temp;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  mat = (purify_sparsemat_row*)data[2];
+  plan = (fftw_plan*)data[3];
+  ws = (purify_measurement_workspace*)data[4];
+  comm = (MPI_Comm*)data[5];
+  temp = purify_measurement_workspace_acquire(ws);
+
+  //Local scatter and sum of the grids of all ranks
+  purify_sparsemat_adj_complexr(temp, (complex double*)in, mat);
+  MPI_Allreduce(MPI_IN_PLACE, (double*)temp, 2 * mat->ncols, MPI_DOUBLE,
+                MPI_SUM, *comm);
+
+  //Inverse FFT, cropping and decovoluntion
+  purify_measurement_cft_image((complex double*)out, temp, deconv, 
+                               param, plan);
+
+  purify_measurement_workspace_release(ws, temp);
+
+}
+
+/*!
+ * Create a gridded measurement operator distributed in slabs of rows
+ * (see \ref purify_measurement_slab). Rank r owns rows [r nimg, (r+1)
+ * nimg) of the image and [r nr, (r+1) nr) of the oversampled grid.
+ *
+ * \param[out] slab Distributed operator.
+ * \param[in] u Vector with the u coordinates of all visibilities.
+ * \param[in] v Vector with the v coordinates of all visibilities.
+ * \param[in] param Parameters of the operator. The number of ranks
+ * must divide ny1, nx1*ofx and ny1*ofy.
+ * \param[in] comm Communicator.
+ */
+void purify_measurement_init_slab(purify_measurement_slab *slab,
+                                  double *u, double *v,
+                                  purify_measurement_cparam *param,
+                                  MPI_Comm comm) {
+
+  int i, j, c0, c1, nvals;
+  double *deconv;
+  purify_sparsemat_row gmat;
+
+  slab->param = *param;
+  slab->comm = comm;
+  MPI_Comm_size(comm, &slab->nprocs);
+  MPI_Comm_rank(comm, &slab->rank);
+  slab->nx2 = param->nx1 * param->ofx;
+  slab->ny2 = param->ny1 * param->ofy;
+  if (param->ny1 % slab->nprocs != 0 || slab->nx2 % slab->nprocs != 0
+      || slab->ny2 % slab->nprocs != 0)
+    PURIFY_ERROR_GENERIC("Number of ranks must divide the image and grid");
+  slab->nr = slab->ny2 / slab->nprocs;
+  slab->nc = slab->nx2 / slab->nprocs;
+  slab->nimg = param->ny1 / slab->nprocs;
+
+  //Gridding matrix and deconvolution kernel, keeping the local part.
+  deconv = (double*)malloc(param->nx1 * param->ny1 * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  purify_measurement_init_cft(&gmat, deconv, u, v, param);
+  slab->deconv = (double*)malloc(slab->nimg * param->nx1 * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->deconv);
+  memcpy(slab->deconv, deconv + slab->rank * slab->nimg * param->nx1,
+         slab->nimg * param->nx1 * sizeof(double));
+  free(deconv);
+
+  c0 = slab->rank * slab->nr * slab->nx2;
+  c1 = c0 + slab->nr * slab->nx2;
+  nvals = 0;
+  for (j = 0; j < gmat.nvals; j++)
+    if (gmat.colind[j] >= c0 && gmat.colind[j] < c1) nvals++;
+  slab->gmat.nrows = gmat.nrows;
+  slab->gmat.ncols = c1 - c0;
+  slab->gmat.nvals = nvals;
+  slab->gmat.real = gmat.real;
+  slab->gmat.vals = NULL;
+  slab->gmat.cvals = NULL;
+  if (gmat.real == 1) {
+    slab->gmat.vals = (double*)purify_utils_malloc(nvals * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(slab->gmat.vals);
+  }
+  else {
+    slab->gmat.cvals = (complex double*)purify_utils_malloc(nvals 
+                                               * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(slab->gmat.cvals);
+  }
+  slab->gmat.colind = (int*)purify_utils_malloc(nvals * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->gmat.colind);
+  slab->gmat.rowptr = (int*)purify_utils_malloc((gmat.nrows + 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->gmat.rowptr);
+  nvals = 0;
+  for (i = 0; i < gmat.nrows; i++) {
+    slab->gmat.rowptr[i] = nvals;
+    for (j = gmat.rowptr[i]; j < gmat.rowptr[i+1]; j++) {
+      if (gmat.colind[j] < c0 || gmat.colind[j] >= c1) continue;
+      slab->gmat.colind[nvals] = gmat.colind[j] - c0;
+      if (gmat.real == 1)
+        slab->gmat.vals[nvals] = gmat.vals[j];
+      else
+        slab->gmat.cvals[nvals] = gmat.cvals[j];
+      nvals++;
+    }
+  }
+  slab->gmat.rowptr[gmat.nrows] = nvals;
+  purify_sparsemat_freer(&gmat);
+
+  //Local slabs and exchange buffers (all of nr*nx2 = nc*ny2 elements).
+  i = slab->nr * slab->nx2;
+  slab->grid = (complex double*)purify_utils_malloc(i * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->grid);
+  slab->gridt = (complex double*)purify_utils_malloc(i * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->gridt);
+  slab->sbuf = (complex double*)purify_utils_malloc(i * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->sbuf);
+  slab->rbuf = (complex double*)purify_utils_malloc(i * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(slab->rbuf);
+
+  slab->rowfwd = fftw_plan_many_dft(1, &slab->nx2, slab->nr, 
+                                    slab->grid, NULL, 1, slab->nx2,
+                                    slab->grid, NULL, 1, slab->nx2,
+                                    FFTW_FORWARD, FFTW_MEASURE);
+  slab->rowadj = fftw_plan_many_dft(1, &slab->nx2, slab->nr, 
+                                    slab->grid, NULL, 1, slab->nx2,
+                                    slab->grid, NULL, 1, slab->nx2,
+                                    FFTW_BACKWARD, FFTW_MEASURE);
+  slab->colfwd = fftw_plan_many_dft(1, &slab->ny2, slab->nc, 
+                                    slab->gridt, NULL, 1, slab->ny2,
+                                    slab->gridt, NULL, 1, slab->ny2,
+                                    FFTW_FORWARD, FFTW_MEASURE);
+  slab->coladj = fftw_plan_many_dft(1, &slab->ny2, slab->nc, 
+                                    slab->gridt, NULL, 1, slab->ny2,
+                                    slab->gridt, NULL, 1, slab->ny2,
+                                    FFTW_BACKWARD, FFTW_MEASURE);
+
+}
+
+/*!
+ * Free a slab distributed operator.
+ *
+ * \param[in,out] slab Distributed operator.
+ */
+void purify_measurement_free_slab(purify_measurement_slab *slab) {
+
+  free(slab->deconv);
+  purify_sparsemat_freer(&slab->gmat);
+  purify_utils_free(slab->grid);
+  purify_utils_free(slab->gridt);
+  purify_utils_free(slab->sbuf);
+  purify_utils_free(slab->rbuf);
+  fftw_destroy_plan(slab->rowfwd);
+  fftw_destroy_plan(slab->rowadj);
+  fftw_destroy_plan(slab->colfwd);
+  fftw_destroy_plan(slab->coladj);
+
+}
+
+/*!
+ * Distributed two dimensional FFT of the local rows of the grid, in
+ * place: local row FFTs, all-to-all transpose, local column FFTs and
+ * all-to-all transpose back to rows.
+ *
+ * \param[in,out] slab Distributed operator (slab->grid).
+ * \param[in] sign FFTW_FORWARD or FFTW_BACKWARD.
+ */
+void purify_measurement_slabfft(purify_measurement_slab *slab, int sign) {
+
+  int s, c, r, nr, nc, nb;
+
+  nr = slab->nr;
+  nc = slab->nc;
+  nb = nr * nc;
+
+  fftw_execute_dft(sign == FFTW_FORWARD ? slab->rowfwd : slab->rowadj,
+                   slab->grid, slab->grid);
+
+  //Block for rank s: local rows by its columns, column major.
+  for (s = 0; s < slab->nprocs; s++)
+    for (c = 0; c < nc; c++)
+      for (r = 0; r < nr; r++)
+        slab->sbuf[s*nb + c*nr + r] = slab->grid[r*slab->nx2 + s*nc + c];
+  MPI_Alltoall(slab->sbuf, 2 * nb, MPI_DOUBLE, 
+               slab->rbuf, 2 * nb, MPI_DOUBLE, slab->comm);
+  for (s = 0; s < slab->nprocs; s++)
+    for (c = 0; c < nc; c++)
+      for (r = 0; r < nr; r++)
+        slab->gridt[c*slab->ny2 + s*nr + r] = slab->rbuf[s*nb + c*nr + r];
+
+  fftw_execute_dft(sign == FFTW_FORWARD ? slab->colfwd : slab->coladj,
+                   slab->gridt, slab->gridt);
+
+  for (s = 0; s < slab->nprocs; s++)
+    for (c = 0; c < nc; c++)
+      for (r = 0; r < nr; r++)
+        slab->sbuf[s*nb + c*nr + r] = slab->gridt[c*slab->ny2 + s*nr + r];
+  MPI_Alltoall(slab->sbuf, 2 * nb, MPI_DOUBLE, 
+               slab->rbuf, 2 * nb, MPI_DOUBLE, slab->comm);
+  for (s = 0; s < slab->nprocs; s++)
+    for (c = 0; c < nc; c++)
+      for (r = 0; r < nr; r++)
+        slab->grid[r*slab->nx2 + s*nc + c] = slab->rbuf[s*nb + c*nr + r];
+
+}
+
+/*!
+ * Exchange rows between the image and the grid distributions. Image
+ * row j goes to row g(j) of the grid, with the zero padding and the
+ * fftshift of \ref purify_measurement_cftfwd, i.e. g(j) = (j + npady
+ * + ny2/2) mod ny2. Rows are packed by destination in increasing
+ * order of j, so receivers know the row of each received block.
+ *
+ * \param[in,out] slab Distributed operator.
+ * \param[in] toimage Zero to send image rows (packed in slab->sbuf)
+ * to the grid, one to send grid rows to the image.
+ */
+static void purify_measurement_slab_exchange(purify_measurement_slab *slab,
+                                             int toimage) {
+
+  int j, g, r, src, dst, nx1, offy;
+  int *scounts, *sdispls, *rcounts, *rdispls;
+
+  nx1 = slab->param.nx1;
+  offy = (slab->ny2 - slab->param.ny1) / 2 + slab->ny2 / 2;
+
+  scounts = (int*)calloc(slab->nprocs, sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(scounts);
+  rcounts = (int*)calloc(slab->nprocs, sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(rcounts);
+  sdispls = (int*)malloc(slab->nprocs * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(sdispls);
+  rdispls = (int*)malloc(slab->nprocs * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(rdispls);
+
+  for (j = 0; j < slab->param.ny1; j++) {
+    g = (j + offy) % slab->ny2;
+    src = toimage ? g / slab->nr : j / slab->nimg;
+    dst = toimage ? j / slab->nimg : g / slab->nr;
+    if (src == slab->rank) scounts[dst] += 2 * nx1;
+    if (dst == slab->rank) rcounts[src] += 2 * nx1;
+  }
+  sdispls[0] = 0;
+  rdispls[0] = 0;
+  for (r = 1; r < slab->nprocs; r++) {
+    sdispls[r] = sdispls[r-1] + scounts[r-1];
+    rdispls[r] = rdispls[r-1] + rcounts[r-1];
+  }
+
+  MPI_Alltoallv(slab->sbuf, scounts, sdispls, MPI_DOUBLE,
+                slab->rbuf, rcounts, rdispls, MPI_DOUBLE, slab->comm);
+
+  free(scounts);
+  free(rcounts);
+  free(sdispls);
+  free(rdispls);
+
+}
+
+/*!
+ * Measurement operator for continuos visibilities with the image and
+ * grid distributed in slabs of rows (see \ref
+ * purify_measurement_init_slab).
+ *
+ * \param[out] out (complex double*) All visibilities (same on every
+ * rank).
+ * \param[in] in (complex double*) Local rows of the image.
+ * \param[in] data 
+ * - data[0] (purify_measurement_slab*): Distributed operator.
+ */
+void purify_measurement_slabcftfwd(void *out, void *in, void **data){
+
+  purify_measurement_slab *slab;
+  complex double *xin, *yout, *row;
+  int i, j, g, k, nx1, offx, offy;
+  double scale;
+
+  slab = (purify_measurement_slab*)data[0];
+  xin = (complex double*)in;
+  yout = (complex double*)out;
+  nx1 = slab->param.nx1;
+  offx = (slab->nx2 - nx1) / 2 + slab->nx2 / 2;
+  offy = (slab->ny2 - slab->param.ny1) / 2 + slab->ny2 / 2;
+  scale = 1/sqrt((double)(slab->nx2*slab->ny2));
+
+  //Deconvolve the local image rows, packed by owner of the grid row
+  //(rows of an owner are consecutive in j, so the order is kept).
+  k = 0;
+  for (g = 0; g < slab->nprocs; g++)
+    for (j = 0; j < slab->nimg; j++)
+      if (((slab->rank*slab->nimg + j + offy) % slab->ny2) / slab->nr == g)
+        for (i = 0; i < nx1; i++, k++)
+          slab->sbuf[k] = xin[j*nx1 + i] * slab->deconv[j*nx1 + i] * scale;
+  purify_measurement_slab_exchange(slab, 0);
+
+  //Zero padded and shifted local grid rows.
+  for (i = 0; i < slab->nr * slab->nx2; i++)
+    slab->grid[i] = 0.0;
+  k = 0;
+  for (j = 0; j < slab->param.ny1; j++) {
+    g = (j + offy) % slab->ny2;
+    if (g / slab->nr != slab->rank) continue;
+    row = slab->grid + (g - slab->rank*slab->nr) * slab->nx2;
+    for (i = 0; i < nx1; i++, k++)
+      row[(i + offx) % slab->nx2] = slab->rbuf[k];
+  }
+
+  purify_measurement_slabfft(slab, FFTW_FORWARD);
+
+  //Partial degridding of every visibility, summed over the ranks.
+  purify_sparsemat_fwd_complexr(yout, slab->grid, &slab->gmat);
+  MPI_Allreduce(MPI_IN_PLACE, (double*)yout, 2 * slab->gmat.nrows, 
+                MPI_DOUBLE, MPI_SUM, slab->comm);
+
+}
+
+/*!
+ * Adjoint measurement operator for continuos visibilities with the
+ * image and grid distributed in slabs of rows.
+ *
+ * \param[out] out (complex double*) Local rows of the image.
+ * \param[in] in (complex double*) All visibilities (same on every
+ * rank).
+ * \param[in] data 
+ * - data[0] (purify_measurement_slab*): Distributed operator.
+ */
+void purify_measurement_slabcftadj(void *out, void *in, void **data){
+
+  purify_measurement_slab *slab;
+  complex double *yin, *xout, *row;
+  int i, j, g, k, s, nx1, offx, offy;
+  double scale;
+
+  slab = (purify_measurement_slab*)data[0];
+  yin = (complex double*)in;
+  xout = (complex double*)out;
+  nx1 = slab->param.nx1;
+  offx = (slab->nx2 - nx1) / 2 + slab->nx2 / 2;
+  offy = (slab->ny2 - slab->param.ny1) / 2 + slab->ny2 / 2;
+  scale = 1/sqrt((double)(slab->nx2*slab->ny2));
+
+  purify_sparsemat_adj_complexr(slab->grid, yin, &slab->gmat);
+  purify_measurement_slabfft(slab, FFTW_BACKWARD);
+
+  //Cropped local grid rows, packed by owner of the image row.
+  k = 0;
+  for (j = 0; j < slab->param.ny1; j++) {
+    g = (j + offy) % slab->ny2;
+    if (g / slab->nr != slab->rank) continue;
+    row = slab->grid + (g - slab->rank*slab->nr) * slab->nx2;
+    for (i = 0; i < nx1; i++, k++)
+      slab->sbuf[k] = row[(i + offx) % slab->nx2];
+  }
+  purify_measurement_slab_exchange(slab, 1);
+
+  //Received rows come by source rank, in increasing j for each.
+  k = 0;
+  for (s = 0; s < slab->nprocs; s++)
+    for (j = 0; j < slab->nimg; j++)
+      if (((slab->rank*slab->nimg + j + offy) % slab->ny2) / slab->nr == s)
+        for (i = 0; i < nx1; i++, k++)
+          xout[j*nx1 + i] = slab->rbuf[k] * slab->deconv[j*nx1 + i] * scale;
+
+}
+#endif
+
+/*!
+ * Compute the phasors exp(-i(start + k step)) for k = 0, ..., n-1.
+ * The first lanes of each interval of PURIFY_MEASUREMENT_DFT_SYNC
+ * samples are evaluated directly, the remaining ones by rotating
+ * PURIFY_MEASUREMENT_DFT_BLOCK independent lanes at a time so that
+ * the recurrence vectorises and the rounding error stays bounded.
+ *
+ * \param[out] re (double*) Real part of the phasors.
+ * \param[out] im (double*) Imaginary part of the phasors.
+ * \param[in] n Number of phasors.
+ * \param[in] start Phase of the first phasor.
+ * \param[in] step Phase increment between consecutive phasors.
+ */
+static void purify_measurement_phasors(double *re, double *im, int n, 
+                                       double start, double step) {
+
+  int k, l, k0, kend, lmax;
+  double br, bi;
+
+  br = cos(PURIFY_MEASUREMENT_DFT_BLOCK*step);
+  bi = -sin(PURIFY_MEASUREMENT_DFT_BLOCK*step);
+
+  for (k0 = 0; k0 < n; k0 += PURIFY_MEASUREMENT_DFT_SYNC) {
+    kend = purify_min(k0 + PURIFY_MEASUREMENT_DFT_SYNC, n);
+    lmax = purify_min(k0 + PURIFY_MEASUREMENT_DFT_BLOCK, kend);
+    #pragma omp simd
+    for (k = k0; k < lmax; k++) {
+      re[k] = cos(start + k*step);
+      im[k] = -sin(start + k*step);
+    }
+    for (k = k0 + PURIFY_MEASUREMENT_DFT_BLOCK; k < kend; 
+         k += PURIFY_MEASUREMENT_DFT_BLOCK) {
+      lmax = purify_min(PURIFY_MEASUREMENT_DFT_BLOCK, kend - k);
+      #pragma omp simd
+      for (l = 0; l < lmax; l++) {
+        re[k+l] = re[k+l-PURIFY_MEASUREMENT_DFT_BLOCK]*br 
+          - im[k+l-PURIFY_MEASUREMENT_DFT_BLOCK]*bi;
+        im[k+l] = re[k+l-PURIFY_MEASUREMENT_DFT_BLOCK]*bi 
+          + im[k+l-PURIFY_MEASUREMENT_DFT_BLOCK]*br;
+      }
+    }
+  }
+
+}
+
+/*!
+ * Direct (non-gridded) evaluation of the measurement operator for
+ * continuos visibilities. Each visibility is computed as the exact
+ * sum over pixels of x exp(-2 pi i (u l + v m)), using the same pixel
+ * coordinates, scaling and deconvolution as \ref
+ * purify_measurement_cftfwd, so that it can be used as a reference
+ * for the gridded operator or on small data sets.
+ *
+ * \param[out] out (complex double*) Measured visibilities.
+ * \param[in] in (complex double*) Input image.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (double*): u coordinates of the visibilities.
+ * - data[3] (double*): v coordinates of the visibilities.
+ *
+ * \note The cost is O(nmeas nx1 ny1). The computation is parallel
+ * over visibilities.
+ */
+void purify_measurement_dftfwd(void *out, void *in, void **data){
+
+  int i, j, k, nx1, ny1, nx2, ny2;
+  int offx, offy;
+  double scale;
+  double *xr, *xi;
+  purify_measurement_cparam *param;
+  double *deconv, *u, *v;
+  complex double *xin;
+  complex double *yout;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  u = (double*)data[2];
+  v = (double*)data[3];
+
+  xin = (complex double*)in;
+  yout = (complex double*)out;
+
+  nx1 = param->nx1;
+  ny1 = param->ny1;
+  nx2 = param->ofx*nx1;
+  ny2 = param->ofy*ny1;
+  scale = 1/sqrt((double)(nx2*ny2));
+
+  //Pixel offsets of the first column and row with respect to the
+  //phase centre of the zero padded grid.
+  offx = (nx2 - nx1) / 2 - nx2 / 2;
+  offy = (ny2 - ny1) / 2 - ny2 / 2;
+
+  //Deconvolved image split in real and imaginary parts.
+  xr = (double*)malloc(nx1 * ny1 * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xr);
+  xi = (double*)malloc(nx1 * ny1 * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xi);
+  for (i = 0; i < nx1 * ny1; i++){
+    xr[i] = creal(xin[i]) * deconv[i] * scale;
+    xi[i] = cimag(xin[i]) * deconv[i] * scale;
+  }
+
+  #pragma omp parallel private(i, j, k)
+  {
+    double *pur, *pui, *pvr, *pvi;
+    double thu, thv, rr, ri, sr, si;
+    int st;
+
+    pur = (double*)malloc(nx1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pur);
+    pui = (double*)malloc(nx1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pui);
+    pvr = (double*)malloc(ny1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pvr);
+    pvi = (double*)malloc(ny1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pvi);
+
+    #pragma omp for schedule(static)
+    for (k = 0; k < param->nmeas; k++){
+      //Phase increment per pixel.
+      thu = PURIFY_PI * u[k] / param->umax;
+      thv = PURIFY_PI * v[k] / param->vmax;
+      purify_measurement_phasors(pur, pui, nx1, 
+                                 thu * offx + 2.0 * PURIFY_PI * u[k] * param->l0,
+                                 thu);
+      purify_measurement_phasors(pvr, pvi, ny1, 
+                                 thv * offy + 2.0 * PURIFY_PI * v[k] * param->m0,
+                                 thv);
+
+      sr = 0.0;
+      si = 0.0;
+      for (j = 0; j < ny1; j++){
+        st = j * nx1;
+        rr = 0.0;
+        ri = 0.0;
+        #pragma omp simd reduction(+:rr,ri)
+        for (i = 0; i < nx1; i++){
+          rr += xr[st + i] * pur[i] - xi[st + i] * pui[i];
+          ri += xr[st + i] * pui[i] + xi[st + i] * pur[i];
+        }
+        sr += rr * pvr[j] - ri * pvi[j];
+        si += rr * pvi[j] + ri * pvr[j];
+      }
+      yout[k] = sr + si*I;
+    }
+
+    free(pur);
+    free(pui);
+    free(pvr);
+    free(pvi);
+  }
+
+  free(xr);
+  free(xi);
+
+}
+
+/*!
+ * Direct (non-gridded) evaluation of the adjoint measurement operator
+ * for continuos visibilities. Adjoint of \ref
+ * purify_measurement_dftfwd.
+ *
+ * \param[out] out (complex double*) Output image.
+ * \param[in] in (complex double*) Input visibilities.
+ * \param[in] data 
+ * - data[0] (purify_measurement_cparam*): Parameters for the continuos
+ *            Fourier transform.
+ * - data[1] (double*): Matrix with the deconvolution kernel in image
+ *            space.
+ * - data[2] (double*): u coordinates of the visibilities.
+ * - data[3] (double*): v coordinates of the visibilities.
+ *
+ * \note The computation is parallel over visibilities, each thread
+ * accumulating into its own copy of the image.
+ */
+void purify_measurement_dftadj(void *out, void *in, void **data){
+
+  int i, j, k, t, nx1, ny1, nx2, ny2, nthreads;
+  int offx, offy;
+  double scale;
+  double *acc;
+  purify_measurement_cparam *param;
+  double *deconv, *u, *v;
+  complex double *yin;
+  complex double *xout;
+
+  //Cast input pointers
+  param = (purify_measurement_cparam*)data[0];
+  deconv = (double*)data[1];
+  u = (double*)data[2];
+  v = (double*)data[3];
+
+  yin = (complex double*)in;
+  xout = (complex double*)out;
+
+  nx1 = param->nx1;
+  ny1 = param->ny1;
+  nx2 = param->ofx*nx1;
+  ny2 = param->ofy*ny1;
+  scale = 1/sqrt((double)(nx2*ny2));
+  offx = (nx2 - nx1) / 2 - nx2 / 2;
+  offy = (ny2 - ny1) / 2 - ny2 / 2;
+
+  #ifdef _OPENMP 
+    nthreads = omp_get_max_threads();
+  #else
+    nthreads = 1;
+  #endif
+
+  //Real and imaginary accumulators for each thread.
+  acc = (double*)calloc(2 * nthreads * nx1 * ny1, sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(acc);
+
+  #pragma omp parallel private(i, j, k, t) num_threads(nthreads)
+  {
+    double *pur, *pui, *pvr, *pvi;
+    double *accr, *acci;
+    double thu, thv, yr, yi, tr, ti;
+    int st;
+
+    #ifdef _OPENMP 
+      t = omp_get_thread_num();
+    #else
+      t = 0;
+    #endif
+    accr = acc + 2 * t * nx1 * ny1;
+    acci = accr + nx1 * ny1;
+
+    pur = (double*)malloc(nx1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pur);
+    pui = (double*)malloc(nx1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pui);
+    pvr = (double*)malloc(ny1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pvr);
+    pvi = (double*)malloc(ny1 * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pvi);
+
+    #pragma omp for schedule(static)
+    for (k = 0; k < param->nmeas; k++){
+      thu = PURIFY_PI * u[k] / param->umax;
+      thv = PURIFY_PI * v[k] / param->vmax;
+      purify_measurement_phasors(pur, pui, nx1, 
+                                 thu * offx + 2.0 * PURIFY_PI * u[k] * param->l0,
+                                 thu);
+      purify_measurement_phasors(pvr, pvi, ny1, 
+                                 thv * offy + 2.0 * PURIFY_PI * v[k] * param->m0,
+                                 thv);
+
+      yr = creal(yin[k]);
+      yi = cimag(yin[k]);
+      for (j = 0; j < ny1; j++){
+        st = j * nx1;
+        //y times the conjugate of the row phasor.
+        tr = yr * pvr[j] + yi * pvi[j];
+        ti = yi * pvr[j] - yr * pvi[j];
+        #pragma omp simd
+        for (i = 0; i < nx1; i++){
+          accr[st + i] += tr * pur[i] + ti * pui[i];
+          acci[st + i] += ti * pur[i] - tr * pui[i];
+        }
+      }
+    }
+
+    free(pur);
+    free(pui);
+    free(pvr);
+    free(pvi);
+
+    //Reduction of the per thread images.
+    #pragma omp for schedule(static)
+    for (i = 0; i < nx1 * ny1; i++){
+      tr = 0.0;
+      ti = 0.0;
+      for (j = 0; j < nthreads; j++){
+        tr += acc[2 * j * nx1 * ny1 + i];
+        ti += acc[(2 * j + 1) * nx1 * ny1 + i];
+      }
+      xout[i] = (tr + ti*I) * scale * deconv[i];
+    }
+  }
+
+  free(acc);
+
+}
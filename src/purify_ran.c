@@ -189,3 +189,51 @@ int purify_ran_knuthshuffle(int *perm, int nperm, int N, int seed) {
 
   return 0;
 }
+
+
+/*!  
+ * Generate uniform deviate in range [0,1) from an explicit generator
+ * state (splitmix64). Unlike \ref purify_ran_ran2 the routine keeps no
+ * static state and may be called concurrently from several threads,
+ * each one with its own state.
+ *
+ * \param[in,out] state Generator state, updated on output. Any value
+ * (including zero) is a valid seed.
+ * \retval ran_dp Generated uniform deviate.
+ */
+double purify_ran_uniform_r(unsigned long long *state) {
+
+  unsigned long long z;
+
+  z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = z ^ (z >> 31);
+
+  // 53 random bits mapped to [0,1).
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+
+}
+
+
+/*!
+ * Generate sample from Gaussian distribution of mean 0 and standard
+ * deviation 1 from an explicit generator state (re-entrant version of
+ * \ref purify_ran_gasdev2).
+ *
+ * \param[in,out] state Generator state, updated on output.
+ * \retval ran_dp Generated Gaussian deviate.
+ */
+double purify_ran_gasdev_r(unsigned long long *state) {
+
+  double rsq, v1, v2;
+
+  do {
+    v1 = 2.0*purify_ran_uniform_r(state) - 1.0;
+    v2 = 2.0*purify_ran_uniform_r(state) - 1.0;
+    rsq = v1*v1 + v2*v2;
+  } while(rsq >= 1.0 || rsq == 0.0);
+
+  return v1*sqrt(-2.0*log(rsq)/rsq);
+
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include "purify_sparsemat.h"
 #include "purify_error.h"
+#include "purify_utils.h"
 
 
 /*!
@@ -190,10 +191,10 @@ void purify_sparsemat_adj_complex(complex double *y, complex double *x,
  */
 void purify_sparsemat_freer(purify_sparsemat_row *mat) {
 
-  if(mat->vals != NULL) free(mat->vals);
-  if(mat->cvals != NULL) free(mat->cvals);
-  if(mat->colind != NULL) free(mat->colind);
-  if(mat->rowptr != NULL) free(mat->rowptr);
+  if(mat->vals != NULL) purify_utils_free(mat->vals);
+  if(mat->cvals != NULL) purify_utils_free(mat->cvals);
+  if(mat->colind != NULL) purify_utils_free(mat->colind);
+  if(mat->rowptr != NULL) purify_utils_free(mat->rowptr);
   mat->nrows = 0;
   mat->ncols = 0;
   mat->nvals = 0;
@@ -302,7 +303,9 @@ void purify_sparsemat_fwd_complexr(complex double *y, complex double *x,
 
   int rr, c;
 
+  //Rows are independent, split them among threads.
   if (A->real == 1){
+    #pragma omp parallel for private(rr)
     for (c = 0; c < A->nrows; c++) {
       y[c] = 0.0 + 0.0*I;
       for (rr = A->rowptr[c]; rr < A->rowptr[c+1]; rr++)
@@ -310,6 +313,7 @@ void purify_sparsemat_fwd_complexr(complex double *y, complex double *x,
     }
   }
   else{
+    #pragma omp parallel for private(rr)
     for (c = 0; c < A->nrows; c++) {
       y[c] = 0.0 + 0.0*I;
       for (rr = A->rowptr[c]; rr < A->rowptr[c+1]; rr++)
@@ -352,3 +356,29 @@ void purify_sparsemat_adj_complexr(complex double *y, complex double *x,
   }
 
 }
+
+
+/*!
+ * Scale each row of a sparse matrix, i.e. compute \f$A = D A\f$ with
+ * \f$D\f$ diagonal. Used to whiten the measurement operator with the
+ * inverse noise standard deviation of each measurement.
+ *
+ * \param[in,out] A Sparse matrix (passed by reference).
+ * \param[in] s Scaling of each row, of length nrows.
+ */
+void purify_sparsemat_scalerows(purify_sparsemat_row *A, double *s) {
+
+  int rr, c;
+
+  if (A->real == 1){
+    for (c = 0; c < A->nrows; c++)
+      for (rr = A->rowptr[c]; rr < A->rowptr[c+1]; rr++)
+        A->vals[rr] *= s[c];
+  }
+  else{
+    for (c = 0; c < A->nrows; c++)
+      for (rr = A->rowptr[c]; rr < A->rowptr[c+1]; rr++)
+        A->cvals[rr] *= s[c];
+  }
+
+}
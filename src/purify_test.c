@@ -6,8 +6,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <complex.h>  // Must be before fftw3.h
 #include <fftw3.h>
+#include <fitsio.h>
 #include <math.h>
 #include <assert.h>
 #include <time.h> 
@@ -40,6 +42,961 @@
 
 #define VERBOSE 1
 
+int purify_test_hcft(void);
+int purify_test_roundtrip(void);
+int purify_test_cmpint(const void *a, const void *b);
+int purify_test_index(void);
+int purify_test_compare(const char *name,
+                        void (*A)(void *out, void *in, void **data), 
+                        void **A_data,
+                        void (*At)(void *out, void *in, void **data), 
+                        void **At_data,
+                        void (*R)(void *out, void *in, void **data), 
+                        void **R_data,
+                        void (*Rt)(void *out, void *in, void **data), 
+                        void **Rt_data,
+                        int nx, int ny, double tol);
+int purify_test_facets(void);
+int purify_test_shift(void);
+int purify_test_average(void);
+int purify_test_uvfits(void);
+
+/*!
+ * Check the half-plane operator (\ref purify_measurement_hcftfwd) on
+ * folded visibilities against the full operator on the original ones,
+ * and its adjoint with the dot product test.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_hcft(void) {
+
+  int i, nx, nh, nmeas, nfold;
+  unsigned long long state = 29;
+  double errfwd, normfwd, dotfwd, dotadj;
+  double *deconv;
+  complex double *x, *xadj, *y, *yh, *temp;
+  purify_visibility vis;
+  purify_measurement_cparam param;
+  purify_sparsemat_row gmat, hmat;
+  purify_measurement_workspace ws, hws;
+  fftw_plan planfwd, planr2c, planc2r;
+  void *datafwd[5];
+  void *datahfwd[5];
+  void *datahadj[5];
+
+  nmeas = 500;
+  purify_measurement_init_cparam(&param);
+  param.nmeas = nmeas;
+  param.nx1 = 32;
+  param.ny1 = 32;
+  param.ofx = 2;
+  param.ofy = 2;
+  param.kx = 4;
+  param.ky = 4;
+  param.kernel = PURIFY_MEASUREMENT_KERNEL_GAUSS;
+  param.umax = PURIFY_PI;
+  param.vmax = PURIFY_PI;
+  nx = param.nx1*param.ny1;
+  nh = param.nx1*param.ofx/2 + 1;
+
+  purify_visibility_alloc(&vis, nmeas);
+  for (i = 0; i < nmeas; i++) {
+    vis.u[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.umax;
+    vis.v[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.vmax;
+    vis.w[i] = 0.0;
+    vis.noise_std[i] = 1.0;
+  }
+  deconv = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  x = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(x);
+  xadj = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xadj);
+  y = (complex double*)malloc(nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(y);
+  yh = (complex double*)malloc(nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(yh);
+  for (i = 0; i < nx; i++)
+    x[i] = purify_ran_gasdev_r(&state);
+
+  //Full operator on the original coverage
+  purify_measurement_init_cft(&gmat, deconv, vis.u, vis.v, &param);
+  purify_measurement_init_workspace(&ws, nx*param.ofx*param.ofy);
+  temp = purify_measurement_workspace_acquire(&ws);
+  planfwd = fftw_plan_dft_2d(param.ny1*param.ofy, param.nx1*param.ofx, 
+                             temp, temp, FFTW_FORWARD, FFTW_ESTIMATE);
+  purify_measurement_workspace_release(&ws, temp);
+  datafwd[0] = (void*)&param;
+  datafwd[1] = (void*)deconv;
+  datafwd[2] = (void*)&gmat;
+  datafwd[3] = (void*)&planfwd;
+  datafwd[4] = (void*)&ws;
+  purify_measurement_cftfwd((void*)vis.y, (void*)x, datafwd);
+
+  //Half-plane operator on the folded coverage
+  nfold = purify_visibility_fold(&vis);
+  purify_measurement_init_hcft(&hmat, deconv, vis.u, vis.v, &param);
+  purify_measurement_init_workspace(&hws, param.ny1*param.ofy*nh);
+  temp = purify_measurement_workspace_acquire(&hws);
+  planr2c = fftw_plan_dft_r2c_2d(param.ny1*param.ofy, param.nx1*param.ofx,
+                                 (double*)temp, temp, FFTW_ESTIMATE);
+  planc2r = fftw_plan_dft_c2r_2d(param.ny1*param.ofy, param.nx1*param.ofx,
+                                 temp, (double*)temp, FFTW_ESTIMATE);
+  purify_measurement_workspace_release(&hws, temp);
+  datahfwd[0] = (void*)&param;
+  datahfwd[1] = (void*)deconv;
+  datahfwd[2] = (void*)&hmat;
+  datahfwd[3] = (void*)&planr2c;
+  datahfwd[4] = (void*)&hws;
+  datahadj[0] = (void*)&param;
+  datahadj[1] = (void*)deconv;
+  datahadj[2] = (void*)&hmat;
+  datahadj[3] = (void*)&planc2r;
+  datahadj[4] = (void*)&hws;
+  purify_measurement_hcftfwd((void*)yh, (void*)x, datahfwd);
+
+  //Folded visibilities are the conjugates of the original ones
+  errfwd = 0.0;
+  normfwd = 0.0;
+  for (i = 0; i < nmeas; i++) {
+    errfwd += creal((yh[i] - vis.y[i]) * conj(yh[i] - vis.y[i]));
+    normfwd += creal(vis.y[i] * conj(vis.y[i]));
+  }
+  errfwd = sqrt(errfwd / normfwd);
+
+  //Dot product test: Re<A x, y> = <x, A^T y> for real x
+  for (i = 0; i < nmeas; i++)
+    y[i] = purify_ran_gasdev_r(&state) + purify_ran_gasdev_r(&state)*I;
+  purify_measurement_hcftadj((void*)xadj, (void*)y, datahadj);
+  dotfwd = 0.0;
+  for (i = 0; i < nmeas; i++)
+    dotfwd += creal(yh[i] * conj(y[i]));
+  dotadj = 0.0;
+  for (i = 0; i < nx; i++)
+    dotadj += creal(x[i]) * creal(xadj[i]);
+  dotadj = fabs(dotfwd - dotadj) / fabs(dotfwd);
+
+  printf("Folded visibilities: %i of %i \n", nfold, nmeas);
+  printf("Relative error against the full operator: %e \n", errfwd);
+  printf("Relative error of the adjoint (dot product): %e \n\n", dotadj);
+
+  purify_sparsemat_freer(&gmat);
+  purify_sparsemat_freer(&hmat);
+  purify_measurement_free_workspace(&ws);
+  purify_measurement_free_workspace(&hws);
+  fftw_destroy_plan(planfwd);
+  fftw_destroy_plan(planr2c);
+  fftw_destroy_plan(planc2r);
+  purify_visibility_free(&vis);
+  free(deconv);
+  free(x);
+  free(xadj);
+  free(y);
+  free(yh);
+
+  return errfwd < 1e-10 && dotadj < 1e-10 ? 0 : 1;
+
+}
+
+/*!
+ * Compare an operator and its adjoint against reference ones on random
+ * inputs, check the adjoint with the dot product test and time both
+ * operators against the references.
+ *
+ * \param[in] name Name of the operator in the output.
+ * \param[in] A Forward operator under test.
+ * \param[in] A_data Data of the forward operator.
+ * \param[in] At Adjoint operator under test.
+ * \param[in] At_data Data of the adjoint operator.
+ * \param[in] R Reference forward operator.
+ * \param[in] R_data Data of the reference forward operator.
+ * \param[in] Rt Reference adjoint operator.
+ * \param[in] Rt_data Data of the reference adjoint operator.
+ * \param[in] nx Dimension of the image.
+ * \param[in] ny Number of visibilities.
+ * \param[in] tol Tolerance of the relative errors against the
+ * references.
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_compare(const char *name,
+                        void (*A)(void *out, void *in, void **data), 
+                        void **A_data,
+                        void (*At)(void *out, void *in, void **data), 
+                        void **At_data,
+                        void (*R)(void *out, void *in, void **data), 
+                        void **R_data,
+                        void (*Rt)(void *out, void *in, void **data), 
+                        void **Rt_data,
+                        int nx, int ny, double tol) {
+
+  int i;
+  unsigned long long state = 31;
+  double errfwd, erradj, normfwd, normadj, dot;
+  complex double dotfwd, dotadj;
+  complex double *x, *xa, *xr, *y, *ya, *yr;
+  clock_t start, stop;
+  double t, tref;
+
+  x = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(x);
+  xa = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xa);
+  xr = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xr);
+  y = (complex double*)malloc(ny * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(y);
+  ya = (complex double*)malloc(ny * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ya);
+  yr = (complex double*)malloc(ny * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(yr);
+  for (i = 0; i < nx; i++)
+    x[i] = purify_ran_gasdev_r(&state) + purify_ran_gasdev_r(&state)*I;
+  for (i = 0; i < ny; i++)
+    y[i] = purify_ran_gasdev_r(&state) + purify_ran_gasdev_r(&state)*I;
+
+  //Forward operator
+  assert((start = clock())!=-1);
+  R((void*)yr, (void*)x, R_data);
+  stop = clock();
+  tref = (double) (stop-start)/CLOCKS_PER_SEC;
+  assert((start = clock())!=-1);
+  A((void*)ya, (void*)x, A_data);
+  stop = clock();
+  t = (double) (stop-start)/CLOCKS_PER_SEC;
+  printf("Time measurement operator (reference): %f \n", tref);
+  printf("Time measurement operator (%s): %f \n", name, t);
+
+  //Adjoint operator
+  assert((start = clock())!=-1);
+  Rt((void*)xr, (void*)y, Rt_data);
+  stop = clock();
+  tref = (double) (stop-start)/CLOCKS_PER_SEC;
+  assert((start = clock())!=-1);
+  At((void*)xa, (void*)y, At_data);
+  stop = clock();
+  t = (double) (stop-start)/CLOCKS_PER_SEC;
+  printf("Time adjoint operator (reference): %f \n", tref);
+  printf("Time adjoint operator (%s): %f \n", name, t);
+
+  errfwd = 0.0;
+  normfwd = 0.0;
+  dotfwd = 0.0;
+  for (i = 0; i < ny; i++) {
+    errfwd += creal((ya[i] - yr[i]) * conj(ya[i] - yr[i]));
+    normfwd += creal(yr[i] * conj(yr[i]));
+    dotfwd += ya[i] * conj(y[i]);
+  }
+  errfwd = sqrt(errfwd / normfwd);
+
+  erradj = 0.0;
+  normadj = 0.0;
+  dotadj = 0.0;
+  for (i = 0; i < nx; i++) {
+    erradj += creal((xa[i] - xr[i]) * conj(xa[i] - xr[i]));
+    normadj += creal(xr[i] * conj(xr[i]));
+    dotadj += x[i] * conj(xa[i]);
+  }
+  erradj = sqrt(erradj / normadj);
+
+  //Dot product test: <A x, y> = <x, A^T y>
+  dot = cabs(dotfwd - dotadj) / cabs(dotfwd);
+
+  printf("Relative error against the reference (forward): %e \n", errfwd);
+  printf("Relative error against the reference (adjoint): %e \n", erradj);
+  printf("Relative error of the adjoint (dot product): %e \n\n", dot);
+
+  free(x);
+  free(xa);
+  free(xr);
+  free(y);
+  free(ya);
+  free(yr);
+
+  return errfwd <= tol && erradj <= tol && dot < 1e-10 ? 0 : 1;
+
+}
+
+/*!
+ * Check the faceted operator (\ref purify_measurement_facetfwd) with
+ * the dot product test and against the operator on the whole image.
+ * The facet grids are coarser and the deconvolution kernel is one, so
+ * the taper of the interpolation kernel differs between a facet and
+ * the whole image; on a random image the operators agree to about 20%,
+ * while a misplaced facet gives errors of order one.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_facets(void) {
+
+  int i, nx, nmeas, ret;
+  unsigned long long state = 37;
+  double *deconv;
+  complex double *temp;
+  purify_measurement_cparam param;
+  purify_sparsemat_row gmat;
+  purify_measurement_workspace ws;
+  purify_measurement_facets facets;
+  fftw_plan planfwd, planadj;
+  double *u, *v;
+  void *datafwd[5];
+  void *dataadj[5];
+  void *datafacet[1];
+
+  nmeas = 500;
+  purify_measurement_init_cparam(&param);
+  param.nmeas = nmeas;
+  param.nx1 = 32;
+  param.ny1 = 32;
+  param.ofx = 2;
+  param.ofy = 2;
+  param.kx = 6;
+  param.ky = 6;
+  param.kernel = PURIFY_MEASUREMENT_KERNEL_GAUSS;
+  param.umax = PURIFY_PI;
+  param.vmax = PURIFY_PI;
+  nx = param.nx1*param.ny1;
+
+  u = (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(u);
+  v = (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(v);
+  for (i = 0; i < nmeas; i++) {
+    u[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.umax;
+    v[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.vmax;
+  }
+  deconv = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+
+  //Operator on the whole image
+  purify_measurement_init_cft(&gmat, deconv, u, v, &param);
+  purify_measurement_init_workspace(&ws, nx*param.ofx*param.ofy);
+  temp = purify_measurement_workspace_acquire(&ws);
+  planfwd = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy, 
+                             temp, temp, FFTW_FORWARD, FFTW_ESTIMATE);
+  planadj = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy, 
+                             temp, temp, FFTW_BACKWARD, FFTW_ESTIMATE);
+  purify_measurement_workspace_release(&ws, temp);
+  datafwd[0] = (void*)&param;
+  datafwd[1] = (void*)deconv;
+  datafwd[2] = (void*)&gmat;
+  datafwd[3] = (void*)&planfwd;
+  datafwd[4] = (void*)&ws;
+  dataadj[0] = (void*)&param;
+  dataadj[1] = (void*)deconv;
+  dataadj[2] = (void*)&gmat;
+  dataadj[3] = (void*)&planadj;
+  dataadj[4] = (void*)&ws;
+
+  //Faceted operator with 2 by 2 facets
+  purify_measurement_init_facets(&facets, u, v, &param, 2, 2, FFTW_ESTIMATE);
+  datafacet[0] = (void*)&facets;
+
+  ret = purify_test_compare("facets", 
+                            &purify_measurement_facetfwd, datafacet,
+                            &purify_measurement_facetadj, datafacet,
+                            &purify_measurement_cftfwd, datafwd,
+                            &purify_measurement_cftadj, dataadj,
+                            nx, nmeas, 0.3);
+
+  purify_measurement_free_facets(&facets);
+  purify_sparsemat_freer(&gmat);
+  purify_measurement_free_workspace(&ws);
+  fftw_destroy_plan(planfwd);
+  fftw_destroy_plan(planadj);
+  free(u);
+  free(v);
+  free(deconv);
+
+  return ret;
+
+}
+
+/*!
+ * Check the gridded operator with the image centre offset from the
+ * phase centre (param.l0, param.m0) against the shifted direct
+ * transform \ref purify_measurement_dftfwd. The offset is a phase
+ * rotation of each visibility, so the error against the reference must
+ * be the same as without offset; a wrong sign or scale of the rotation
+ * changes it by order one.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_shift(void) {
+
+  int i, k, nx, nmeas;
+  unsigned long long state = 41;
+  double err[2], norm[2];
+  double *deconv, *one, *u, *v;
+  complex double *x, *ygrid, *ydft, *temp;
+  purify_measurement_cparam param;
+  purify_sparsemat_row gmat;
+  purify_measurement_workspace ws;
+  fftw_plan planfwd;
+  void *datafwd[5];
+  void *datadft[4];
+
+  nmeas = 500;
+  purify_measurement_init_cparam(&param);
+  param.nmeas = nmeas;
+  param.nx1 = 32;
+  param.ny1 = 32;
+  param.ofx = 2;
+  param.ofy = 2;
+  param.kx = 6;
+  param.ky = 6;
+  param.kernel = PURIFY_MEASUREMENT_KERNEL_GAUSS;
+  param.umax = PURIFY_PI;
+  param.vmax = PURIFY_PI;
+  nx = param.nx1*param.ny1;
+
+  u = (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(u);
+  v = (double*)malloc(nmeas * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(v);
+  deconv = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  one = (double*)malloc(nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(one);
+  x = (complex double*)malloc(nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(x);
+  ygrid = (complex double*)malloc(nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ygrid);
+  ydft = (complex double*)malloc(nmeas * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ydft);
+  for (i = 0; i < nmeas; i++) {
+    u[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.umax;
+    v[i] = (2.0*purify_ran_uniform_r(&state) - 1.0) * 0.9 * param.vmax;
+  }
+  for (i = 0; i < nx; i++) {
+    x[i] = purify_ran_gasdev_r(&state);
+    one[i] = 1.0;
+  }
+
+  purify_measurement_init_workspace(&ws, nx*param.ofx*param.ofy);
+  temp = purify_measurement_workspace_acquire(&ws);
+  planfwd = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy, 
+                             temp, temp, FFTW_FORWARD, FFTW_ESTIMATE);
+  purify_measurement_workspace_release(&ws, temp);
+
+  //Error against the direct transform without and with offset
+  for (k = 0; k < 2; k++) {
+    param.l0 = k ? 0.05 : 0.0;
+    param.m0 = k ? -0.03 : 0.0;
+    purify_measurement_init_cft(&gmat, deconv, u, v, &param);
+    datafwd[0] = (void*)&param;
+    datafwd[1] = (void*)deconv;
+    datafwd[2] = (void*)&gmat;
+    datafwd[3] = (void*)&planfwd;
+    datafwd[4] = (void*)&ws;
+    datadft[0] = (void*)&param;
+    datadft[1] = (void*)one;
+    datadft[2] = (void*)u;
+    datadft[3] = (void*)v;
+    purify_measurement_cftfwd((void*)ygrid, (void*)x, datafwd);
+    purify_measurement_dftfwd((void*)ydft, (void*)x, datadft);
+    purify_sparsemat_freer(&gmat);
+    err[k] = 0.0;
+    norm[k] = 0.0;
+    for (i = 0; i < nmeas; i++) {
+      err[k] += creal((ygrid[i] - ydft[i]) * conj(ygrid[i] - ydft[i]));
+      norm[k] += creal(ydft[i] * conj(ydft[i]));
+    }
+    err[k] = sqrt(err[k] / norm[k]);
+  }
+
+  printf("Relative error against the direct transform: %e \n", err[0]);
+  printf("Relative error against the direct transform (offset): %e \n\n", 
+         err[1]);
+
+  purify_measurement_free_workspace(&ws);
+  fftw_destroy_plan(planfwd);
+  free(u);
+  free(v);
+  free(deconv);
+  free(one);
+  free(x);
+  free(ygrid);
+  free(ydft);
+
+  return fabs(err[1] - err[0]) <= 1e-8 * err[0] ? 0 : 1;
+
+}
+
+/*!
+ * Check \ref purify_visibility_average on two baselines observed at
+ * the same times, moving at uv distances of 0.7 and 3 per sample, plus
+ * a sample of unknown baseline. The smearing limit is set to a uv
+ * distance of 10 (maxloss = 1 - 2/pi, lmax = 0.05), so the short
+ * baseline is averaged over 15 samples and the long one over 4, and
+ * samples of different baselines are never merged.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_average(void) {
+
+  const int nt = 60;
+  const int group[2] = {15, 4};
+  const double speed[2] = {0.7, 3.0};
+  const double start[2] = {10.0, 100.0};
+  int i, b, g, t, nbad;
+  int count[3] = {0, 0, 0};
+  double ratio, tmean;
+  purify_visibility vis, avg;
+
+  //Samples of both baselines interleaved in time order
+  purify_visibility_alloc(&vis, 2*nt + 1);
+  for (t = 0; t < nt; t++) {
+    for (b = 0; b < 2; b++) {
+      i = 2*t + b;
+      vis.u[i] = start[b] + 0.8 * speed[b] * t;
+      vis.v[i] = 0.6 * speed[b] * t;
+      vis.w[i] = 0.0;
+      vis.y[i] = 1000.0 * b + t;
+      vis.noise_std[i] = 1.0;
+      vis.baseline[i] = b;
+      vis.time[i] = t;
+    }
+  }
+  vis.u[2*nt] = start[0];
+  vis.v[2*nt] = 0.0;
+  vis.w[2*nt] = 0.0;
+  vis.y[2*nt] = -1.0;
+  vis.noise_std[2*nt] = 1.0;
+  vis.baseline[2*nt] = -1;
+  vis.time[2*nt] = 0.0;
+
+  ratio = purify_visibility_average(&avg, &vis, 1.0 - 2.0/PURIFY_PI, 0.05);
+
+  //Each average holds one run of consecutive samples of a baseline
+  nbad = 0;
+  for (i = 0; i < avg.nmeas; i++) {
+    b = avg.baseline[i];
+    if (b < 0) {
+      count[2]++;
+      if (avg.u[i] != start[0] || creal(avg.y[i]) != -1.0)
+        nbad++;
+      continue;
+    }
+    if (b > 1) {
+      nbad++;
+      continue;
+    }
+    count[b]++;
+    g = (int)(avg.time[i] / group[b]);
+    tmean = g * group[b] + 0.5 * (group[b] - 1);
+    if (!(fabs(avg.time[i] - tmean) <= 1e-9)
+        || !(fabs(avg.u[i] - start[b] - 0.8 * speed[b] * tmean) <= 1e-9)
+        || !(fabs(avg.v[i] - 0.6 * speed[b] * tmean) <= 1e-9)
+        || !(fabs(creal(avg.y[i]) - 1000.0 * b - tmean) <= 1e-9)
+        || !(fabs(cabs(avg.noise_std[i]) - 1.0 / sqrt(group[b])) <= 1e-12))
+      nbad++;
+  }
+
+  printf("Averaged visibilities: %i of %i (ratio %f) \n", 
+         avg.nmeas, vis.nmeas, ratio);
+  printf("Averages per baseline: %i, %i (unknown %i) \n", 
+         count[0], count[1], count[2]);
+  printf("Wrong averages: %i \n\n", nbad);
+
+  purify_visibility_free(&vis);
+  purify_visibility_free(&avg);
+
+  return nbad == 0 && count[0] == nt / group[0] && count[1] == nt / group[1]
+    && count[2] == 1 ? 0 : 1;
+
+}
+
+/*!
+ * Write a small UVFITS random groups file with CFITSIO (RR and LL
+ * correlations, two channels, scaled u, v, w and an offset date) and
+ * check the visibilities read by \ref purify_visibility_readuvfits:
+ * coordinates converted from the group parameters to wavelengths,
+ * Stokes I and its noise, and rows with one or both correlations
+ * flagged by zero or negative weights.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_uvfits(void) {
+
+  const int ng = 6;
+  const double f0 = 1.4e9, df = 1e6;
+  const double wts[6][2] = {{2.0, 4.0}, {0.0, 4.0}, {2.0, -1.0}, 
+                            {0.0, 0.0}, {1.0, 1.0}, {-3.0, 0.5}};
+  char *ptype[5] = {"UU---SIN", "VV---SIN", "WW---SIN", "BASELINE", "DATE"};
+  double pscal[5] = {1.0/1.4e9, 1.0/1.4e9, 1.0/1.4e9, 1.0, 1.0};
+  double pzero[5] = {0.0, 0.0, 0.0, 0.0, 2450000.5};
+  char *ctype[4] = {"COMPLEX", "STOKES", "FREQ", "IF"};
+  double crval[4] = {1.0, -1.0, 1.4e9, 1.0};
+  double cdelt[4] = {1.0, -1.0, 1e6, 1.0};
+  double crpix = 1.0;
+  char filename[] = "data/test/test.uvfits";
+  char key[FLEN_KEYWORD], buffer[PURIFY_STRLEN];
+  fitsfile *fptr;
+  int fits_status = 0;
+  long naxes[5] = {0, 3, 2, 2, 1};
+  int g, c, s, k, n, nbad, nflag;
+  double par[5], dat[12], freq, w1, w2, sigma;
+  complex double y;
+  purify_visibility vis;
+
+  //Random groups file, overwritten if it exists
+  sprintf(buffer, "!%s", filename);
+  fits_create_file(&fptr, buffer, &fits_status);
+  fits_write_grphdr(fptr, 1, DOUBLE_IMG, 5, naxes, 5, ng, 1, &fits_status);
+  for (n = 0; n < 4; n++) {
+    sprintf(key, "CTYPE%d", n + 2);
+    fits_write_key(fptr, TSTRING, key, ctype[n], NULL, &fits_status);
+    sprintf(key, "CRVAL%d", n + 2);
+    fits_write_key(fptr, TDOUBLE, key, &crval[n], NULL, &fits_status);
+    sprintf(key, "CDELT%d", n + 2);
+    fits_write_key(fptr, TDOUBLE, key, &cdelt[n], NULL, &fits_status);
+    sprintf(key, "CRPIX%d", n + 2);
+    fits_write_key(fptr, TDOUBLE, key, &crpix, NULL, &fits_status);
+  }
+  for (n = 0; n < 5; n++) {
+    sprintf(key, "PTYPE%d", n + 1);
+    fits_write_key(fptr, TSTRING, key, ptype[n], NULL, &fits_status);
+    sprintf(key, "PSCAL%d", n + 1);
+    fits_write_key(fptr, TDOUBLE, key, &pscal[n], NULL, &fits_status);
+    sprintf(key, "PZERO%d", n + 1);
+    fits_write_key(fptr, TDOUBLE, key, &pzero[n], NULL, &fits_status);
+  }
+  for (g = 0; g < ng; g++) {
+    par[0] = 100.0 * g - 250.0;
+    par[1] = 37.5 * g;
+    par[2] = -3.0 * g;
+    par[3] = 256 * (g % 3 + 1) + g % 2 + 2;
+    par[4] = 0.25 * g;
+    //Complex axis first, then Stokes and channel
+    for (c = 0; c < 2; c++) {
+      for (s = 0; s < 2; s++) {
+        k = 3 * (s + 2 * c);
+        dat[k] = g + 0.5 * c + 0.25 * s;
+        dat[k + 1] = -dat[k] - 0.125;
+        dat[k + 2] = wts[g][s];
+      }
+    }
+    fits_write_grppar_dbl(fptr, g + 1, 1, 5, par, &fits_status);
+    fits_write_img_dbl(fptr, g + 1, 1, 12, dat, &fits_status);
+  }
+  fits_close_file(fptr, &fits_status);
+  fits_report_error(stdout, fits_status);
+  if (fits_status)
+    return 1;
+
+  purify_visibility_readfile(&vis, filename, 
+                             PURIFY_VISIBILITY_FILETYPE_UVFITS);
+
+  nbad = vis.nmeas != 2 * ng;
+  nflag = 0;
+  for (g = 0; g < ng && !nbad; g++) {
+    for (c = 0; c < 2; c++) {
+      k = 2 * g + c;
+      freq = f0 + c * df;
+      w1 = wts[g][0];
+      w2 = wts[g][1];
+      //Stokes I from the unflagged correlations
+      if (w1 > 0.0 && w2 > 0.0) {
+        y = (g + 0.5 * c + 0.125) - (g + 0.5 * c + 0.25) * I;
+        sigma = 0.5 * sqrt(1.0 / w1 + 1.0 / w2);
+      }
+      else if (w1 > 0.0) {
+        y = (g + 0.5 * c) - (g + 0.5 * c + 0.125) * I;
+        sigma = sqrt(1.0 / w1);
+      }
+      else if (w2 > 0.0) {
+        y = (g + 0.5 * c + 0.25) - (g + 0.5 * c + 0.375) * I;
+        sigma = sqrt(1.0 / w2);
+      }
+      else {
+        y = 0.0;
+        sigma = INFINITY;
+        nflag++;
+      }
+      if (!(fabs(vis.u[k] - (100.0 * g - 250.0) / f0 * freq) 
+            <= 1e-12 * fabs(vis.u[k]))
+          || !(fabs(vis.v[k] - 37.5 * g / f0 * freq) <= 1e-12 * fabs(vis.v[k]))
+          || !(fabs(vis.w[k] + 3.0 * g / f0 * freq) <= 1e-12 * fabs(vis.w[k]))
+          || vis.baseline[k] != 256 * (g % 3 + 1) + g % 2 + 2
+          || vis.time[k] != 2450000.5 + 0.25 * g
+          || !(cabs(vis.y[k] - y) <= 1e-12)
+          || (isinf(sigma) ? !isinf(creal(vis.noise_std[k]))
+              : !(fabs(creal(vis.noise_std[k]) - sigma) <= 1e-12)))
+        nbad++;
+    }
+  }
+
+  printf("UVFITS visibilities: %i (flagged %i) \n", vis.nmeas, nflag);
+  printf("Wrong visibilities: %i \n\n", nbad);
+
+  purify_visibility_free(&vis);
+
+  return nbad == 0 && nflag == 2 ? 0 : 1;
+
+}
+
+/*!
+ * Write visibilities with edge values (subnormals, 17 digit values,
+ * negative zero, extreme exponents) to the text (UV) and binary
+ * formats and check that they read back bit for bit, and check that
+ * the compressed format reads back within its error bounds.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_roundtrip(void) {
+
+  const double edge[] = {
+    5e-324, 2.2250738585072009e-308, 2.2250738585072014e-308, -0.0,
+    0.30000000000000004, 0.1, 1.0/3.0, 123456789012345678.0,
+    1.7976931348623157e308, -1.7976931348623157e308, 1e-300, 1e300,
+    -4.9406564584124654e-310, 9007199254740993.0, 2.5, PURIFY_PI };
+  const int nedge = sizeof(edge) / sizeof(edge[0]);
+  int i, j, n, nbad, ntext, nbin;
+  unsigned long long state = 47;
+  double amax[2], x, x0, bound;
+  double infimag[2] = {1.0, INFINITY};
+  purify_visibility vis, vis_read;
+  purify_visibility_zparam zparam;
+
+  //Edge values, rotated across the columns
+  n = nedge * nedge;
+  purify_visibility_alloc(&vis, n);
+  for (i = 0; i < n; i++) {
+    j = i / nedge;
+    vis.u[i] = edge[i % nedge];
+    vis.v[i] = edge[(i + j + 1) % nedge];
+    vis.w[i] = edge[(i + 2*j + 2) % nedge];
+    vis.y[i] = edge[(i + 3*j + 3) % nedge] 
+      + edge[(i + 5*j + 4) % nedge]*I;
+    vis.noise_std[i] = edge[(i + 7*j + 5) % nedge] 
+      + edge[(i + 11*j + 6) % nedge]*I;
+    vis.baseline[i] = i % 2 == 0 ? i : -i;
+    vis.time[i] = edge[(i + 13*j + 7) % nedge];
+  }
+
+  //Text: every column but the imaginary part of the noise
+  purify_visibility_writefile(&vis, "data/test/test_edge.uv", 
+                              PURIFY_VISIBILITY_FILETYPE_UV);
+  purify_visibility_readfile(&vis_read, "data/test/test_edge.uv", 
+                             PURIFY_VISIBILITY_FILETYPE_UV);
+  ntext = vis_read.nmeas != n;
+  for (i = 0; i < n && vis_read.nmeas == n; i++) {
+    x = creal(vis.noise_std[i]);
+    x0 = creal(vis_read.noise_std[i]);
+    if (memcmp(&vis.u[i], &vis_read.u[i], sizeof(double)) != 0
+        || memcmp(&vis.v[i], &vis_read.v[i], sizeof(double)) != 0
+        || memcmp(&vis.w[i], &vis_read.w[i], sizeof(double)) != 0
+        || memcmp(&vis.y[i], &vis_read.y[i], sizeof(complex double)) != 0
+        || memcmp(&x, &x0, sizeof(double)) != 0
+        || vis.baseline[i] != vis_read.baseline[i]
+        || memcmp(&vis.time[i], &vis_read.time[i], sizeof(double)) != 0)
+      ntext++;
+  }
+  purify_visibility_free(&vis_read);
+  printf("Text round trip: %i of %i rows differ \n", ntext, n);
+
+  //Binary: every column
+  purify_visibility_writefile(&vis, "data/test/test_edge.bin", 
+                              PURIFY_VISIBILITY_FILETYPE_BIN);
+  purify_visibility_readfile(&vis_read, "data/test/test_edge.bin", 
+                             PURIFY_VISIBILITY_FILETYPE_BIN);
+  nbin = vis_read.nmeas != n;
+  if (vis_read.nmeas == n) {
+    nbin += memcmp(vis.u, vis_read.u, n * sizeof(double)) != 0;
+    nbin += memcmp(vis.v, vis_read.v, n * sizeof(double)) != 0;
+    nbin += memcmp(vis.w, vis_read.w, n * sizeof(double)) != 0;
+    nbin += memcmp(vis.y, vis_read.y, n * sizeof(complex double)) != 0;
+    nbin += memcmp(vis.noise_std, vis_read.noise_std, 
+                   n * sizeof(complex double)) != 0;
+    nbin += memcmp(vis.baseline, vis_read.baseline, n * sizeof(int)) != 0;
+    nbin += memcmp(vis.time, vis_read.time, n * sizeof(double)) != 0;
+  }
+  purify_visibility_free(&vis_read);
+  purify_visibility_free(&vis);
+  printf("Binary round trip: %i columns differ \n", nbin);
+
+  //Compressed: two blocks of random values with half floats, and
+  //flagged visibilities with infinite real and imaginary noise
+  n = 3000;
+  purify_visibility_alloc(&vis, n);
+  for (i = 0; i < n; i++) {
+    vis.u[i] = 1e4 * purify_ran_gasdev_r(&state);
+    vis.v[i] = 1e4 * purify_ran_gasdev_r(&state);
+    vis.w[i] = 1e2 * purify_ran_gasdev_r(&state);
+    vis.y[i] = purify_ran_gasdev_r(&state) + purify_ran_gasdev_r(&state)*I;
+    vis.noise_std[i] = 0.1 + purify_ran_uniform_r(&state);
+    vis.baseline[i] = (int)(purify_ran_uniform_r(&state) * 1000);
+    vis.time[i] = 3600.0 * i / n;
+  }
+  vis.noise_std[n/2] = INFINITY;
+  memcpy(&vis.noise_std[n/2 + 1], infimag, sizeof(infimag));
+  purify_visibility_init_zparam(&zparam);
+  zparam.uvwerr = 1e-3;
+  zparam.yrelerr = 1.0 / (1 << 11);
+  zparam.timeerr = 1e-3;
+  zparam.blocksize = 2048;
+  purify_visibility_writez(&vis, "data/test/test_edge.zvis", &zparam);
+  purify_visibility_readfile(&vis_read, "data/test/test_edge.zvis", 
+                             PURIFY_VISIBILITY_FILETYPE_ZVIS);
+  amax[0] = 0.0;
+  amax[1] = 0.0;
+  for (i = 0; i < n; i++) {
+    amax[0] = fmax(amax[0], fmax(fabs(creal(vis.y[i])), 
+                                 fabs(cimag(vis.y[i]))));
+    if (i != n/2)
+      amax[1] = fmax(amax[1], fabs(creal(vis.noise_std[i])));
+    if (i != n/2 + 1)
+      amax[1] = fmax(amax[1], fabs(cimag(vis.noise_std[i])));
+  }
+  nbad = vis_read.nmeas != n;
+  for (i = 0; i < n && vis_read.nmeas == n; i++) {
+    if (fabs(vis.u[i] - vis_read.u[i]) > zparam.uvwerr
+        || fabs(vis.v[i] - vis_read.v[i]) > zparam.uvwerr
+        || fabs(vis.w[i] - vis_read.w[i]) > zparam.uvwerr
+        || fabs(vis.time[i] - vis_read.time[i]) > zparam.timeerr
+        || vis.baseline[i] != vis_read.baseline[i])
+      nbad++;
+    //Relative bound, down to the half float subnormals
+    for (j = 0; j < 4; j++) {
+      x0 = j == 0 ? creal(vis.y[i]) : j == 1 ? cimag(vis.y[i]) 
+        : j == 2 ? creal(vis.noise_std[i]) : cimag(vis.noise_std[i]);
+      x = j == 0 ? creal(vis_read.y[i]) : j == 1 ? cimag(vis_read.y[i]) 
+        : j == 2 ? creal(vis_read.noise_std[i]) 
+        : cimag(vis_read.noise_std[i]);
+      bound = zparam.yrelerr * fabs(x0) + amax[j/2] * ldexp(1.0, -39);
+      if (isinf(x0) ? x != x0 : !(fabs(x - x0) <= bound))
+        nbad++;
+    }
+  }
+  purify_visibility_free(&vis_read);
+  purify_visibility_free(&vis);
+  printf("Compressed round trip: %i values out of bounds \n\n", nbad);
+
+  return ntext + nbin + nbad;
+
+}
+
+/*!
+ * Compare two integers for qsort.
+ */
+int purify_test_cmpint(const void *a, const void *b) {
+
+  return *(const int*)a - *(const int*)b;
+
+}
+
+/*!
+ * Check the range, annulus and tile queries of the uv index against
+ * brute force scans, with visibilities outside the box of the index
+ * (clamped into the border cells) and on the edges of the cells, and
+ * with query regions on cell edges.
+ *
+ * \retval error Zero return indicates the test passed.
+ */
+int purify_test_index(void) {
+
+  const double ranges[][4] = {
+    {-0.5, 0.25, -0.125, 0.75},   //Cell edges
+    {-0.4, 0.3, -0.77, 0.01},     //Across cells
+    {0.125, 0.25, 0.5, 0.625},    //Single cell
+    {-1.5, -0.75, -1.5, 1.5},     //Beyond the box
+    {0.9, 1.3, -1.3, -0.8},       //Beyond the box
+    {-1.0, 1.0, -1.0, 1.0},       //Box
+    {0.3, 0.3, -1.0, 1.0} };      //Empty
+  const double annuli[][2] = {
+    {0.0, 0.25}, {0.25, 0.5}, {0.3, 0.71}, {0.9, 1.6}, {1.0, 1.0} };
+  const int nrange = sizeof(ranges) / sizeof(ranges[0]);
+  const int nannulus = sizeof(annuli) / sizeof(annuli[0]);
+  int i, k, c, iu, iv, n, nref, nt, nbad;
+  int *sel, *ref, *tile, *seen;
+  unsigned long long state = 48;
+  double r, fu, fv;
+  purify_visibility vis;
+  purify_visibility_index index;
+
+  //Random points over a box larger than that of the index, and points
+  //on the edges of the cells (multiples of the cell size 1/8)
+  n = 20000;
+  purify_visibility_alloc(&vis, n);
+  for (i = 0; i < n; i++) {
+    if (i % 4 == 0) {
+      vis.u[i] = (int)(purify_ran_uniform_r(&state) * 21 - 10) / 8.0;
+      vis.v[i] = (int)(purify_ran_uniform_r(&state) * 21 - 10) / 8.0;
+    }
+    else {
+      vis.u[i] = 2.6 * purify_ran_uniform_r(&state) - 1.3;
+      vis.v[i] = 2.6 * purify_ran_uniform_r(&state) - 1.3;
+    }
+  }
+  purify_visibility_init_index(&index, &vis, -1.0, 1.0, -1.0, 1.0, 16, 16);
+
+  nbad = 0;
+  ref = (int*)malloc(n * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(ref);
+  seen = (int*)calloc(n, sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(seen);
+
+  //Rectangles
+  for (k = 0; k < nrange; k++) {
+    nref = 0;
+    for (i = 0; i < n; i++)
+      if (vis.u[i] >= ranges[k][0] && vis.u[i] < ranges[k][1]
+          && vis.v[i] >= ranges[k][2] && vis.v[i] < ranges[k][3])
+        ref[nref++] = i;
+    nt = purify_visibility_index_range(&sel, &index, &vis, 
+                                       ranges[k][0], ranges[k][1],
+                                       ranges[k][2], ranges[k][3]);
+    qsort(sel, nt, sizeof(int), purify_test_cmpint);
+    if (nt != nref || memcmp(sel, ref, nt * sizeof(int)) != 0)
+      nbad++;
+    free(sel);
+  }
+
+  //Annuli
+  for (k = 0; k < nannulus; k++) {
+    nref = 0;
+    for (i = 0; i < n; i++) {
+      r = sqrt(vis.u[i]*vis.u[i] + vis.v[i]*vis.v[i]);
+      if (r >= annuli[k][0] && r < annuli[k][1])
+        ref[nref++] = i;
+    }
+    nt = purify_visibility_index_annulus(&sel, &index, &vis, 
+                                         annuli[k][0], annuli[k][1]);
+    qsort(sel, nt, sizeof(int), purify_test_cmpint);
+    if (nt != nref || memcmp(sel, ref, nt * sizeof(int)) != 0)
+      nbad++;
+    free(sel);
+  }
+
+  //Tiles: every visibility once, in the clamped cell of its point
+  for (iv = 0; iv < index.nv; iv++) {
+    for (iu = 0; iu < index.nu; iu++) {
+      nt = purify_visibility_index_tile(&tile, &index, iu, iv);
+      for (i = 0; i < nt; i++) {
+        fu = floor((vis.u[tile[i]] + 1.0) * 8.0);
+        fv = floor((vis.v[tile[i]] + 1.0) * 8.0);
+        c = (int)fmin(fmax(fv, 0.0), 15.0) * 16 
+          + (int)fmin(fmax(fu, 0.0), 15.0);
+        if (c != iv * index.nu + iu || (i > 0 && tile[i] <= tile[i-1]))
+          nbad++;
+        seen[tile[i]]++;
+      }
+    }
+  }
+  for (i = 0; i < n; i++)
+    if (seen[i] != 1) nbad++;
+
+  printf("Index queries differing from brute force: %i \n\n", nbad);
+
+  purify_visibility_free_index(&index);
+  purify_visibility_free(&vis);
+  free(ref);
+  free(seen);
+
+  return nbad;
+
+}
+
 int main(int argc, char *argv[]) {
 
   
@@ -54,6 +1011,7 @@ int main(int argc, char *argv[]) {
   double snr_out;
   double gamma=0.001;
   double aux1, aux2;
+  double mbps;
   
 
   purify_image img, img_copy;
@@ -74,15 +1032,25 @@ int main(int argc, char *argv[]) {
   //parameters for the continuos Fourier Transform
   double *deconv;
   purify_sparsemat_row gmat;
-  purify_visibility vis_test;
+  purify_visibility vis_test, vis_map;
   purify_measurement_cparam param_m1;
   purify_measurement_cparam param_m2;
   complex double *fft_temp1;
-  complex double *fft_temp2;
+  purify_measurement_workspace fft_ws;
   void *datafwd[5];
   void *dataadj[5];
   fftw_plan planfwd;
   fftw_plan planadj;
+  double *gdiag;
+  void *datagram[6];
+  purify_measurement_opnormparam param_on;
+  double bound, bound_gram;
+  purify_measurement_oocfft ooc;
+  void *dataooc[4];
+  purify_measurement_stream stream;
+  purify_visibility batch;
+  void *datasfwd[4];
+  void *datasadj[4];
 
   //Structures for sparsity operator
   sopt_wavelet_type *dict_types;
@@ -115,6 +1083,26 @@ int main(int argc, char *argv[]) {
              "./data/images/Coverages/cont_sim2.vis",
              filetype_vis); 
   printf("Number of visibilities: %i \n\n", vis_test.nmeas);  
+  printf("Mapping u-v coverage\n\n");
+  purify_visibility_mapfile(&vis_map,
+             "./data/images/Coverages/cont_sim2.vis",
+             filetype_vis, &mbps); 
+  printf("Parsing throughput: %f MB/s \n\n", mbps);
+  if (purify_visibility_compare(&vis_test, &vis_map, 0.0))
+    PURIFY_ERROR_GENERIC("Mapped visibilities differ from the ones read");
+  purify_visibility_free(&vis_map);
+  printf("Round trip of the visibility file formats\n\n");
+  if (purify_test_roundtrip())
+    PURIFY_ERROR_GENERIC("Visibility round trip test failed");
+  printf("Queries of the uv index\n\n");
+  if (purify_test_index())
+    PURIFY_ERROR_GENERIC("Visibility index test failed");
+  printf("Averaging along baseline tracks\n\n");
+  if (purify_test_average())
+    PURIFY_ERROR_GENERIC("Visibility averaging test failed");
+  printf("UVFITS round trip\n\n");
+  if (purify_test_uvfits())
+    PURIFY_ERROR_GENERIC("UVFITS test failed");
   printf("Visibility module test past\n\n"); 
 
    
@@ -135,6 +1123,7 @@ int main(int argc, char *argv[]) {
   printf("Image dimension: %i, %i \n\n", img.nx, img.ny); 
   printf("Image module test past\n\n"); 
 
+  purify_measurement_init_cparam(&param_m1);
   param_m1.nmeas = vis_test.nmeas;
   param_m1.ny1 = dimy;
   param_m1.nx1 = dimx;
@@ -142,7 +1131,9 @@ int main(int argc, char *argv[]) {
   param_m1.ofx = 2;
   param_m1.ky = 24;
   param_m1.kx = 24;
+  param_m1.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
+  purify_measurement_init_cparam(&param_m2);
   param_m2.nmeas = vis_test.nmeas;
   param_m2.ny1 = dimy;
   param_m2.nx1 = dimx;
@@ -150,6 +1141,7 @@ int main(int argc, char *argv[]) {
   param_m2.ofx = 2;
   param_m2.ky = 24;
   param_m2.kx = 24;
+  param_m2.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
   Nb = 9;
   Nx=param_m2.ny1*param_m2.nx1;
@@ -205,12 +1197,10 @@ int main(int argc, char *argv[]) {
   t = (double) (stop-start)/CLOCKS_PER_SEC;
   printf("Time griding matrix initalization: %f \n\n", t);
   
-  //Memory allocation for the fft
+  //Pool of grids for the fft, shared by both operators
   i = Nx*param_m1.ofy*param_m1.ofx;
-  fft_temp1 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp1);
-  fft_temp2 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp2);
+  purify_measurement_init_workspace(&fft_ws, i);
+  fft_temp1 = purify_measurement_workspace_acquire(&fft_ws);
 
   //FFT plan  
   planfwd = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
@@ -218,21 +1208,23 @@ int main(int argc, char *argv[]) {
               FFTW_FORWARD, FFTW_MEASURE);
 
   planadj = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
-              fft_temp2, fft_temp2, 
+              fft_temp1, fft_temp1, 
               FFTW_BACKWARD, FFTW_MEASURE);
 
+  purify_measurement_workspace_release(&fft_ws, fft_temp1);
+
 
   datafwd[0] = (void*)&param_m1;
   datafwd[1] = (void*)deconv;
   datafwd[2] = (void*)&gmat;
   datafwd[3] = (void*)&planfwd;
-  datafwd[4] = (void*)fft_temp1;
+  datafwd[4] = (void*)&fft_ws;
 
   dataadj[0] = (void*)&param_m2;
   dataadj[1] = (void*)deconv;
   dataadj[2] = (void*)&gmat;
   dataadj[3] = (void*)&planadj;
-  dataadj[4] = (void*)fft_temp2;
+  dataadj[4] = (void*)&fft_ws;
 
 
   printf("FFT plan done \n\n");
@@ -292,7 +1284,111 @@ int main(int argc, char *argv[]) {
   printf("Writing dirty image in fits file\n\n");
   purify_image_writefile(&img_copy, "data/test/test_dirty.fits", filetype_img);
 
+  //Operator norm with and without the Gram operator
+  printf("Estimating operator norm\n\n");
+  gdiag = (double*)malloc((gmat.ncols) * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(gdiag);
+  purify_measurement_init_gram(gdiag, &gmat);
+  datagram[0] = (void*)&param_m1;
+  datagram[1] = (void*)deconv;
+  datagram[2] = (void*)gdiag;
+  datagram[3] = (void*)&planfwd;
+  datagram[4] = (void*)&planadj;
+  datagram[5] = (void*)&fft_ws;
+
+  purify_measurement_init_opnormparam(&param_on);
+  param_on.verbose = 1;
+  assert((start = clock())!=-1);
+  bound = purify_measurement_opnorm(&purify_measurement_cftfwd, datafwd,
+                                    &purify_measurement_cftadj, dataadj,
+                                    NULL, NULL, Nx, Ny, &param_on);
+  stop = clock();
+  t = (double) (stop-start)/CLOCKS_PER_SEC;
+  printf("Time operator norm: %f \n\n", t);
+  assert((start = clock())!=-1);
+  bound_gram = purify_measurement_opnorm(NULL, NULL, NULL, NULL,
+                                         &purify_measurement_cftgram, datagram,
+                                         Nx, Ny, &param_on);
+  stop = clock();
+  t = (double) (stop-start)/CLOCKS_PER_SEC;
+  printf("Time operator norm (Gram): %f \n\n", t);
+  printf("Relative difference: %e \n\n", fabs(bound - bound_gram)/bound);
+  free(gdiag);
+
+  //Out-of-core operator against the in-memory one
+  printf("Out-of-core measurement operator\n\n");
+  purify_measurement_init_oocfft(&ooc, param_m1.ny1*param_m1.ofy, 
+                                 param_m1.nx1*param_m1.ofx, 64, "data/test");
+  dataooc[0] = (void*)&param_m1;
+  dataooc[1] = (void*)deconv;
+  dataooc[2] = (void*)&gmat;
+  dataooc[3] = (void*)&ooc;
+  if (purify_test_compare("out of core", 
+                          &purify_measurement_ooccftfwd, dataooc,
+                          &purify_measurement_ooccftadj, dataooc,
+                          &purify_measurement_cftfwd, datafwd,
+                          &purify_measurement_cftadj, dataadj,
+                          Nx, Ny, 1e-10))
+    PURIFY_ERROR_GENERIC("Out-of-core measurement operator test failed");
+  purify_measurement_free_oocfft(&ooc);
+
+  //Streaming operator built from batches that cross the chunks
+  printf("Streaming measurement operator\n\n");
+  purify_measurement_init_stream(&stream, &param_m1, 1000);
+  for (i = 0; i < vis_test.nmeas; i += batch.nmeas) {
+    batch.nmeas = purify_min(777, vis_test.nmeas - i);
+    batch.u = vis_test.u + i;
+    batch.v = vis_test.v + i;
+    batch.w = vis_test.w + i;
+    batch.noise_std = vis_test.noise_std + i;
+    batch.y = vis_test.y + i;
+    batch.baseline = vis_test.baseline + i;
+    batch.time = vis_test.time + i;
+    batch.map = NULL;
+    batch.maplen = 0;
+    purify_measurement_stream_append(&stream, &batch);
+  }
+  printf("Chunks: %i \n", stream.nchunks);
+  datasfwd[0] = (void*)&stream;
+  datasfwd[1] = (void*)deconv;
+  datasfwd[2] = (void*)&planfwd;
+  datasfwd[3] = (void*)&fft_ws;
+  datasadj[0] = (void*)&stream;
+  datasadj[1] = (void*)deconv;
+  datasadj[2] = (void*)&planadj;
+  datasadj[3] = (void*)&fft_ws;
+  if (stream.param.nmeas != Ny
+      || purify_test_compare("streaming", 
+                             &purify_measurement_streamfwd, datasfwd,
+                             &purify_measurement_streamadj, datasadj,
+                             &purify_measurement_cftfwd, datafwd,
+                             &purify_measurement_cftadj, dataadj,
+                             Nx, Ny, 1e-10))
+    PURIFY_ERROR_GENERIC("Streaming measurement operator test failed");
+  purify_measurement_free_stream(&stream);
+
   printf("Measurement module test past\n\n"); 
+
+  printf("************************\n");
+  printf("Half-plane operator test\n");
+  printf("************************\n\n");
+  if (purify_test_hcft())
+    PURIFY_ERROR_GENERIC("Half-plane operator test failed");
+  printf("Half-plane operator test past\n\n"); 
+
+  printf("*********************\n");
+  printf("Faceted operator test\n");
+  printf("*********************\n\n");
+  if (purify_test_facets())
+    PURIFY_ERROR_GENERIC("Faceted operator test failed");
+  printf("Faceted operator test past\n\n"); 
+
+  printf("***********************\n");
+  printf("Phase centre shift test\n");
+  printf("***********************\n\n");
+  if (purify_test_shift())
+    PURIFY_ERROR_GENERIC("Phase centre shift test failed");
+  printf("Phase centre shift test past\n\n"); 
   
   printf("***********************\n");
   printf("SOPT linking test\n");
@@ -438,8 +1534,7 @@ int main(int argc, char *argv[]) {
   sopt_sara_free(&param1);
   free(dict_types);
 
-  free(fft_temp1);
-  free(fft_temp2);
+  purify_measurement_free_workspace(&fft_ws);
   fftw_destroy_plan(planfwd);
   fftw_destroy_plan(planadj);
   purify_sparsemat_freer(&gmat);
@@ -5,10 +5,30 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <complex.h>
 #include <math.h>
+#include <sys/mman.h>
 #include "purify_error.h"
 #include "purify_types.h"
+#include "purify_utils.h"
+
+/*! Size of the header in front of the blocks of purify_utils_malloc
+    (keeps the 64 byte alignment of the data). */
+#define PURIFY_UTILS_ALLOC_HEADER 64
+/*! Size of a huge page. */
+#define PURIFY_UTILS_ALLOC_HUGEPAGE (2 << 20)
+
+/*! Header of a block allocated by purify_utils_malloc. */
+typedef struct {
+  /*! Size of the underlying allocation (mapped blocks only). */
+  size_t mapped;
+  /*! Policy used to allocate the block. */
+  int policy;
+} purify_utils_alloc_header;
+
+/*! Allocation policy, -1 until set or read from PURIFY_ALLOC. */
+static int purify_utils_policy = -1;
 
 void purify_utils_fftshift_2d_c(complex double *x, int nx, int ny){
     
@@ -166,3 +186,178 @@ int purify_utils_absearch(double *x, int nx, double key){
 }
 
 
+
+/*!
+ * Update a 64 bit FNV-1a hash with the contents of a buffer. Used to
+ * fingerprint coverages and operator configurations for on-disk
+ * caches.
+ * 
+ * \param[in] hash Current hash value (use PURIFY_UTILS_HASH_INIT to
+ * start a new hash).
+ * \param[in] buf Buffer to add to the hash.
+ * \param[in] nbytes Size of the buffer in bytes.
+ * \retval hash Updated hash value.
+ */
+unsigned long long purify_utils_hash(unsigned long long hash, 
+                                     const void *buf, size_t nbytes) {
+
+  const unsigned char *p = (const unsigned char*)buf;
+  size_t i;
+
+  for (i = 0; i < nbytes; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001B3ULL;
+  }
+
+  return hash;
+
+}
+
+
+/*!
+ * Set the allocation policy of purify_utils_malloc and
+ * purify_utils_calloc. Blocks allocated before are still freed
+ * correctly by purify_utils_free.
+ *
+ * \param[in] policy Allocation policy.
+ */
+void purify_utils_alloc_setpolicy(purify_utils_alloc_policy policy) {
+
+  purify_utils_policy = policy;
+
+}
+
+/*!
+ * Allocation policy of purify_utils_malloc. Unless set with
+ * purify_utils_alloc_setpolicy it is read from the environment
+ * variable PURIFY_ALLOC ("default", "numa" or "hugetlb"), and is
+ * PURIFY_UTILS_ALLOC_NUMA if the variable is not set.
+ *
+ * \retval policy Allocation policy.
+ */
+purify_utils_alloc_policy purify_utils_alloc_getpolicy(void) {
+
+  const char *env;
+
+  if (purify_utils_policy < 0) {
+    env = getenv("PURIFY_ALLOC");
+    if (env != NULL && strcmp(env, "default") == 0)
+      purify_utils_policy = PURIFY_UTILS_ALLOC_DEFAULT;
+    else if (env != NULL && strcmp(env, "hugetlb") == 0)
+      purify_utils_policy = PURIFY_UTILS_ALLOC_HUGETLB;
+    else
+      purify_utils_policy = PURIFY_UTILS_ALLOC_NUMA;
+  }
+
+  return (purify_utils_alloc_policy)purify_utils_policy;
+
+}
+
+/*!
+ * Allocate a large 64 byte aligned buffer. With the NUMA policies the
+ * data is backed by huge pages when possible, and zeroed by all
+ * OpenMP threads with a static schedule, so that its pages are placed
+ * on the memory of the threads that use them in statically scheduled
+ * loops.
+ *
+ * \param[in] size Size of the buffer in bytes.
+ * \retval p Buffer (NULL if the allocation failed), which must be
+ * freed with purify_utils_free.
+ */
+void *purify_utils_malloc(size_t size) {
+
+  purify_utils_alloc_header *h;
+  purify_utils_alloc_policy policy;
+  char *base = NULL;
+  size_t total, mapped = 0;
+  long i, n;
+
+  policy = purify_utils_alloc_getpolicy();
+  total = size + PURIFY_UTILS_ALLOC_HEADER;
+
+  if (policy == PURIFY_UTILS_ALLOC_DEFAULT) {
+    //Same alignment as the other policies, so that FFTW plans made on
+    //one buffer can be executed on another.
+    if (posix_memalign((void**)&base, 64, total) != 0)
+      return NULL;
+  }
+  else {
+    #ifdef MAP_HUGETLB
+    if (policy == PURIFY_UTILS_ALLOC_HUGETLB) {
+      mapped = (total + PURIFY_UTILS_ALLOC_HUGEPAGE - 1) 
+        / PURIFY_UTILS_ALLOC_HUGEPAGE * PURIFY_UTILS_ALLOC_HUGEPAGE;
+      base = (char*)mmap(NULL, mapped, PROT_READ | PROT_WRITE, 
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (base == MAP_FAILED) {
+        base = NULL;
+        mapped = 0;
+      }
+    }
+    #endif
+    if (base == NULL) {
+      if (posix_memalign((void**)&base, total >= PURIFY_UTILS_ALLOC_HUGEPAGE ?
+                         PURIFY_UTILS_ALLOC_HUGEPAGE : 64, total) != 0)
+        return NULL;
+      #ifdef MADV_HUGEPAGE
+      if (total >= PURIFY_UTILS_ALLOC_HUGEPAGE)
+        madvise(base, total, MADV_HUGEPAGE);
+      #endif
+    }
+    //Parallel first touch.
+    n = (long)(size / sizeof(double));
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++)
+      ((double*)(base + PURIFY_UTILS_ALLOC_HEADER))[i] = 0.0;
+    memset(base + PURIFY_UTILS_ALLOC_HEADER + n * sizeof(double), 0, 
+           size - n * sizeof(double));
+  }
+
+  h = (purify_utils_alloc_header*)base;
+  h->mapped = mapped;
+  h->policy = policy;
+
+  return base + PURIFY_UTILS_ALLOC_HEADER;
+
+}
+
+/*!
+ * Allocate a large zeroed buffer (see purify_utils_malloc).
+ *
+ * \param[in] n Number of elements.
+ * \param[in] size Size of each element in bytes.
+ * \retval p Buffer (NULL if the allocation failed), which must be
+ * freed with purify_utils_free.
+ */
+void *purify_utils_calloc(size_t n, size_t size) {
+
+  char *p;
+
+  p = (char*)purify_utils_malloc(n * size);
+  if (p != NULL && purify_utils_alloc_getpolicy() 
+      == PURIFY_UTILS_ALLOC_DEFAULT)
+    memset(p, 0, n * size);
+
+  return p;
+
+}
+
+/*!
+ * Free a buffer allocated with purify_utils_malloc or
+ * purify_utils_calloc.
+ *
+ * \param[in] p Buffer (nothing is done if NULL).
+ */
+void purify_utils_free(void *p) {
+
+  purify_utils_alloc_header *h;
+  char *base;
+
+  if (p == NULL) return;
+  base = (char*)p - PURIFY_UTILS_ALLOC_HEADER;
+  h = (purify_utils_alloc_header*)base;
+  if (h->mapped > 0)
+    munmap(base, h->mapped);
+  else
+    free(base);
+
+}
@@ -7,6 +7,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <time.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <fitsio.h>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
 #include "purify_visibility.h"
 #include "purify_sparsemat.h"
 #include "purify_utils.h"
@@ -16,6 +30,114 @@
 
 
 int purify_compare_ints(const void *a, const void *b);
+
+/*! Grid cell of a visibility, used to merge co-located visibilities. */
+typedef struct {
+  int iu;
+  int iv;
+  int sub;
+  int ind;
+} purify_visibility_cell;
+
+int purify_visibility_compare_cells(const void *a, const void *b);
+
+/*! Header of a compressed visibility file, followed by the end
+    offsets of its blocks and the deflated blocks. */
+typedef struct {
+  char magic[8];
+  int version;
+  unsigned int byteorder;
+  long long nmeas;
+  int blocksize;
+  int nblocks;
+  int yprec;
+  int level;
+  double uvwstep[3];
+  double tstep;
+} purify_visibility_zheader;
+
+/*! Powers of ten that are exactly representable as doubles. */
+static const double purify_visibility_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/*! Number of rows formatted by a thread in a block of a text file. */
+#define PURIFY_VISIBILITY_WRITEBLOCK 16384
+/*! Upper bound of the length of a formatted row of a text file. */
+#define PURIFY_VISIBILITY_MAXROW 256
+
+/*! Bytes of group parameters and data of a UVFITS file read in one
+    bulk read. */
+#define PURIFY_VISIBILITY_UVFITSBLOCK 67108864L
+/*! Maximum number of axes of the data array of a UVFITS file. */
+#define PURIFY_VISIBILITY_UVFITSMAXAXIS 8
+
+/*! Largest quantised coordinate of a compressed visibility file, so
+    that the differences of two coordinates fit in 32 bits. */
+#define PURIFY_VISIBILITY_ZQMAX 1073741824.0
+
+/*! Baseline and time of a visibility, used to average along tracks. */
+typedef struct {
+  int baseline;
+  double time;
+  int ind;
+} purify_visibility_sample;
+
+int purify_visibility_compare_samples(const void *a, const void *b);
+int purify_visibility_average_track(purify_visibility *avg, int k,
+				    purify_visibility *vis,
+				    purify_visibility_sample *samples,
+				    int start, int end, double maxdist);
+int purify_visibility_countlines(const char *p, const char *end);
+void purify_visibility_parsechunk(purify_visibility *vis, int i,
+				  const char *p, const char *end,
+				  purify_visibility_filetype filetype);
+void purify_visibility_parsespan(purify_visibility *vis, int i,
+				 const char *p, const char *end,
+				 purify_visibility_filetype filetype);
+void purify_visibility_parsefield(purify_visibility *vis, int i, int itok,
+				  const char *tok, const char *end,
+				  purify_visibility_filetype filetype);
+double purify_visibility_strtod(const char *tok, const char *end);
+int purify_visibility_strtoi(const char *tok, const char *end);
+double purify_visibility_time(void);
+int purify_visibility_writebin(purify_visibility *vis, FILE *file);
+size_t purify_visibility_readbinheader(purify_visibility_binheader *header,
+				       int fd, const char *filename);
+void purify_visibility_bincolsize(size_t *colsize);
+int purify_visibility_cellind(double u, double v, double uinc, double vinc,
+			      int nx2, int ny2);
+int purify_visibility_writezstream(purify_visibility *vis, FILE *file,
+				   purify_visibility_zparam *zparam);
+size_t purify_visibility_zrawsize(purify_visibility_zheader *header, 
+				  int n);
+size_t purify_visibility_zencode(unsigned char *raw, unsigned char *tmp,
+				 purify_visibility *vis, int start, int n,
+				 purify_visibility_zheader *header);
+void purify_visibility_zdecode(purify_visibility *vis, int start, int n,
+			       const unsigned char *raw, unsigned char *tmp,
+			       purify_visibility_zheader *header);
+void purify_visibility_shuffle(unsigned char *dst, 
+			       const unsigned char *src, 
+			       int n, int size);
+void purify_visibility_unshuffle(unsigned char *dst, 
+				 const unsigned char *src, 
+				 int n, int size);
+unsigned short purify_visibility_float2half(float f);
+float purify_visibility_half2float(unsigned short h);
+int purify_visibility_writetext(purify_visibility *vis, FILE *file,
+				purify_visibility_filetype filetype);
+char *purify_visibility_formatrow(char *s, purify_visibility *vis, int i,
+				  purify_visibility_filetype filetype);
+char *purify_visibility_dtoa(char *s, double x);
+void purify_visibility_setimag(complex double *z, double x);
+char *purify_visibility_itoa(char *s, int n);
+double purify_visibility_fitskey(fitsfile *fptr, const char *key, 
+				 double def);
+int purify_visibility_index_select(int **sel,
+				   purify_visibility_index *index,
+				   purify_visibility *vis,
+				   double *region, int annulus);
 double purify_visibility_modifypdf(double *pdf, double *new_pdf, 
 				   int num_elements, int nb_meas, 
 				   int max_iter);
@@ -105,6 +227,8 @@ inline double purify_visibility_umax(double fov, int n) {
  */
 void purify_visibility_alloc(purify_visibility *vis, int nmeas) {
 
+  int i;
+
   vis->nmeas = nmeas;
   vis->u = (double*)calloc(vis->nmeas, sizeof(double));
   vis->v = (double*)calloc(vis->nmeas, sizeof(double));
@@ -113,11 +237,19 @@ void purify_visibility_alloc(purify_visibility *vis, int nmeas) {
 					   sizeof(complex double));
   vis->y = (complex double*)calloc(vis->nmeas, 
 				   sizeof(complex double));
+  vis->baseline = (int*)malloc(vis->nmeas * sizeof(int));
+  vis->time = (double*)calloc(vis->nmeas, sizeof(double));
+  vis->map = NULL;
+  vis->maplen = 0;
   PURIFY_ERROR_MEM_ALLOC_CHECK(vis->u);
   PURIFY_ERROR_MEM_ALLOC_CHECK(vis->v);
   PURIFY_ERROR_MEM_ALLOC_CHECK(vis->w);
   PURIFY_ERROR_MEM_ALLOC_CHECK(vis->noise_std);
   PURIFY_ERROR_MEM_ALLOC_CHECK(vis->y);
+  PURIFY_ERROR_MEM_ALLOC_CHECK(vis->baseline);
+  PURIFY_ERROR_MEM_ALLOC_CHECK(vis->time);
+  for (i = 0; i < vis->nmeas; i++)
+    vis->baseline[i] = -1;
 
 }
 
@@ -147,6 +279,8 @@ void purify_visibility_copy(purify_visibility *copy,
 	 orig->nmeas * sizeof(complex double));
   memcpy(copy->y, orig->y, 
 	 orig->nmeas * sizeof(complex double));
+  memcpy(copy->baseline, orig->baseline, orig->nmeas*sizeof(int));
+  memcpy(copy->time, orig->time, orig->nmeas*sizeof(double));
 
 }
 
@@ -160,11 +294,26 @@ void purify_visibility_copy(purify_visibility *copy,
  */
 void purify_visibility_free(purify_visibility *vis) {
 
+  if (vis->map != NULL) {
+    // Arrays point into a file mapping.
+    munmap(vis->map, vis->maplen);
+    vis->map = NULL;
+    vis->maplen = 0;
+    vis->u = NULL;
+    vis->v = NULL;
+    vis->w = NULL;
+    vis->noise_std = NULL;
+    vis->y = NULL;
+    vis->baseline = NULL;
+    vis->time = NULL;
+  }
   if(vis->u != NULL) free(vis->u);
   if(vis->v != NULL) free(vis->v);
   if(vis->w != NULL) free(vis->w);
   if(vis->noise_std != NULL) free(vis->noise_std);
   if(vis->y != NULL) free(vis->y);
+  if(vis->baseline != NULL) free(vis->baseline);
+  if(vis->time != NULL) free(vis->time);
   vis->nmeas = 0;
 
 }
@@ -204,6 +353,8 @@ int purify_visibility_compare(purify_visibility *vis1,
       return 1;
     if (fabs(cimag(vis1->y[i] - vis2->y[i])) > tol) 
       return 1;
+    if (vis1->baseline[i] != vis2->baseline[i]) return 1;
+    if (fabs(vis1->time[i] - vis2->time[i]) > tol) return 1;
 
   }
 
@@ -557,285 +708,3315 @@ void purify_visibility_vis2mask(purify_sparsemat *mask,
 
 
 /*!
- * Read continuous visibilities from file.
- *
- * \param[out] vis Visibilities read from the file.
- * \param[in] filename Name of the file to read.
- * \param[in] filetype Type of file to read.
- * \retval error Zero return indicates no errors.
- *
- * \note Memory for the visibilities is allocated herein and must be
- * freed by the calling routine (note space for measurements is also
- * allocated).
+ * Fold visibilities onto the half plane u >= 0 (v >= 0 on the u = 0
+ * axis) using the conjugate symmetry \f$V(-u,-v) = V(u,v)^*\f$ of the
+ * visibilities of a real image.
  * 
- * \authors <a href="http://www.jasonmcewen.org">Jason McEwen</a>
+ * \param[in,out] vis Visibilities to fold.
+ * \retval nfold Number of visibilities folded.
  */
-int purify_visibility_readfile(purify_visibility *vis, 
-			       const char *filename, 
-			       purify_visibility_filetype filetype) {
+int purify_visibility_fold(purify_visibility *vis) {
 
+  int i, nfold = 0;
 
-  FILE *file;
-  char buffer[PURIFY_STRLEN];
-  int i, nvis, itok;
-  char *tok;
-  char delimiters[] = " ,";
+  for (i = 0; i < vis->nmeas; i++) {
+    if (vis->u[i] < 0.0 || (vis->u[i] == 0.0 && vis->v[i] < 0.0)) {
+      vis->u[i] = -vis->u[i];
+      vis->v[i] = -vis->v[i];
+      vis->w[i] = -vis->w[i];
+      vis->y[i] = conj(vis->y[i]);
+      nfold++;
+    }
+  }
 
-  // Open file.
-  file = fopen(filename, "r");
-  if (file == NULL) {
-    sprintf(buffer, "Failed to open file %s", filename);
-    PURIFY_ERROR_GENERIC(buffer);
+  return nfold;
+
+}
+
+
+/*!
+ * Merge visibilities that fall in the same cell of the oversampled
+ * grid into a single gridded visibility. The merged visibility is the
+ * noise weighted average of the originals, so that
+ * \f$\sum_k |y_k - \Phi_c x|^2/\sigma_k^2 = |y_c - \Phi_c x|^2/\sigma_c^2
+ * + \f$ const, with \f$1/\sigma_c^2 = \sum_k 1/\sigma_k^2\f$.
+ * 
+ * \param[out] coal Merged visibilities. The u, v, w coordinates are
+ * the weighted average of the merged coordinates and noise_std holds
+ * \f$\sigma_c\f$.
+ * \param[out] count Number of visibilities merged in each element of
+ * coal (not computed if NULL).
+ * \param[in] vis Original visibilities.
+ * \param[in] umax Maximum u frequency of the operator.
+ * \param[in] vmax Maximum v frequency of the operator.
+ * \param[in] nx2 Size of the oversampled grid along u.
+ * \param[in] ny2 Size of the oversampled grid along v.
+ * \param[in] nsub Number of bins of the fractional offset within a
+ * cell, along each axis. With nsub = 1 the merge is exact for the
+ * nearest neighbour kernel. Wider kernels need nsub > 1, in which
+ * case the merge is an approximation with position error below
+ * 1/nsub cells.
+ *
+ * \note Visibilities with zero noise standard deviation are given unit
+ * weight. Memory for coal and count is allocated herein and must be
+ * freed by the calling routine.
+ */
+void purify_visibility_coalesce(purify_visibility *coal,
+				int **count,
+				purify_visibility *vis,
+				double umax, double vmax,
+				int nx2, int ny2, int nsub) {
+
+  int i, k, n;
+  double uinc, vinc, ufrc, vfrc, wk, wsum, u0, v0, uk, vk;
+  purify_visibility_cell *cells;
+
+  uinc = umax / (nx2 / 2);
+  vinc = vmax / (ny2 / 2);
+
+  // Cell and fractional offset bin of each visibility.
+  cells = (purify_visibility_cell*)malloc(vis->nmeas 
+					  * sizeof(purify_visibility_cell));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(cells);
+  for (i = 0; i < vis->nmeas; i++) {
+    ufrc = vis->u[i] / uinc;
+    vfrc = vis->v[i] / vinc;
+    cells[i].iu = floor(ufrc + 0.5);
+    cells[i].iv = floor(vfrc + 0.5);
+    cells[i].sub = 
+      purify_min(nsub - 1, (int)((ufrc - cells[i].iu + 0.5) * nsub)) * nsub
+      + purify_min(nsub - 1, (int)((vfrc - cells[i].iv + 0.5) * nsub));
+    cells[i].ind = i;
+    // Periodic grid, as in purify_measurement_init_cft.
+    if (cells[i].iu < 0) cells[i].iu += nx2;
+    if (cells[i].iu >= nx2) cells[i].iu -= nx2;
+    if (cells[i].iv < 0) cells[i].iv += ny2;
+    if (cells[i].iv >= ny2) cells[i].iv -= ny2;
+  }
+  qsort(cells, vis->nmeas, sizeof(purify_visibility_cell), 
+	purify_visibility_compare_cells);
+
+  // Count merged visibilities.
+  n = 0;
+  for (i = 0; i < vis->nmeas; i++)
+    if (i == 0 || purify_visibility_compare_cells(&cells[i-1], &cells[i]))
+      n++;
+
+  purify_visibility_alloc(coal, n);
+  if (count != NULL) {
+    *count = (int*)calloc(n, sizeof(int));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(*count);
   }
 
-  // Read file to count number of visibilities to read.
-  nvis = 0;
-  while(fgets(buffer, PURIFY_STRLEN, file) != NULL) {
-    nvis++;
-    //puts(buffer);
+  // Noise weighted averages. Coordinates are averaged in the period
+  // of the first visibility of the cell, so that cells on the edge of
+  // the grid merge visibilities from both ends of the uv plane.
+  k = -1;
+  wsum = 0.0;
+  u0 = 0.0;
+  v0 = 0.0;
+  for (i = 0; i < vis->nmeas; i++) {
+    if (i == 0 || purify_visibility_compare_cells(&cells[i-1], &cells[i])) {
+      if (k >= 0)
+	coal->noise_std[k] = wsum;
+      k++;
+      wsum = 0.0;
+      u0 = vis->u[cells[i].ind];
+      v0 = vis->v[cells[i].ind];
+    }
+    uk = vis->u[cells[i].ind];
+    vk = vis->v[cells[i].ind];
+    uk -= 2.0 * umax * floor((uk - u0) / (2.0 * umax) + 0.5);
+    vk -= 2.0 * vmax * floor((vk - v0) / (2.0 * vmax) + 0.5);
+    wk = cabs(vis->noise_std[cells[i].ind]);
+    wk = wk > 0.0 ? 1.0 / (wk * wk) : 1.0;
+    wsum += wk;
+    coal->u[k] += wk * uk;
+    coal->v[k] += wk * vk;
+    coal->w[k] += wk * vis->w[cells[i].ind];
+    coal->y[k] += wk * vis->y[cells[i].ind];
+    if (count != NULL)
+      (*count)[k]++;
+  }
+  if (k >= 0)
+    coal->noise_std[k] = wsum;
+
+  for (k = 0; k < n; k++) {
+    wsum = creal(coal->noise_std[k]);
+    coal->u[k] /= wsum;
+    coal->v[k] /= wsum;
+    coal->w[k] /= wsum;
+    coal->y[k] /= wsum;
+    coal->noise_std[k] = 1.0 / sqrt(wsum);
   }
 
-  // Allocate space for visibilities.
-  purify_visibility_alloc(vis, nvis);
+  free(cells);
 
-  // Read visibilities.
-  rewind(file);
-  switch (filetype) {
-    case PURIFY_VISIBILITY_FILETYPE_UV:
-        i = 0;
-        while(fgets(buffer, PURIFY_STRLEN, file) != NULL) {
-        tok = strtok(buffer, delimiters);
-        itok = 0;
-        while (tok != NULL) {
-    	switch (itok) {
-	        case 0:
-	        vis->u[i] = atof(tok);
-	        break;
-	        case 1:
-	        vis->v[i] = atof(tok);
-	        break;
-	        case 2:
-	        vis->w[i] = atof(tok);
-	        break;
-	        case 3:
-	        vis->y[i] = atof(tok);
-	        break;
-	        case 4:
-	        vis->y[i] += I * atof(tok);
-	        break;
-	        case 5:
-	        vis->noise_std[i] = atof(tok);
-	        break;
-	        default:
-	        break;
-	    } // switch
-	    itok++;
-	    tok = strtok(NULL, delimiters);
-        } // while
-        i++;
+}
+
+
+/*!
+ * Compute imaging weights of the visibilities from the density of
+ * natural weights \f$w_k = 1/\sigma_k^2\f$ on the oversampled grid.
+ * The density \f$D_c = \sum_{k \in c} w_k\f$ of each grid cell is
+ * accumulated in parallel with a histogram per thread. The weights are
+ * \f$w_k\f$ (natural), \f$w_k/D_c\f$ (uniform) or \f$w_k/(1 + D_c
+ * f^2)\f$ (Briggs), with \f$f^2 = (5 \cdot 10^{-R})^2 \sum_k w_k /
+ * \sum_k w_k D_{c(k)}\f$ for robustness R.
+ * 
+ * \param[out] weights Weight of each visibility (memory must be
+ * allocated by the calling routine). The operators are weighted by
+ * scaling the rows of the gridding matrix, and the measurements, by
+ * the square root of the weights once (see
+ * purify_sparsemat_scalerows).
+ * \param[in] vis Visibilities.
+ * \param[in] umax Maximum u frequency of the operator.
+ * \param[in] vmax Maximum v frequency of the operator.
+ * \param[in] nx2 Size of the oversampled grid along u.
+ * \param[in] ny2 Size of the oversampled grid along v.
+ * \param[in] weighting Weighting scheme.
+ * \param[in] robust Robustness R of Briggs weighting (-2 is close to
+ * uniform and 2 close to natural weighting).
+ *
+ * \note Visibilities with zero noise standard deviation are given unit
+ * natural weight, and those with infinite noise standard deviation
+ * (flagged) zero weight.
+ */
+void purify_visibility_weights(double *weights,
+			       purify_visibility *vis,
+			       double umax, double vmax,
+			       int nx2, int ny2,
+			       purify_visibility_weighting weighting,
+			       double robust) {
+
+  int i, t, tt, nthreads, ncells, *cell;
+  double uinc, vinc, wk, sumw, sumwd, f2;
+  double *hist;
+
+  // Natural weights.
+  for (i = 0; i < vis->nmeas; i++) {
+    wk = cabs(vis->noise_std[i]);
+    weights[i] = wk > 0.0 ? 1.0 / (wk * wk) : 1.0;
+  }
+  if (weighting == PURIFY_VISIBILITY_WEIGHTING_NATURAL)
+    return;
+
+  uinc = umax / (nx2 / 2);
+  vinc = vmax / (ny2 / 2);
+  ncells = nx2 * ny2;
+  #ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+  #else
+    nthreads = 1;
+  #endif
+
+  // Grid cell of each visibility, wrapped as in the gridding matrix.
+  cell = (int*)malloc(vis->nmeas * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(cell);
+  hist = (double*)calloc((size_t)nthreads * ncells, sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(hist);
+
+  #pragma omp parallel private(i, t, tt)
+  {
+    #ifdef _OPENMP
+      t = omp_get_thread_num();
+    #else
+      t = 0;
+    #endif
+    #pragma omp for
+    for (i = 0; i < vis->nmeas; i++) {
+      cell[i] = purify_visibility_cellind(vis->u[i], vis->v[i], 
+					  uinc, vinc, nx2, ny2);
+      hist[(size_t)t * ncells + cell[i]] += weights[i];
     }
-    break;
+    // Reduce the histograms into the first one.
+    #pragma omp for
+    for (i = 0; i < ncells; i++) {
+      for (tt = 1; tt < nthreads; tt++)
+	hist[i] += hist[(size_t)tt * ncells + i];
+    }
+  }
 
-  case PURIFY_VISIBILITY_FILETYPE_VIS:
-    i = 0;
-    while(fgets(buffer, PURIFY_STRLEN, file) != NULL) {
-      tok = strtok(buffer, delimiters);
-      itok = 0;
-      while (tok != NULL) {
-	switch (itok) {
-	case 0:
-	  // dummy
-	  break;
-	case 1:
-	  vis->u[i] = atof(tok);
-	  break;
-	case 2:
-	  vis->v[i] = atof(tok);
-	  break;
-	case 3:
-	  vis->w[i] = atof(tok);
-	  break;
-	case 4:
-	  vis->y[i] = atof(tok);
-	  break;
-	case 5:
-	  vis->y[i] += I * atof(tok);
-	  break;
-	case 6:
-	  vis->noise_std[i] = atof(tok);
-	  break;
-	case 7:
-	  vis->noise_std[i] = I * atof(tok);
-	  break;
-	default:
-	  break;
+  // Cells holding only zero weights (infinite noise) have no density.
+  if (weighting == PURIFY_VISIBILITY_WEIGHTING_UNIFORM) {
+    for (i = 0; i < vis->nmeas; i++)
+      weights[i] = hist[cell[i]] > 0.0 ? weights[i] / hist[cell[i]] : 0.0;
+  }
+  else {
+    sumw = 0.0;
+    sumwd = 0.0;
+    for (i = 0; i < vis->nmeas; i++) {
+      sumw += weights[i];
+      sumwd += weights[i] * hist[cell[i]];
+    }
+    f2 = sumwd > 0.0 ? 
+      pow(5.0 * pow(10.0, -robust), 2) * sumw / sumwd : 0.0;
+    for (i = 0; i < vis->nmeas; i++)
+      weights[i] /= 1.0 + hist[cell[i]] * f2;
+  }
+
+  free(cell);
+  free(hist);
+
+}
+
+
+/*!
+ * Build a bucketed index of the visibilities over a regular grid of
+ * cells in the uv plane. The visibilities are counted per cell with a
+ * histogram per thread and then scattered in parallel, so each cell
+ * lists its visibilities in increasing order. Visibilities outside the
+ * box are assigned to the nearest cell on its border.
+ *
+ * \param[out] index Index (memory allocated here and freed with
+ * purify_visibility_free_index).
+ * \param[in] vis Visibilities.
+ * \param[in] umin Lower u bound of the box.
+ * \param[in] umax Upper u bound of the box.
+ * \param[in] vmin Lower v bound of the box.
+ * \param[in] vmax Upper v bound of the box.
+ * \param[in] nu Number of cells along u.
+ * \param[in] nv Number of cells along v.
+ *
+ * \note If umin >= umax (vmin >= vmax) the u (v) extent of the
+ * visibilities is used. Cells aligned with tiles of the oversampled
+ * grid are obtained with the box [-umax, umax) x [-vmax, vmax) and nu
+ * (nv) dividing nx2 (ny2).
+ */
+void purify_visibility_init_index(purify_visibility_index *index,
+				  purify_visibility *vis,
+				  double umin, double umax,
+				  double vmin, double vmax,
+				  int nu, int nv) {
+
+  int i, c, t, nt, ntr, ncells, start, end, *cell, *pos;
+  double u0, u1, v0, v1;
+
+  if (nu < 1 || nv < 1)
+    PURIFY_ERROR_GENERIC("Number of cells of the index must be positive");
+
+  // Extent of the visibilities.
+  if (umin >= umax || vmin >= vmax) {
+    u0 = v0 = DBL_MAX;
+    u1 = v1 = -DBL_MAX;
+    #pragma omp parallel for reduction(min:u0, v0) reduction(max:u1, v1)
+    for (i = 0; i < vis->nmeas; i++) {
+      u0 = purify_min(u0, vis->u[i]);
+      u1 = purify_max(u1, vis->u[i]);
+      v0 = purify_min(v0, vis->v[i]);
+      v1 = purify_max(v1, vis->v[i]);
+    }
+    if (umin >= umax) {
+      umin = u0;
+      umax = u1 > u0 ? u1 : u0 + 1.0;
+    }
+    if (vmin >= vmax) {
+      vmin = v0;
+      vmax = v1 > v0 ? v1 : v0 + 1.0;
+    }
+  }
+
+  index->nu = nu;
+  index->nv = nv;
+  index->umin = umin;
+  index->vmin = vmin;
+  index->du = (umax - umin) / nu;
+  index->dv = (vmax - vmin) / nv;
+  index->nmeas = vis->nmeas;
+  ncells = nu * nv;
+
+  #ifdef _OPENMP
+    nt = omp_get_max_threads();
+  #else
+    nt = 1;
+  #endif
+  cell = (int*)malloc(vis->nmeas * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(cell);
+  pos = (int*)calloc((size_t)nt * ncells, sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(pos);
+  index->offset = (int*)malloc((ncells + 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(index->offset);
+  index->ind = (int*)malloc(vis->nmeas * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(index->ind);
+
+  // Each thread counts, and later scatters, a contiguous range of
+  // visibilities so the order within a cell is kept.
+  #pragma omp parallel private(i, c, t, ntr, start, end)
+  {
+    #ifdef _OPENMP
+      t = omp_get_thread_num();
+      ntr = omp_get_num_threads();
+    #else
+      t = 0;
+      ntr = 1;
+    #endif
+    start = (long long)vis->nmeas * t / ntr;
+    end = (long long)vis->nmeas * (t + 1) / ntr;
+    for (i = start; i < end; i++) {
+      cell[i] = purify_visibility_index_cell(index, vis->u[i], vis->v[i]);
+      pos[(size_t)t * ncells + cell[i]]++;
+    }
+    #pragma omp barrier
+    #pragma omp single
+    {
+      i = 0;
+      for (c = 0; c < ncells; c++) {
+	index->offset[c] = i;
+	for (t = 0; t < nt; t++) {
+	  start = pos[(size_t)t * ncells + c];
+	  pos[(size_t)t * ncells + c] = i;
+	  i += start;
 	}
-	itok++;
-	tok = strtok(NULL, delimiters);
       }
-      i++;
+      index->offset[ncells] = i;
     }
-    break;
+    #ifdef _OPENMP
+      t = omp_get_thread_num();
+    #else
+      t = 0;
+    #endif
+    start = (long long)vis->nmeas * t / ntr;
+    end = (long long)vis->nmeas * (t + 1) / ntr;
+    for (i = start; i < end; i++)
+      index->ind[pos[(size_t)t * ncells + cell[i]]++] = i;
+  }
 
-  case PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS:
-    i = 0;
-    while(fgets(buffer, PURIFY_STRLEN, file) != NULL) {
-      tok = strtok(buffer, delimiters);
-      itok = 0;
-      while (tok != NULL) {
-	switch (itok) {
-	case 0:
-	  // dummy
-	  break;
-	case 1:
-	  vis->u[i] = atof(tok);
-	  break;
-	case 2:
-	  vis->v[i] = atof(tok);
-	  break;
-	case 3:
-	  vis->y[i] = atof(tok);
-	  break;
-	case 4:
-	  vis->y[i] += I * atof(tok);
-	  break;
-	case 5:
-	  vis->noise_std[i] = (1 + I) * atof(tok) / PURIFY_SQRT2;
-	  break;
-	default:
-	  break;
+  free(cell);
+  free(pos);
+
+}
+
+
+/*!
+ * Free the memory of a visibility index.
+ *
+ * \param[in,out] index Index.
+ */
+void purify_visibility_free_index(purify_visibility_index *index) {
+
+  free(index->offset);
+  free(index->ind);
+  index->offset = NULL;
+  index->ind = NULL;
+  index->nmeas = 0;
+
+}
+
+
+/*!
+ * Cell of the index containing a point of the uv plane, clamped to the
+ * border of the box.
+ *
+ * \param[in] index Index.
+ * \param[in] u Fourier u coordinate.
+ * \param[in] v Fourier v coordinate.
+ * \retval cell Linear index iv * nu + iu of the cell.
+ */
+int purify_visibility_index_cell(purify_visibility_index *index,
+				 double u, double v) {
+
+  double fu, fv;
+  int iu, iv;
+
+  fu = floor((u - index->umin) / index->du);
+  fv = floor((v - index->vmin) / index->dv);
+  iu = fu < 0.0 ? 0 : (fu >= index->nu ? index->nu - 1 : (int)fu);
+  iv = fv < 0.0 ? 0 : (fv >= index->nv ? index->nv - 1 : (int)fv);
+
+  return iv * index->nu + iu;
+
+}
+
+
+/*!
+ * Visibilities of a tile (cell) of the index, to process the
+ * visibilities tile by tile.
+ *
+ * \param[out] ind Pointer to the indices of the visibilities of the
+ * tile, in increasing order (points into the index, not to be freed).
+ * \param[in] index Index.
+ * \param[in] iu Cell along u.
+ * \param[in] iv Cell along v.
+ * \retval n Number of visibilities of the tile.
+ */
+int purify_visibility_index_tile(int **ind,
+				 purify_visibility_index *index,
+				 int iu, int iv) {
+
+  int c;
+
+  c = iv * index->nu + iu;
+  *ind = index->ind + index->offset[c];
+
+  return index->offset[c+1] - index->offset[c];
+
+}
+
+
+/*!
+ * Select the visibilities in a rectangle of the uv plane,
+ * umin <= u < umax and vmin <= v < vmax. Only the cells overlapping
+ * the rectangle are visited and only the visibilities of the cells
+ * crossing its border are tested.
+ *
+ * \param[out] sel Indices of the selected visibilities, sorted by cell
+ * (memory allocated here).
+ * \param[in] index Index of the visibilities.
+ * \param[in] vis Visibilities.
+ * \param[in] umin Lower u bound.
+ * \param[in] umax Upper u bound.
+ * \param[in] vmin Lower v bound.
+ * \param[in] vmax Upper v bound.
+ * \retval n Number of selected visibilities.
+ */
+int purify_visibility_index_range(int **sel,
+				  purify_visibility_index *index,
+				  purify_visibility *vis,
+				  double umin, double umax,
+				  double vmin, double vmax) {
+
+  double region[4];
+
+  region[0] = umin;
+  region[1] = umax;
+  region[2] = vmin;
+  region[3] = vmax;
+
+  return purify_visibility_index_select(sel, index, vis, region, 0);
+
+}
+
+
+/*!
+ * Select the visibilities in an annulus of the uv plane,
+ * rmin <= sqrt(u^2 + v^2) < rmax, for example a cut on the projected
+ * baseline length. Only the cells overlapping the annulus are visited
+ * and only the visibilities of the cells crossing its border are
+ * tested.
+ *
+ * \param[out] sel Indices of the selected visibilities, sorted by cell
+ * (memory allocated here).
+ * \param[in] index Index of the visibilities.
+ * \param[in] vis Visibilities.
+ * \param[in] rmin Inner radius.
+ * \param[in] rmax Outer radius.
+ * \retval n Number of selected visibilities.
+ */
+int purify_visibility_index_annulus(int **sel,
+				    purify_visibility_index *index,
+				    purify_visibility *vis,
+				    double rmin, double rmax) {
+
+  double region[4];
+
+  region[0] = -rmax;
+  region[1] = rmax;
+  region[2] = rmin;
+  region[3] = rmax;
+
+  return purify_visibility_index_select(sel, index, vis, region, 1);
+
+}
+
+
+/*!
+ * Select the visibilities of the index in a rectangle or an annulus.
+ * The cells visited are those between the cells of the corners of the
+ * bounding box. A cell of a rectangle is taken whole if the cells of
+ * both bounds are strictly on either side of it, which is exact since
+ * the cell is a monotonic function of the coordinates. A cell of an
+ * annulus is skipped or taken whole from its extent, widened to
+ * absorb rounding.
+ *
+ * \param[out] sel Indices of the selected visibilities.
+ * \param[in] index Index.
+ * \param[in] vis Visibilities.
+ * \param[in] region Rectangle {umin, umax, vmin, vmax}, or for an
+ * annulus {-rmax, rmax, rmin, rmax}.
+ * \param[in] annulus Non-zero to select an annulus.
+ * \retval n Number of selected visibilities.
+ */
+int purify_visibility_index_select(int **sel,
+				   purify_visibility_index *index,
+				   purify_visibility *vis,
+				   double *region, int annulus) {
+
+  int iu, iv, iu0, iu1, iv0, iv1, c, i, k, n, nmax, inside;
+  double u0, u1, v0, v1, tu, tv, dmin, dmax, rmin2, rmax2, r2;
+
+  // Cells overlapping the bounding box of the region.
+  c = purify_visibility_index_cell(index, region[0], 
+				   annulus ? region[0] : region[2]);
+  iu0 = c % index->nu;
+  iv0 = c / index->nu;
+  c = purify_visibility_index_cell(index, region[1], region[3]);
+  iu1 = c % index->nu;
+  iv1 = c / index->nu;
+  rmin2 = region[2] * region[2];
+  rmax2 = region[3] * region[3];
+  tu = 1e-9 * index->du;
+  tv = 1e-9 * index->dv;
+
+  nmax = 0;
+  for (iv = iv0; iv <= iv1; iv++)
+    nmax += index->offset[iv * index->nu + iu1 + 1] 
+      - index->offset[iv * index->nu + iu0];
+  *sel = (int*)malloc(purify_max(nmax, 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(*sel);
+
+  n = 0;
+  for (iv = iv0; iv <= iv1; iv++) {
+    for (iu = iu0; iu <= iu1; iu++) {
+      c = iv * index->nu + iu;
+      if (index->offset[c] == index->offset[c+1])
+	continue;
+
+      if (annulus) {
+	// Border cells may hold visibilities outside the box.
+	u0 = iu == 0 ? -DBL_MAX : index->umin + iu * index->du - tu;
+	u1 = iu == index->nu - 1 ? DBL_MAX 
+	  : index->umin + (iu + 1) * index->du + tu;
+	v0 = iv == 0 ? -DBL_MAX : index->vmin + iv * index->dv - tv;
+	v1 = iv == index->nv - 1 ? DBL_MAX 
+	  : index->vmin + (iv + 1) * index->dv + tv;
+	dmin = pow(purify_max(purify_max(u0, -u1), 0.0), 2) 
+	  + pow(purify_max(purify_max(v0, -v1), 0.0), 2);
+	dmax = pow(purify_max(fabs(u0), fabs(u1)), 2) 
+	  + pow(purify_max(fabs(v0), fabs(v1)), 2);
+	if (dmin >= rmax2 || dmax < rmin2)
+	  continue;
+	inside = dmin >= rmin2 && dmax < rmax2;
+      }
+      else
+	inside = iu0 < iu && iu < iu1 && iv0 < iv && iv < iv1;
+
+      for (k = index->offset[c]; k < index->offset[c+1]; k++) {
+	i = index->ind[k];
+	if (!inside) {
+	  if (annulus) {
+	    r2 = vis->u[i] * vis->u[i] + vis->v[i] * vis->v[i];
+	    if (r2 < rmin2 || r2 >= rmax2)
+	      continue;
+	  }
+	  else if (vis->u[i] < region[0] || vis->u[i] >= region[1]
+		   || vis->v[i] < region[2] || vis->v[i] >= region[3])
+	    continue;
 	}
-	itok++;
-	tok = strtok(NULL, delimiters);
+	(*sel)[n++] = i;
       }
-      i++;
     }
-    break;
+  }
 
-  case PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS:
-    i = 0;
-    while(fgets(buffer, PURIFY_STRLEN, file) != NULL) {
-      tok = strtok(buffer, delimiters);
-      itok = 0;
-      while (tok != NULL) {
-	switch (itok) {
-	case 0:
-	  // dummy
-	  break;
-	case 1:
-	  vis->u[i] = atof(tok);
-	  break;
-	case 2:
-	  vis->v[i] = atof(tok);
-	  break;
-	case 3:
-	  vis->w[i] = atof(tok);
-	  break;
-	case 4:
-	  vis->y[i] = atof(tok);
-	  break;
-	case 5:
-	  vis->y[i] += I * atof(tok);
-	  break;
-	case 6:
-	  vis->noise_std[i] = (1 + I) * atof(tok) / PURIFY_SQRT2;
-	  break;
-	default:
-	  break;
-	}
-	itok++;
-	tok = strtok(NULL, delimiters);
+  return n;
+
+}
+
+
+/*!
+ * Copy of the visibilities reordered tile by tile as in the index, so
+ * that gridding a tile accesses a contiguous range of visibilities.
+ *
+ * \param[out] sorted Reordered visibilities (memory allocated here).
+ * \param[in] vis Visibilities.
+ * \param[in] index Index of the visibilities.
+ */
+void purify_visibility_index_permute(purify_visibility *sorted,
+				     purify_visibility *vis,
+				     purify_visibility_index *index) {
+
+  int k, i;
+
+  purify_visibility_alloc(sorted, vis->nmeas);
+
+  #pragma omp parallel for private(i)
+  for (k = 0; k < vis->nmeas; k++) {
+    i = index->ind[k];
+    sorted->u[k] = vis->u[i];
+    sorted->v[k] = vis->v[i];
+    sorted->w[k] = vis->w[i];
+    sorted->noise_std[k] = vis->noise_std[i];
+    sorted->y[k] = vis->y[i];
+    sorted->baseline[k] = vis->baseline[i];
+    sorted->time[k] = vis->time[i];
+  }
+
+}
+
+
+/*!
+ * Flag, and optionally drop, the visibilities that would only cost
+ * operator work or corrupt the reconstruction: rows with non-finite
+ * values, rows of zero weight and rows outside the uv grid, which
+ * would otherwise be aliased by the index wrapping of the gridding
+ * matrix. Flags are computed in a parallel vectorised pass and the
+ * kept rows are gathered in parallel into compacted arrays.
+ *
+ * \param[out] report Counts of the flagged visibilities and run time
+ * (NULL to skip).
+ * \param[out] flags Combination of purify_visibility_flag values of
+ * each visibility before compaction (NULL to skip, otherwise vis->nmeas
+ * entries allocated by the calling routine).
+ * \param[in,out] vis Visibilities, replaced by the kept ones if drop
+ * is set. A mapped file is copied into allocated arrays and unmapped.
+ * \param[in,out] weights Weights of the visibilities, rows with
+ * weights that are not positive are flagged as zero weight, compacted
+ * as the visibilities (NULL to skip).
+ * \param[in] umax Maximum u frequency of the operator, visibilities
+ * with |u| > umax are flagged as out of grid (0 to skip).
+ * \param[in] vmax Maximum v frequency of the operator (0 to skip).
+ * \param[in] drop Non-zero to drop the flagged visibilities.
+ * \retval n Number of visibilities not flagged.
+ *
+ * \note Rows with infinite noise standard deviation have zero natural
+ * weight and are flagged as zero weight.
+ */
+int purify_visibility_filter(purify_visibility_filterreport *report,
+			     unsigned char *flags,
+			     purify_visibility *vis,
+			     double *weights,
+			     double umax, double vmax,
+			     int drop) {
+
+  int i, k, t, nt, ntr, start, end, n, nnonfinite, nzeroweight;
+  int noutofgrid, *keep, *pos;
+  unsigned char *flag;
+  double *u, *v, *w, *tmp, ulim, vlim, t0;
+  complex double *y, *noise;
+  purify_visibility kept;
+
+  t0 = purify_visibility_time();
+  flag = flags;
+  if (flag == NULL) {
+    flag = (unsigned char*)malloc(purify_max(vis->nmeas, 1));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(flag);
+  }
+  ulim = umax > 0.0 ? umax : DBL_MAX;
+  vlim = vmax > 0.0 ? vmax : DBL_MAX;
+
+  // Flags. Comparisons with DBL_MAX are false for NaN and infinity
+  // and vectorise, unlike isfinite. The arrays are read through local
+  // pointers since the flags may alias the visibility structure.
+  u = vis->u;
+  v = vis->v;
+  w = vis->w;
+  y = vis->y;
+  noise = vis->noise_std;
+  #pragma omp parallel for simd
+  for (i = 0; i < vis->nmeas; i++) {
+    flag[i] = 
+      (!(fabs(u[i]) <= DBL_MAX) | !(fabs(v[i]) <= DBL_MAX)
+       | !(fabs(w[i]) <= DBL_MAX) 
+       | !(fabs(creal(y[i])) <= DBL_MAX) 
+       | !(fabs(cimag(y[i])) <= DBL_MAX)
+       | (creal(noise[i]) != creal(noise[i]))
+       | (cimag(noise[i]) != cimag(noise[i])))
+      * PURIFY_VISIBILITY_FLAG_NONFINITE
+      | ((fabs(creal(noise[i])) > DBL_MAX)
+	 | (fabs(cimag(noise[i])) > DBL_MAX))
+      * PURIFY_VISIBILITY_FLAG_ZEROWEIGHT
+      | ((fabs(u[i]) > ulim) | (fabs(v[i]) > vlim))
+      * PURIFY_VISIBILITY_FLAG_OUTOFGRID;
+  }
+  if (weights != NULL) {
+    #pragma omp parallel for simd
+    for (i = 0; i < vis->nmeas; i++)
+      flag[i] |= !(weights[i] > 0.0) * PURIFY_VISIBILITY_FLAG_ZEROWEIGHT;
+  }
+
+  n = 0;
+  nnonfinite = 0;
+  nzeroweight = 0;
+  noutofgrid = 0;
+  #pragma omp parallel for simd \
+    reduction(+:n, nnonfinite, nzeroweight, noutofgrid)
+  for (i = 0; i < vis->nmeas; i++) {
+    n += flag[i] == 0;
+    nnonfinite += (flag[i] & PURIFY_VISIBILITY_FLAG_NONFINITE) != 0;
+    nzeroweight += (flag[i] & PURIFY_VISIBILITY_FLAG_ZEROWEIGHT) != 0;
+    noutofgrid += (flag[i] & PURIFY_VISIBILITY_FLAG_OUTOFGRID) != 0;
+  }
+  if (report != NULL) {
+    report->nmeas = vis->nmeas;
+    report->nkept = n;
+    report->nnonfinite = nnonfinite;
+    report->nzeroweight = nzeroweight;
+    report->noutofgrid = noutofgrid;
+  }
+
+  if (drop && n < vis->nmeas) {
+
+    // Indices of the kept rows, each thread scanning a contiguous
+    // range of rows.
+    #ifdef _OPENMP
+      nt = omp_get_max_threads();
+    #else
+      nt = 1;
+    #endif
+    keep = (int*)malloc(purify_max(n, 1) * sizeof(int));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(keep);
+    pos = (int*)calloc(nt + 1, sizeof(int));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(pos);
+    #pragma omp parallel private(i, k, t, ntr, start, end)
+    {
+      #ifdef _OPENMP
+        t = omp_get_thread_num();
+        ntr = omp_get_num_threads();
+      #else
+        t = 0;
+        ntr = 1;
+      #endif
+      start = (long long)vis->nmeas * t / ntr;
+      end = (long long)vis->nmeas * (t + 1) / ntr;
+      k = 0;
+      for (i = start; i < end; i++)
+	k += flag[i] == 0;
+      pos[t+1] = k;
+      #pragma omp barrier
+      #pragma omp single
+      {
+	for (k = 0; k < nt; k++)
+	  pos[k+1] += pos[k];
       }
-      i++;
+      k = pos[t];
+      for (i = start; i < end; i++)
+	if (flag[i] == 0)
+	  keep[k++] = i;
+    }
+
+    purify_visibility_alloc(&kept, n);
+    #pragma omp parallel for private(i)
+    for (k = 0; k < n; k++) {
+      i = keep[k];
+      kept.u[k] = vis->u[i];
+      kept.v[k] = vis->v[i];
+      kept.w[k] = vis->w[i];
+      kept.noise_std[k] = vis->noise_std[i];
+      kept.y[k] = vis->y[i];
+      kept.baseline[k] = vis->baseline[i];
+      kept.time[k] = vis->time[i];
+    }
+    purify_visibility_free(vis);
+    *vis = kept;
+
+    if (weights != NULL) {
+      tmp = (double*)malloc(purify_max(n, 1) * sizeof(double));
+      PURIFY_ERROR_MEM_ALLOC_CHECK(tmp);
+      #pragma omp parallel for
+      for (k = 0; k < n; k++)
+	tmp[k] = weights[keep[k]];
+      memcpy(weights, tmp, n * sizeof(double));
+      free(tmp);
     }
-    break;
-    
-  default:
-    sprintf(buffer, 
-	    "Visibility filetype with id %d is not supported", 
-	    filetype);
-    PURIFY_ERROR_GENERIC(buffer);
-    break;
 
+    free(keep);
+    free(pos);
   }
 
-  // Close file.
-  fclose(file);
+  if (flags == NULL)
+    free(flag);
+  if (report != NULL)
+    report->time = purify_visibility_time() - t0;
+
+  return n;
+
+}
+
+
+/*!
+ * Order visibility cells by v index, u index and fractional offset
+ * bin (comparison function for qsort).
+ */
+int purify_visibility_compare_cells(const void *a, const void *b) {
 
+  const purify_visibility_cell *ca = (const purify_visibility_cell*)a;
+  const purify_visibility_cell *cb = (const purify_visibility_cell*)b;
+
+  if (ca->iv != cb->iv) return ca->iv < cb->iv ? -1 : 1;
+  if (ca->iu != cb->iu) return ca->iu < cb->iu ? -1 : 1;
+  if (ca->sub != cb->sub) return ca->sub < cb->sub ? -1 : 1;
   return 0;
 
 }
 
 
 /*!
- * Write continuous visibilities to file.
+ * Average visibilities along the uv track of each baseline to reduce
+ * the number of visibilities before imaging. Consecutive samples of a
+ * baseline are merged as long as their separation in the uv plane
+ * stays below the distance at which the amplitude of a source at
+ * distance lmax from the phase centre is attenuated by maxloss, i.e.
+ * \f$1 - \mathrm{sinc}(\pi \Delta u \, l_{\rm max}) \le\f$ maxloss.
+ * Long baselines, which move faster in the uv plane, are therefore
+ * averaged over shorter time intervals than short baselines. Averages
+ * are noise weighted as in purify_visibility_coalesce.
  * 
- * \param[in] vis Visibilities to write to the file.
- * \param[in] filename Name of the file to write.
- * \param[in] filetype Type of file to write.
- * \retval error Zero return indicates no errors.
+ * \param[out] avg Averaged visibilities. The time of an averaged
+ * visibility is the weighted average time of its samples.
+ * \param[in] vis Original visibilities. Visibilities with unknown
+ * baseline (-1) are copied unchanged.
+ * \param[in] maxloss Maximum smearing loss of amplitude (0 < maxloss
+ * < 1).
+ * \param[in] lmax Largest distance from the phase centre (in radians)
+ * for which the smearing loss is bounded, e.g. half the field of view.
+ * \retval ratio Compression ratio (number of original over number of
+ * averaged visibilities).
  *
- * \authors <a href="http://www.jasonmcewen.org">Jason McEwen</a>
+ * \note Memory for avg is allocated herein and must be freed by the
+ * calling routine.
  */
-int purify_visibility_writefile(purify_visibility *vis, 
-				const char *filename, 
-				purify_visibility_filetype filetype) {
+double purify_visibility_average(purify_visibility *avg,
+				 purify_visibility *vis,
+				 double maxloss, double lmax) {
+
+  int i, b, nb, n;
+  int *first, *offset;
+  double lo, hi, x, maxdist;
+  purify_visibility_sample *samples;
+
+  // Largest uv separation within an average, solving
+  // 1 - sin(x)/x = maxloss for x = pi du lmax by bisection.
+  lo = 0.0;
+  hi = PURIFY_PI;
+  for (i = 0; i < 60; i++) {
+    x = 0.5 * (lo + hi);
+    if (1.0 - sin(x) / x > maxloss) hi = x;
+    else lo = x;
+  }
+  maxdist = lo / (PURIFY_PI * lmax);
 
+  // Order samples along the track of each baseline.
+  samples = (purify_visibility_sample*)malloc(vis->nmeas 
+			    * sizeof(purify_visibility_sample));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(samples);
+  for (i = 0; i < vis->nmeas; i++) {
+    samples[i].baseline = vis->baseline[i];
+    samples[i].time = vis->time[i];
+    samples[i].ind = i;
+  }
+  qsort(samples, vis->nmeas, sizeof(purify_visibility_sample), 
+	purify_visibility_compare_samples);
+
+  // First sample of each track. Samples of unknown baseline are
+  // tracks of their own.
+  first = (int*)malloc((vis->nmeas + 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(first);
+  nb = 0;
+  for (i = 0; i < vis->nmeas; i++)
+    if (i == 0 || samples[i].baseline < 0 
+	|| samples[i].baseline != samples[i-1].baseline)
+      first[nb++] = i;
+  first[nb] = vis->nmeas;
+
+  // Count averages per track, then average into the offsets.
+  offset = (int*)malloc((nb + 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(offset);
+  #pragma omp parallel for schedule(dynamic)
+  for (b = 0; b < nb; b++)
+    offset[b + 1] = purify_visibility_average_track(NULL, 0, vis, 
+		      samples, first[b], first[b + 1], maxdist);
+  offset[0] = 0;
+  for (b = 0; b < nb; b++)
+    offset[b + 1] += offset[b];
+  n = offset[nb];
+
+  purify_visibility_alloc(avg, n);
+  #pragma omp parallel for schedule(dynamic)
+  for (b = 0; b < nb; b++)
+    purify_visibility_average_track(avg, offset[b], vis, samples, 
+				    first[b], first[b + 1], maxdist);
+
+  free(samples);
+  free(first);
+  free(offset);
+
+  return n > 0 ? (double)vis->nmeas / (double)n : 1.0;
 
-  FILE *file;
-  char buffer[PURIFY_STRLEN];
-  int i;
+}
 
-  // Open file.
-  file = fopen(filename, "w");
-  if (file == NULL) {
-    sprintf(buffer, "Failed to create file %s", filename);
-    PURIFY_ERROR_GENERIC(buffer);
+
+/*!
+ * Average the samples [start, end) of the track of a single baseline
+ * into avg, starting at index k.
+ *
+ * \param[out] avg Averaged visibilities (only counted if NULL).
+ * \param[in] k Index of the first average in avg.
+ * \param[in] vis Original visibilities.
+ * \param[in] samples Samples ordered by baseline and time.
+ * \param[in] start First sample of the track.
+ * \param[in] end One past the last sample of the track.
+ * \param[in] maxdist Largest uv distance from the first sample of an
+ * average.
+ * \retval n Number of averages of the track.
+ */
+int purify_visibility_average_track(purify_visibility *avg, int k,
+				    purify_visibility *vis,
+				    purify_visibility_sample *samples,
+				    int start, int end, double maxdist) {
+
+  int i, j, i0, n = 0;
+  double du, dv, wk, wsum;
+
+  i = start;
+  while (i < end) {
+    i0 = samples[i].ind;
+    wsum = 0.0;
+    do {
+      j = samples[i].ind;
+      if (avg != NULL) {
+	wk = cabs(vis->noise_std[j]);
+	wk = wk > 0.0 ? 1.0 / (wk * wk) : 1.0;
+	wsum += wk;
+	avg->u[k] += wk * vis->u[j];
+	avg->v[k] += wk * vis->v[j];
+	avg->w[k] += wk * vis->w[j];
+	avg->y[k] += wk * vis->y[j];
+	avg->time[k] += wk * vis->time[j];
+      }
+      i++;
+      if (i >= end || samples[i].baseline < 0)
+	break;
+      du = vis->u[samples[i].ind] - vis->u[i0];
+      dv = vis->v[samples[i].ind] - vis->v[i0];
+    } while (sqrt(du*du + dv*dv) <= maxdist);
+
+    if (avg != NULL) {
+      avg->u[k] /= wsum;
+      avg->v[k] /= wsum;
+      avg->w[k] /= wsum;
+      avg->y[k] /= wsum;
+      avg->time[k] /= wsum;
+      avg->noise_std[k] = 1.0 / sqrt(wsum);
+      avg->baseline[k] = vis->baseline[i0];
+      k++;
+    }
+    n++;
   }
 
-  // Write file.
-  switch (filetype) {
+  return n;
 
-  case PURIFY_VISIBILITY_FILETYPE_VIS:
-    for (i = 0; i < vis->nmeas; i++)
-      fprintf(file, " %d %.10f %.10f %.10f %.10e %.10e %.10e %.10e\n", 
-	      i+1, 
-	      vis->u[i], vis->v[i], vis->w[i],
-	      creal(vis->y[i]), cimag(vis->y[i]), 
-	      creal(vis->noise_std[i]), cimag(vis->noise_std[i])) ;
-    break;
+}
 
-  case PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS:
-    for (i = 0; i < vis->nmeas; i++)
-      fprintf(file, " %d %.4f %.4f %.7e %.7e %.7e\n", 
-	      i+1, 
-	      vis->u[i], vis->v[i], 
-	      creal(vis->y[i]), cimag(vis->y[i]), 
-	      cabs(vis->noise_std[i]));
-    break;
 
-  case PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS:
-    for (i = 0; i < vis->nmeas; i++)
-      fprintf(file, " %d %.4f %.4f %.4f %.7e %.7e %.7e\n", 
-	      i+1, 
-	      vis->u[i], vis->v[i], vis->w[i],
-	      creal(vis->y[i]), cimag(vis->y[i]), 
-	      cabs(vis->noise_std[i]));
-    break;
+/*!
+ * Order visibility samples by baseline, time and index (comparison
+ * function for qsort).
+ */
+int purify_visibility_compare_samples(const void *a, const void *b) {
 
-  default:
-    sprintf(buffer, 
-	    "Visibility filetype with id %d is not supported", 
-	    filetype);
-    PURIFY_ERROR_GENERIC(buffer);
+  const purify_visibility_sample *sa = (const purify_visibility_sample*)a;
+  const purify_visibility_sample *sb = (const purify_visibility_sample*)b;
 
-    break;
+  if (sa->baseline != sb->baseline) 
+    return sa->baseline < sb->baseline ? -1 : 1;
+  if (sa->time != sb->time) return sa->time < sb->time ? -1 : 1;
+  if (sa->ind != sb->ind) return sa->ind < sb->ind ? -1 : 1;
+  return 0;
+
+}
+
+
+#ifdef PURIFY_MPI
+/*!
+ * Partition visibilities held by one rank in contiguous blocks of
+ * nearly equal size across the ranks of a communicator.
+ * 
+ * \param[out] local Block of visibilities of the calling rank
+ * (memory is allocated herein and must be freed by the calling
+ * routine).
+ * \param[in] vis Visibilities to partition (only referenced on root).
+ * \param[in] root Rank holding the visibilities.
+ * \param[in] comm Communicator.
+ */
+void purify_visibility_mpi_scatter(purify_visibility *local,
+				   purify_visibility *vis,
+				   int root, MPI_Comm comm) {
+
+  int r, rank, nprocs, nmeas;
+  int *counts, *displs;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nprocs);
+  if (rank == root)
+    nmeas = vis->nmeas;
+  MPI_Bcast(&nmeas, 1, MPI_INT, root, comm);
+
+  counts = (int*)malloc(nprocs * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(counts);
+  displs = (int*)malloc(nprocs * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(displs);
+  for (r = 0; r < nprocs; r++) {
+    counts[r] = nmeas / nprocs + (r < nmeas % nprocs ? 1 : 0);
+    displs[r] = r == 0 ? 0 : displs[r-1] + counts[r-1];
   }
+  purify_visibility_alloc(local, counts[rank]);
+
+  MPI_Scatterv(rank == root ? vis->u : NULL, counts, displs, MPI_DOUBLE,
+	       local->u, counts[rank], MPI_DOUBLE, root, comm);
+  MPI_Scatterv(rank == root ? vis->v : NULL, counts, displs, MPI_DOUBLE,
+	       local->v, counts[rank], MPI_DOUBLE, root, comm);
+  MPI_Scatterv(rank == root ? vis->w : NULL, counts, displs, MPI_DOUBLE,
+	       local->w, counts[rank], MPI_DOUBLE, root, comm);
+  MPI_Scatterv(rank == root ? vis->time : NULL, counts, displs, MPI_DOUBLE,
+	       local->time, counts[rank], MPI_DOUBLE, root, comm);
+  MPI_Scatterv(rank == root ? vis->baseline : NULL, counts, displs, MPI_INT,
+	       local->baseline, counts[rank], MPI_INT, root, comm);
+
+  // Complex arrays as pairs of doubles.
+  for (r = 0; r < nprocs; r++) {
+    counts[r] *= 2;
+    displs[r] *= 2;
+  }
+  MPI_Scatterv(rank == root ? (double*)vis->y : NULL, counts, displs, 
+	       MPI_DOUBLE, (double*)local->y, counts[rank], MPI_DOUBLE, 
+	       root, comm);
+  MPI_Scatterv(rank == root ? (double*)vis->noise_std : NULL, counts, 
+	       displs, MPI_DOUBLE, (double*)local->noise_std, counts[rank], 
+	       MPI_DOUBLE, root, comm);
 
-  // Close file.
-  fclose(file);
+  free(counts);
+  free(displs);
 
-  return 0;
+}
+#endif
+
+
+/*!
+ * Read continuous visibilities from file (see \ref
+ * purify_visibility_mapfile and, for binary files, \ref
+ * purify_visibility_mapbin, with copy-on-write arrays, \ref
+ * purify_visibility_readz and \ref purify_visibility_readuvfits).
+ *
+ * \param[out] vis Visibilities read from the file.
+ * \param[in] filename Name of the file to read.
+ * \param[in] filetype Type of file to read.
+ * \retval error Zero return indicates no errors.
+ *
+ * \note Memory for the visibilities is allocated herein and must be
+ * freed by the calling routine (note space for measurements is also
+ * allocated).
+ * 
+ * \authors <a href="http://www.jasonmcewen.org">Jason McEwen</a>
+ */
+int purify_visibility_readfile(purify_visibility *vis, 
+			       const char *filename, 
+			       purify_visibility_filetype filetype) {
+
+  if (filetype == PURIFY_VISIBILITY_FILETYPE_BIN)
+    return purify_visibility_mapbin(vis, filename, 1);
+  if (filetype == PURIFY_VISIBILITY_FILETYPE_ZVIS)
+    return purify_visibility_readz(vis, filename);
+  if (filetype == PURIFY_VISIBILITY_FILETYPE_UVFITS)
+    return purify_visibility_readuvfits(vis, filename);
+
+  return purify_visibility_mapfile(vis, filename, filetype, NULL);
+
+}
+
+
+/*!
+ * Read continuous visibilities from a memory-mapped file. The file is
+ * split on line boundaries into one chunk per thread; each thread
+ * counts the lines of its chunk and, once the offsets are known,
+ * parses them directly into the visibility arrays. The values are
+ * identical to those obtained with atof on every line.
+ *
+ * \param[out] vis Visibilities read from the file.
+ * \param[in] filename Name of the file to read.
+ * \param[in] filetype Type of file to read.
+ * \param[out] throughput Parsing throughput in MB/s (ignored if NULL).
+ * \retval error Zero return indicates no errors.
+ *
+ * \note Memory for the visibilities is allocated herein and must be
+ * freed by the calling routine.
+ */
+int purify_visibility_mapfile(purify_visibility *vis, 
+			      const char *filename, 
+			      purify_visibility_filetype filetype,
+			      double *throughput) {
+
+  char buffer[PURIFY_STRLEN];
+  int fd, t, nthreads;
+  int *first;
+  size_t size, pos;
+  size_t *start;
+  char *data, *q;
+  struct stat st;
+  double t0, elapsed;
+
+  t0 = purify_visibility_time();
+
+  // Map file.
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    sprintf(buffer, "Failed to open file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  if (fstat(fd, &st) != 0) {
+    sprintf(buffer, "Failed to stat file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  size = (size_t)st.st_size;
+  data = NULL;
+  if (size > 0) {
+    data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      sprintf(buffer, "Failed to map file %s", filename);
+      PURIFY_ERROR_GENERIC(buffer);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  // Split the file on line boundaries.
+  nthreads = 1;
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  start = (size_t*)malloc((nthreads + 1) * sizeof(size_t));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(start);
+  first = (int*)malloc((nthreads + 1) * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(first);
+  start[0] = 0;
+  start[nthreads] = size;
+  for (t = 1; t < nthreads; t++) {
+    pos = size / nthreads * t;
+    if (pos < start[t-1]) pos = start[t-1];
+    if (pos > 0) {
+      q = (char*)memchr(data + pos - 1, '\n', size - pos + 1);
+      pos = q != NULL ? (size_t)(q - data) + 1 : size;
+    }
+    start[t] = pos;
+  }
+
+  // Count the visibilities of each chunk.
+  first[0] = 0;
+  #pragma omp parallel for schedule(static, 1)
+  for (t = 0; t < nthreads; t++)
+    first[t+1] = purify_visibility_countlines(data + start[t], 
+					      data + start[t+1]);
+  for (t = 0; t < nthreads; t++)
+    first[t+1] += first[t];
+
+  // Allocate space for visibilities.
+  purify_visibility_alloc(vis, first[nthreads]);
+
+  // Parse visibilities.
+  #pragma omp parallel for schedule(static, 1)
+  for (t = 0; t < nthreads; t++)
+    purify_visibility_parsechunk(vis, first[t], data + start[t], 
+				 data + start[t+1], filetype);
+
+  if (size > 0)
+    munmap(data, size);
+  free(start);
+  free(first);
+
+  elapsed = purify_visibility_time() - t0;
+  if (throughput != NULL)
+    *throughput = elapsed > 0.0 ? size / 1.0e6 / elapsed : 0.0;
+
+  return 0;
+
+}
+
+
+/*!
+ * Load visibilities from a binary visibility file without copying
+ * them: the arrays of the visibility object point into a mapping of
+ * the file, so the load time does not depend on the number of
+ * visibilities. With writable set the mapping is private and pages
+ * are copied when first written to; otherwise it is read-only and any
+ * write to the arrays is a segmentation fault.
+ *
+ * \param[out] vis Visibilities mapped from the file.
+ * \param[in] filename Name of the file to map.
+ * \param[in] writable Map the arrays copy-on-write (1) or read-only (0).
+ * \retval error Zero return indicates no errors.
+ *
+ * \note The mapping is released by \ref purify_visibility_free.
+ */
+int purify_visibility_mapbin(purify_visibility *vis, 
+			     const char *filename, 
+			     int writable) {
+
+  char buffer[PURIFY_STRLEN];
+  int fd;
+  size_t size;
+  char *data;
+  purify_visibility_binheader header;
+
+  // Open file and check its header.
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    sprintf(buffer, "Failed to open file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  size = purify_visibility_readbinheader(&header, fd, filename);
+  if (header.nmeas > INT_MAX) {
+    sprintf(buffer, "Binary visibility file %s has too many visibilities "
+	    "to load at once", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Map file.
+  if (writable)
+    data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, 
+		       fd, 0);
+  else
+    data = (char*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    sprintf(buffer, "Failed to map file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  close(fd);
+
+  vis->nmeas = (int)header.nmeas;
+  vis->u = (double*)(data + header.offset[0]);
+  vis->v = (double*)(data + header.offset[1]);
+  vis->w = (double*)(data + header.offset[2]);
+  vis->y = (complex double*)(data + header.offset[3]);
+  vis->noise_std = (complex double*)(data + header.offset[4]);
+  vis->baseline = (int*)(data + header.offset[5]);
+  vis->time = (double*)(data + header.offset[6]);
+  vis->map = (void*)data;
+  vis->maplen = size;
+
+  return 0;
+
+}
+
+
+/*!
+ * Read and check the header of a binary visibility file.
+ *
+ * \param[out] header Header of the file.
+ * \param[in] fd Descriptor of the open file.
+ * \param[in] filename Name of the file (for error messages).
+ * \retval size Size of the file in bytes.
+ */
+size_t purify_visibility_readbinheader(purify_visibility_binheader *header,
+				       int fd, const char *filename) {
+
+  char buffer[PURIFY_STRLEN];
+  int k;
+  size_t size;
+  size_t colsize[PURIFY_VISIBILITY_BINNCOLS];
+  struct stat st;
+
+  if (fstat(fd, &st) != 0) {
+    sprintf(buffer, "Failed to stat file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  size = (size_t)st.st_size;
+
+  if (size < sizeof(*header) 
+      || pread(fd, header, sizeof(*header), 0) != sizeof(*header)
+      || memcmp(header->magic, PURIFY_VISIBILITY_BINMAGIC, 8) != 0) {
+    sprintf(buffer, "File %s is not a binary visibility file", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  if (header->version != PURIFY_VISIBILITY_BINVERSION 
+      || header->byteorder != 0x01020304) {
+    sprintf(buffer, 
+	    "Binary visibility file %s has an unsupported version or byte order", 
+	    filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  // The column length is compared with the space left after its offset,
+  // so a corrupted nmeas cannot overflow the check.
+  purify_visibility_bincolsize(colsize);
+  for (k = 0; k < PURIFY_VISIBILITY_BINNCOLS; k++)
+    if (header->nmeas < 0 || header->offset[k] < (long long)sizeof(*header) 
+	|| header->offset[k] % PURIFY_VISIBILITY_BINALIGN != 0
+	|| (size_t)header->offset[k] > size
+	|| (unsigned long long)header->nmeas 
+	   > (size - (size_t)header->offset[k]) / colsize[k]) {
+      sprintf(buffer, "Binary visibility file %s is truncated", filename);
+      PURIFY_ERROR_GENERIC(buffer);
+    }
+
+  return size;
+
+}
+
+
+/*!
+ * Size in bytes of the elements of the columns of a binary visibility
+ * file.
+ *
+ * \param[out] colsize Size of the elements of each column.
+ */
+void purify_visibility_bincolsize(size_t *colsize) {
+
+  colsize[0] = sizeof(double);
+  colsize[1] = sizeof(double);
+  colsize[2] = sizeof(double);
+  colsize[3] = sizeof(complex double);
+  colsize[4] = sizeof(complex double);
+  colsize[5] = sizeof(int);
+  colsize[6] = sizeof(double);
+
+}
+
+
+/*!
+ * Write visibilities to an open file in the binary visibility format.
+ *
+ * \param[in] vis Visibilities to write to the file.
+ * \param[in] file File to write, positioned at its start.
+ * \retval error Zero return indicates no errors.
+ */
+int purify_visibility_writebin(purify_visibility *vis, FILE *file) {
+
+  static const char zeros[PURIFY_VISIBILITY_BINALIGN] = {0};
+  int k;
+  long long pos;
+  size_t colsize[PURIFY_VISIBILITY_BINNCOLS];
+  const void *cols[PURIFY_VISIBILITY_BINNCOLS];
+  purify_visibility_binheader header;
+
+  cols[0] = vis->u;
+  cols[1] = vis->v;
+  cols[2] = vis->w;
+  cols[3] = vis->y;
+  cols[4] = vis->noise_std;
+  cols[5] = vis->baseline;
+  cols[6] = vis->time;
+  purify_visibility_bincolsize(colsize);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PURIFY_VISIBILITY_BINMAGIC, 8);
+  header.version = PURIFY_VISIBILITY_BINVERSION;
+  header.byteorder = 0x01020304;
+  header.nmeas = vis->nmeas;
+  pos = sizeof(header);
+  for (k = 0; k < PURIFY_VISIBILITY_BINNCOLS; k++) {
+    pos = (pos + PURIFY_VISIBILITY_BINALIGN - 1) 
+      / PURIFY_VISIBILITY_BINALIGN * PURIFY_VISIBILITY_BINALIGN;
+    header.offset[k] = pos;
+    pos += vis->nmeas * colsize[k];
+  }
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    return 1;
+  pos = sizeof(header);
+  for (k = 0; k < PURIFY_VISIBILITY_BINNCOLS; k++) {
+    if (fwrite(zeros, 1, header.offset[k] - pos, file) 
+	!= (size_t)(header.offset[k] - pos))
+      return 1;
+    if (fwrite(cols[k], colsize[k], vis->nmeas, file) 
+	!= (size_t)vis->nmeas)
+      return 1;
+    pos = header.offset[k] + vis->nmeas * colsize[k];
+  }
+
+  return 0;
+
+}
+
+
+/*!
+ * Initialise the parameters of a compressed visibility file with
+ * their defaults: the finest quantisation of the coordinates and the
+ * time, single floats for the visibilities and blocks of 65536
+ * visibilities.
+ *
+ * \param[out] zparam Parameters of the compressed file.
+ */
+void purify_visibility_init_zparam(purify_visibility_zparam *zparam) {
+
+  zparam->uvwerr = 0.0;
+  zparam->yrelerr = 1.0 / (1 << 24);
+  zparam->timeerr = 0.0;
+  zparam->blocksize = 65536;
+  zparam->level = 6;
+
+}
+
+
+/*!
+ * Write visibilities to a compressed visibility file. The blocks are
+ * encoded and deflated in parallel.
+ *
+ * \param[in] vis Visibilities to write to the file.
+ * \param[in] filename Name of the file to write.
+ * \param[in] zparam Error bounds and blocking of the file.
+ * \retval error Zero return indicates no errors.
+ */
+int purify_visibility_writez(purify_visibility *vis, 
+			     const char *filename, 
+			     purify_visibility_zparam *zparam) {
+
+  char buffer[PURIFY_STRLEN];
+  FILE *file;
+  int error;
+
+  file = fopen(filename, "wb");
+  if (file == NULL) {
+    sprintf(buffer, "Failed to create file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  error = purify_visibility_writezstream(vis, file, zparam);
+  fclose(file);
+
+  return error;
+
+}
+
+
+/*!
+ * Write visibilities to an open file in the compressed visibility
+ * format (see \ref purify_visibility_writez).
+ *
+ * \param[in] vis Visibilities to write to the file.
+ * \param[in] file File to write, positioned at its start.
+ * \param[in] zparam Error bounds and blocking of the file.
+ * \retval error Zero return indicates no errors.
+ */
+int purify_visibility_writezstream(purify_visibility *vis, FILE *file,
+				   purify_visibility_zparam *zparam) {
+
+  int b, i, k, n, nblocks, error;
+  double umax[3], tmax;
+  size_t rawcap, rawlen;
+  long long *offset;
+  uLongf *zlen;
+  unsigned char **zbuf;
+  unsigned char *raw, *tmp;
+  purify_visibility_zheader header;
+
+  // Quantisation steps.
+  umax[0] = 0.0;
+  umax[1] = 0.0;
+  umax[2] = 0.0;
+  tmax = 0.0;
+  for (i = 0; i < vis->nmeas; i++) {
+    umax[0] = fmax(umax[0], fabs(vis->u[i]));
+    umax[1] = fmax(umax[1], fabs(vis->v[i]));
+    umax[2] = fmax(umax[2], fabs(vis->w[i]));
+    tmax = fmax(tmax, fabs(vis->time[i]));
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PURIFY_VISIBILITY_ZMAGIC, 8);
+  header.version = PURIFY_VISIBILITY_ZVERSION;
+  header.byteorder = 0x01020304;
+  header.nmeas = vis->nmeas;
+  header.blocksize = zparam->blocksize;
+  header.level = zparam->level;
+  if (zparam->yrelerr >= 1.0 / (1 << 11))
+    header.yprec = 2;
+  else if (zparam->yrelerr >= 1.0 / (1 << 24))
+    header.yprec = 4;
+  else
+    header.yprec = 8;
+  for (k = 0; k < 3; k++) {
+    header.uvwstep[k] = zparam->uvwerr > 0.0 ? 2.0 * zparam->uvwerr 
+      : (umax[k] > 0.0 ? umax[k] / (PURIFY_VISIBILITY_ZQMAX - 1) : 1.0);
+    if (umax[k] / header.uvwstep[k] >= PURIFY_VISIBILITY_ZQMAX - 0.5)
+      PURIFY_ERROR_GENERIC("Error bound of u, v and w too small for 31 bits");
+  }
+  header.tstep = zparam->timeerr > 0.0 ? 2.0 * zparam->timeerr 
+    : (tmax > 0.0 ? tmax / 9007199254740992.0 : 1.0);
+  if (tmax / header.tstep >= 4.0e18)
+    PURIFY_ERROR_GENERIC("Error bound of the time too small for 63 bits");
+  nblocks = (vis->nmeas + header.blocksize - 1) / header.blocksize;
+  header.nblocks = nblocks;
+
+  // Encode and deflate the blocks.
+  rawcap = purify_visibility_zrawsize(&header, header.blocksize);
+  zbuf = (unsigned char**)malloc(nblocks * sizeof(unsigned char*));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(zbuf);
+  zlen = (uLongf*)malloc(nblocks * sizeof(uLongf));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(zlen);
+  error = 0;
+  #pragma omp parallel private(b, n, rawlen, raw, tmp)
+  {
+    raw = (unsigned char*)malloc(rawcap);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(raw);
+    tmp = (unsigned char*)malloc(rawcap);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(tmp);
+    #pragma omp for schedule(dynamic)
+    for (b = 0; b < nblocks; b++) {
+      n = purify_min(header.blocksize, vis->nmeas - b * header.blocksize);
+      rawlen = purify_visibility_zencode(raw, tmp, vis, 
+					 b * header.blocksize, n, &header);
+      zlen[b] = compressBound(rawlen);
+      zbuf[b] = (unsigned char*)malloc(zlen[b]);
+      PURIFY_ERROR_MEM_ALLOC_CHECK(zbuf[b]);
+      if (compress2(zbuf[b], &zlen[b], raw, rawlen, header.level) != Z_OK) {
+	#pragma omp atomic
+	error++;
+      }
+    }
+    free(raw);
+    free(tmp);
+  }
+
+  // Header, end offsets of the blocks and blocks.
+  offset = (long long*)malloc((nblocks + 1) * sizeof(long long));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(offset);
+  offset[0] = sizeof(header) + (nblocks + 1) * sizeof(long long);
+  for (b = 0; b < nblocks; b++)
+    offset[b+1] = offset[b] + zlen[b];
+  if (!error && fwrite(&header, sizeof(header), 1, file) != 1)
+    error = 1;
+  if (!error && fwrite(offset, sizeof(long long), nblocks + 1, file) 
+      != (size_t)(nblocks + 1))
+    error = 1;
+  for (b = 0; b < nblocks; b++) {
+    if (!error && fwrite(zbuf[b], 1, zlen[b], file) != zlen[b])
+      error = 1;
+    free(zbuf[b]);
+  }
+
+  free(zbuf);
+  free(zlen);
+  free(offset);
+
+  return error;
+
+}
+
+
+/*!
+ * Read visibilities from a compressed visibility file. The blocks are
+ * inflated and decoded in parallel directly into the visibility
+ * arrays.
+ *
+ * \param[out] vis Visibilities read from the file.
+ * \param[in] filename Name of the file to read.
+ * \retval error Zero return indicates no errors.
+ *
+ * \note Memory for the visibilities is allocated herein and must be
+ * freed by the calling routine.
+ */
+int purify_visibility_readz(purify_visibility *vis, 
+			    const char *filename) {
+
+  char buffer[PURIFY_STRLEN];
+  int fd, b, n, error;
+  size_t size, rawcap;
+  uLongf rawlen;
+  unsigned char *data, *raw, *tmp;
+  long long *offset;
+  struct stat st;
+  purify_visibility_zheader header;
+
+  // Map file and check its header.
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    sprintf(buffer, "Failed to open file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  if (fstat(fd, &st) != 0) {
+    sprintf(buffer, "Failed to stat file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  size = (size_t)st.st_size;
+  if (size < sizeof(header) 
+      || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+      || memcmp(header.magic, PURIFY_VISIBILITY_ZMAGIC, 8) != 0
+      || header.version != PURIFY_VISIBILITY_ZVERSION 
+      || header.byteorder != 0x01020304
+      || header.nmeas < 0 || header.nmeas > INT_MAX 
+      || header.blocksize <= 0
+      || header.nblocks != (header.nmeas + header.blocksize - 1) 
+      / header.blocksize
+      || size < sizeof(header) + (header.nblocks + 1) * sizeof(long long)) {
+    sprintf(buffer, "File %s is not a compressed visibility file", 
+	    filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  data = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    sprintf(buffer, "Failed to map file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  close(fd);
+  offset = (long long*)(data + sizeof(header));
+  if (offset[header.nblocks] > (long long)size) {
+    sprintf(buffer, "Compressed visibility file %s is truncated", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  // Blocks must follow the offset table in order, so that no block
+  // extends outside the mapping.
+  error = offset[0] < (long long)(sizeof(header) 
+				  + (header.nblocks + 1) * sizeof(long long));
+  for (b = 0; b < header.nblocks; b++)
+    error |= offset[b+1] < offset[b];
+  if (error) {
+    sprintf(buffer, "Compressed visibility file %s is corrupted", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  purify_visibility_alloc(vis, (int)header.nmeas);
+
+  // Inflate and decode the blocks.
+  rawcap = purify_visibility_zrawsize(&header, header.blocksize);
+  error = 0;
+  #pragma omp parallel private(b, n, rawlen, raw, tmp)
+  {
+    raw = (unsigned char*)malloc(rawcap);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(raw);
+    tmp = (unsigned char*)malloc(rawcap);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(tmp);
+    #pragma omp for schedule(dynamic)
+    for (b = 0; b < header.nblocks; b++) {
+      n = purify_min(header.blocksize, vis->nmeas - b * header.blocksize);
+      rawlen = purify_visibility_zrawsize(&header, n);
+      if (uncompress(raw, &rawlen, data + offset[b], 
+		     offset[b+1] - offset[b]) != Z_OK
+	  || rawlen != purify_visibility_zrawsize(&header, n)) {
+	#pragma omp atomic
+	error++;
+      }
+      else
+	purify_visibility_zdecode(vis, b * header.blocksize, n, raw, tmp,
+				  &header);
+    }
+    free(raw);
+    free(tmp);
+  }
+
+  munmap(data, size);
+  if (error) {
+    sprintf(buffer, "Compressed visibility file %s is corrupted", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  return 0;
+
+}
+
+
+/*!
+ * Read visibilities from a UVFITS file in random groups format. The
+ * group parameters and the data of blocks of groups are read with
+ * one bulk fits_read_col call each, since CFITSIO presents random
+ * groups as a table whose columns are the parameters and the data
+ * array. The visibilities of a block are then filled in parallel, one
+ * per group, IF and channel, with u, v and w converted from seconds
+ * to wavelengths at the frequency of the channel and Stokes I formed
+ * from the correlations.
+ *
+ * \param[out] vis Visibilities read from the file.
+ * \param[in] filename Name of the file to read.
+ * \retval error Zero return indicates no errors.
+ *
+ * \note Stokes I is read directly or formed as (RR+LL)/2 or (XX+YY)/2
+ * with noise variance (1/w_1 + 1/w_2)/4, w being the weights of the
+ * correlations. If one of the correlations is flagged (non-positive
+ * weight) the other one is used alone, and if both are flagged the
+ * noise standard deviation is infinite, so the visibility can be
+ * dropped with purify_visibility_filter. The time is the sum of the
+ * DATE parameters in days. IF frequency offsets are read from the AIPS
+ * FQ table. Binary table (FITS-IDI) files are not supported.
+ *
+ * \note Memory for the visibilities is allocated herein and must be
+ * freed by the calling routine.
+ */
+int purify_visibility_readuvfits(purify_visibility *vis, 
+				 const char *filename) {
+
+  fitsfile *fptr;
+  int fits_status = 0;
+  char buffer[PURIFY_STRLEN], key[FLEN_KEYWORD], ctype[FLEN_VALUE];
+  int groups, naxis, pcount, n, anynul, colnum, ok;
+  int iuu, ivv, iww, ibl, idate[2], ncomplex, stokes[2];
+  int nstokes, nfreq, nif, g, iif, c, k, nblock;
+  long naxes[PURIFY_VISIBILITY_UVFITSMAXAXIS], gcount, first;
+  long scomplex, sstokes, sfreq, sif, nelem;
+  double *pscal, *pzero, *freq, *par, *dat, *p, *d;
+  double crval, cdelt, crpix, fcrval, fcdelt, fcrpix;
+  double uu, vv, ww, date, re1, im1, w1, re2, im2, w2;
+
+  // Open file and check that it holds random groups.
+  fits_open_file(&fptr, filename, READONLY, &fits_status);
+  fits_report_error(stdout, fits_status);
+  if (fits_status) {
+    sprintf(buffer, "Failed to open file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  groups = 0;
+  fits_read_key(fptr, TLOGICAL, "GROUPS", &groups, NULL, &fits_status);
+  fits_read_key(fptr, TINT, "NAXIS", &naxis, NULL, &fits_status);
+  fits_read_key(fptr, TINT, "PCOUNT", &pcount, NULL, &fits_status);
+  fits_read_key(fptr, TLONG, "GCOUNT", &gcount, NULL, &fits_status);
+  fits_report_error(stdout, fits_status);
+  if (fits_status || !groups || naxis < 3 
+      || naxis > PURIFY_VISIBILITY_UVFITSMAXAXIS) {
+    sprintf(buffer, "File %s is not a UVFITS random groups file", 
+	    filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Group parameters.
+  pscal = (double*)malloc(pcount * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(pscal);
+  pzero = (double*)malloc(pcount * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(pzero);
+  iuu = ivv = iww = ibl = idate[0] = idate[1] = -1;
+  for (n = 0; n < pcount; n++) {
+    sprintf(key, "PTYPE%d", n + 1);
+    fits_read_key(fptr, TSTRING, key, ctype, NULL, &fits_status);
+    sprintf(key, "PSCAL%d", n + 1);
+    pscal[n] = purify_visibility_fitskey(fptr, key, 1.0);
+    sprintf(key, "PZERO%d", n + 1);
+    pzero[n] = purify_visibility_fitskey(fptr, key, 0.0);
+    if (strncmp(ctype, "UU", 2) == 0) iuu = n;
+    else if (strncmp(ctype, "VV", 2) == 0) ivv = n;
+    else if (strncmp(ctype, "WW", 2) == 0) iww = n;
+    else if (strncmp(ctype, "BASELINE", 8) == 0) ibl = n;
+    else if (strncmp(ctype, "DATE", 4) == 0) {
+      if (idate[0] < 0) idate[0] = n;
+      else if (idate[1] < 0) idate[1] = n;
+    }
+  }
+  fits_report_error(stdout, fits_status);
+  if (fits_status || iuu < 0 || ivv < 0 || iww < 0) {
+    sprintf(buffer, "No UU, VV and WW group parameters in file %s", 
+	    filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Axes of the data array (the first one has length zero).
+  ncomplex = nstokes = nfreq = nif = 1;
+  scomplex = sstokes = sfreq = sif = 0;
+  crval = cdelt = crpix = 1.0;
+  fcrval = fcdelt = fcrpix = 0.0;
+  nelem = 1;
+  for (n = 1; n < naxis; n++) {
+    sprintf(key, "NAXIS%d", n + 1);
+    fits_read_key(fptr, TLONG, key, &naxes[n], NULL, &fits_status);
+    sprintf(key, "CTYPE%d", n + 1);
+    fits_read_key(fptr, TSTRING, key, ctype, NULL, &fits_status);
+    if (strncmp(ctype, "COMPLEX", 7) == 0) {
+      ncomplex = naxes[n];
+      scomplex = nelem;
+    }
+    else if (strncmp(ctype, "STOKES", 6) == 0) {
+      nstokes = naxes[n];
+      sstokes = nelem;
+      sprintf(key, "CRVAL%d", n + 1);
+      crval = purify_visibility_fitskey(fptr, key, 1.0);
+      sprintf(key, "CDELT%d", n + 1);
+      cdelt = purify_visibility_fitskey(fptr, key, 1.0);
+      sprintf(key, "CRPIX%d", n + 1);
+      crpix = purify_visibility_fitskey(fptr, key, 1.0);
+    }
+    else if (strncmp(ctype, "FREQ", 4) == 0) {
+      nfreq = naxes[n];
+      sfreq = nelem;
+      sprintf(key, "CRVAL%d", n + 1);
+      fcrval = purify_visibility_fitskey(fptr, key, 0.0);
+      sprintf(key, "CDELT%d", n + 1);
+      fcdelt = purify_visibility_fitskey(fptr, key, 0.0);
+      sprintf(key, "CRPIX%d", n + 1);
+      fcrpix = purify_visibility_fitskey(fptr, key, 1.0);
+    }
+    else if (strncmp(ctype, "IF", 2) == 0) {
+      nif = naxes[n];
+      sif = nelem;
+    }
+    nelem *= naxes[n];
+  }
+  fits_report_error(stdout, fits_status);
+  if (fits_status || ncomplex < 2 || fcrval <= 0.0) {
+    sprintf(buffer, "Invalid data axes in file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Correlations forming Stokes I: I itself, RR and LL, or XX and YY.
+  stokes[0] = stokes[1] = -1;
+  for (n = 0; n < nstokes; n++) {
+    k = (int)floor(crval + (n + 1 - crpix) * cdelt + 0.5);
+    if (k == 1) 
+      stokes[0] = stokes[1] = n;
+    else if ((k == -1 || k == -5) && stokes[0] < 0) 
+      stokes[0] = n;
+    else if ((k == -2 || k == -6) && stokes[1] < 0) 
+      stokes[1] = n;
+  }
+  if (stokes[0] < 0 || stokes[1] < 0) {
+    sprintf(buffer, "No Stokes I or parallel hand correlations in file %s", 
+	    filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Frequency of each IF and channel.
+  freq = (double*)malloc(nif * nfreq * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(freq);
+  for (iif = 0; iif < nif; iif++)
+    freq[iif * nfreq] = 0.0;
+  if (nif > 1) {
+    fits_movnam_hdu(fptr, BINARY_TBL, "AIPS FQ", 0, &fits_status);
+    fits_get_colnum(fptr, CASEINSEN, "IF FREQ", &colnum, &fits_status);
+    fits_read_col(fptr, TDOUBLE, colnum, 1, 1, nif, NULL, freq, 
+		  &anynul, &fits_status);
+    fits_movabs_hdu(fptr, 1, NULL, &fits_status);
+    fits_report_error(stdout, fits_status);
+    if (fits_status) {
+      sprintf(buffer, "No IF frequencies in the AIPS FQ table of file %s", 
+	      filename);
+      PURIFY_ERROR_GENERIC(buffer);
+    }
+    for (iif = nif - 1; iif >= 0; iif--)
+      freq[iif * nfreq] = freq[iif];
+  }
+  for (iif = 0; iif < nif; iif++)
+    for (c = nfreq - 1; c >= 0; c--)
+      freq[iif * nfreq + c] = freq[iif * nfreq] 
+	+ fcrval + (c + 1 - fcrpix) * fcdelt;
+
+  if ((double)gcount * nif * nfreq > INT_MAX) {
+    sprintf(buffer, "Too many visibilities in file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+  purify_visibility_alloc(vis, gcount * nif * nfreq);
+
+  // Bulk reads of blocks of groups.
+  nblock = (int)purify_max(PURIFY_VISIBILITY_UVFITSBLOCK 
+			   / ((pcount + nelem) * (long)sizeof(double)), 1L);
+  nblock = (int)purify_min((long)nblock, purify_max(gcount, 1L));
+  par = (double*)malloc((size_t)nblock * purify_max(pcount, 1) 
+			* sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(par);
+  dat = (double*)malloc((size_t)nblock * nelem * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(dat);
+  ok = 1;
+  for (first = 0; first < gcount && ok; first += nblock) {
+    nblock = (int)purify_min((long)nblock, gcount - first);
+    fits_read_col(fptr, TDOUBLE, 1, first + 1, 1, (long)nblock * pcount,
+		  NULL, par, &anynul, &fits_status);
+    fits_read_col(fptr, TDOUBLE, 2, first + 1, 1, (long)nblock * nelem,
+		  NULL, dat, &anynul, &fits_status);
+    ok = fits_status == 0;
+
+    #pragma omp parallel for private(p, d, uu, vv, ww, date, iif, c, k, \
+				     re1, im1, w1, re2, im2, w2)
+    for (g = 0; g < nblock; g++) {
+      p = par + (size_t)g * pcount;
+      uu = p[iuu] * pscal[iuu] + pzero[iuu];
+      vv = p[ivv] * pscal[ivv] + pzero[ivv];
+      ww = p[iww] * pscal[iww] + pzero[iww];
+      date = 0.0;
+      if (idate[0] >= 0)
+	date += p[idate[0]] * pscal[idate[0]] + pzero[idate[0]];
+      if (idate[1] >= 0)
+	date += p[idate[1]] * pscal[idate[1]] + pzero[idate[1]];
+      for (iif = 0; iif < nif; iif++) {
+	for (c = 0; c < nfreq; c++) {
+	  k = ((first + g) * nif + iif) * nfreq + c;
+	  vis->u[k] = uu * freq[iif * nfreq + c];
+	  vis->v[k] = vv * freq[iif * nfreq + c];
+	  vis->w[k] = ww * freq[iif * nfreq + c];
+	  vis->baseline[k] = ibl >= 0 ? 
+	    (int)(p[ibl] * pscal[ibl] + pzero[ibl]) : -1;
+	  vis->time[k] = date;
+
+	  d = dat + (size_t)g * nelem + iif * sif + c * sfreq;
+	  re1 = d[stokes[0] * sstokes];
+	  im1 = d[stokes[0] * sstokes + scomplex];
+	  w1 = ncomplex > 2 ? d[stokes[0] * sstokes + 2 * scomplex] : 1.0;
+	  re2 = d[stokes[1] * sstokes];
+	  im2 = d[stokes[1] * sstokes + scomplex];
+	  w2 = ncomplex > 2 ? d[stokes[1] * sstokes + 2 * scomplex] : 1.0;
+	  if (stokes[0] == stokes[1] && w1 > 0.0) {
+	    vis->y[k] = re1 + I * im1;
+	    vis->noise_std[k] = sqrt(1.0 / w1);
+	  }
+	  else if (w1 > 0.0 && w2 > 0.0) {
+	    vis->y[k] = 0.5 * (re1 + re2) + I * 0.5 * (im1 + im2);
+	    vis->noise_std[k] = 0.5 * sqrt(1.0 / w1 + 1.0 / w2);
+	  }
+	  else if (w1 > 0.0) {
+	    vis->y[k] = re1 + I * im1;
+	    vis->noise_std[k] = sqrt(1.0 / w1);
+	  }
+	  else if (w2 > 0.0) {
+	    vis->y[k] = re2 + I * im2;
+	    vis->noise_std[k] = sqrt(1.0 / w2);
+	  }
+	  else {
+	    vis->y[k] = 0.0;
+	    vis->noise_std[k] = INFINITY;
+	  }
+	}
+      }
+    }
+  }
+  fits_report_error(stdout, fits_status);
+  if (!ok) {
+    sprintf(buffer, "Failed to read the groups of file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  fits_close_file(fptr, &fits_status);
+  fits_report_error(stdout, fits_status);
+
+  free(pscal);
+  free(pzero);
+  free(freq);
+  free(par);
+  free(dat);
+
+  return 0;
+
+}
+
+
+/*!
+ * Read a numeric keyword of the current HDU of a FITS file.
+ *
+ * \param[in] fptr FITS file.
+ * \param[in] key Name of the keyword.
+ * \param[in] def Value returned if the keyword is missing.
+ * \retval value Value of the keyword.
+ */
+double purify_visibility_fitskey(fitsfile *fptr, const char *key, 
+				 double def) {
+
+  int fits_status = 0;
+  double value;
+
+  fits_read_key(fptr, TDOUBLE, key, &value, NULL, &fits_status);
+
+  return fits_status ? def : value;
+
+}
+
+
+/*!
+ * Size of an encoded block of a compressed visibility file: the
+ * scales of y and noise_std, the u, v, w, y, noise_std, baseline and
+ * time columns.
+ *
+ * \param[in] header Header of the file.
+ * \param[in] n Number of visibilities of the block.
+ * \retval size Size in bytes.
+ */
+size_t purify_visibility_zrawsize(purify_visibility_zheader *header, 
+				  int n) {
+
+  return 2 * sizeof(double) 
+    + (size_t)n * (3 * sizeof(int) + 4 * header->yprec 
+		   + sizeof(int) + sizeof(long long));
+
+}
+
+
+/*!
+ * Encode a block of visibilities: quantise, delta encode and shuffle
+ * the bytes of each column so that deflate sees runs of similar bytes.
+ *
+ * \param[out] raw Encoded block.
+ * \param[out] tmp Work space of the size of the encoded block.
+ * \param[in] vis Visibilities.
+ * \param[in] start First visibility of the block.
+ * \param[in] n Number of visibilities of the block.
+ * \param[in] header Header of the file (quantisation steps and
+ * precision of the visibilities).
+ * \retval size Size in bytes of the encoded block.
+ */
+size_t purify_visibility_zencode(unsigned char *raw, unsigned char *tmp,
+				 purify_visibility *vis, int start, int n,
+				 purify_visibility_zheader *header) {
+
+  int i, k, p;
+  int *iq;
+  long long q, prev, *lq;
+  unsigned int ub, uprev;
+  unsigned short h;
+  float f;
+  double x, scale[2], amax;
+  double *cols[3];
+  complex double *ycols[2];
+  unsigned char *pos;
+
+  p = header->yprec;
+  pos = raw;
+  cols[0] = vis->u + start;
+  cols[1] = vis->v + start;
+  cols[2] = vis->w + start;
+  ycols[0] = vis->y + start;
+  ycols[1] = vis->noise_std + start;
+
+  // Scales that bring half floats to the top of their range, from
+  // the finite values only so that infinities (flagged noise) are
+  // encoded as half float infinities.
+  for (k = 0; k < 2; k++) {
+    amax = 0.0;
+    for (i = 0; i < n; i++) {
+      x = fabs(creal(ycols[k][i]));
+      if (x <= DBL_MAX) amax = fmax(amax, x);
+      x = fabs(cimag(ycols[k][i]));
+      if (x <= DBL_MAX) amax = fmax(amax, x);
+    }
+    scale[k] = p == 2 && amax > 0.0 ? amax / 32768.0 : 1.0;
+  }
+  memcpy(pos, scale, sizeof(scale));
+  pos += sizeof(scale);
+
+  // Coordinates.
+  iq = (int*)tmp;
+  for (k = 0; k < 3; k++) {
+    prev = 0;
+    for (i = 0; i < n; i++) {
+      q = llround(cols[k][i] / header->uvwstep[k]);
+      iq[i] = (int)(q - prev);
+      prev = q;
+    }
+    purify_visibility_shuffle(pos, tmp, n, sizeof(int));
+    pos += n * sizeof(int);
+  }
+
+  // Visibilities and noise.
+  for (k = 0; k < 2; k++) {
+    for (i = 0; i < 2*n; i++) {
+      x = i % 2 == 0 ? creal(ycols[k][i/2]) : cimag(ycols[k][i/2]);
+      if (p == 2) {
+	h = purify_visibility_float2half((float)(x / scale[k]));
+	memcpy(tmp + i*p, &h, p);
+      }
+      else if (p == 4) {
+	f = (float)x;
+	memcpy(tmp + i*p, &f, p);
+      }
+      else
+	memcpy(tmp + i*p, &x, p);
+    }
+    purify_visibility_shuffle(pos, tmp, 2*n, p);
+    pos += 2*n*p;
+  }
+
+  // Baselines.
+  uprev = 0;
+  for (i = 0; i < n; i++) {
+    ub = (unsigned int)vis->baseline[start + i];
+    ((unsigned int*)tmp)[i] = ub - uprev;
+    uprev = ub;
+  }
+  purify_visibility_shuffle(pos, tmp, n, sizeof(int));
+  pos += n * sizeof(int);
+
+  // Times.
+  lq = (long long*)tmp;
+  prev = 0;
+  for (i = 0; i < n; i++) {
+    q = llround(vis->time[start + i] / header->tstep);
+    lq[i] = q - prev;
+    prev = q;
+  }
+  purify_visibility_shuffle(pos, tmp, n, sizeof(long long));
+  pos += n * sizeof(long long);
+
+  return pos - raw;
+
+}
+
+
+/*!
+ * Decode a block of visibilities encoded by \ref
+ * purify_visibility_zencode.
+ *
+ * \param[in,out] vis Visibilities (memory must already be allocated).
+ * \param[in] start First visibility of the block.
+ * \param[in] n Number of visibilities of the block.
+ * \param[in] raw Encoded block.
+ * \param[out] tmp Work space of the size of the encoded block.
+ * \param[in] header Header of the file.
+ */
+void purify_visibility_zdecode(purify_visibility *vis, int start, int n,
+			       const unsigned char *raw, unsigned char *tmp,
+			       purify_visibility_zheader *header) {
+
+  int i, k, p;
+  int *iq;
+  long long q, *lq;
+  unsigned int ub, *uq;
+  unsigned short *hq;
+  float *fq;
+  double scale[2], x[2];
+  double *cols[3], *dq;
+  complex double *ycols[2];
+  const unsigned char *pos;
+
+  p = header->yprec;
+  pos = raw;
+  cols[0] = vis->u + start;
+  cols[1] = vis->v + start;
+  cols[2] = vis->w + start;
+  ycols[0] = vis->y + start;
+  ycols[1] = vis->noise_std + start;
+
+  memcpy(scale, pos, sizeof(scale));
+  pos += sizeof(scale);
+
+  // Coordinates.
+  iq = (int*)tmp;
+  for (k = 0; k < 3; k++) {
+    purify_visibility_unshuffle(tmp, pos, n, sizeof(int));
+    q = 0;
+    for (i = 0; i < n; i++) {
+      q += iq[i];
+      cols[k][i] = q * header->uvwstep[k];
+    }
+    pos += n * sizeof(int);
+  }
+
+  // Visibilities and noise.
+  hq = (unsigned short*)tmp;
+  fq = (float*)tmp;
+  dq = (double*)tmp;
+  for (k = 0; k < 2; k++) {
+    purify_visibility_unshuffle(tmp, pos, 2*n, p);
+    for (i = 0; i < n; i++) {
+      if (p == 2) {
+	x[0] = purify_visibility_half2float(hq[2*i]) * scale[k];
+	x[1] = purify_visibility_half2float(hq[2*i+1]) * scale[k];
+      }
+      else if (p == 4) {
+	x[0] = fq[2*i];
+	x[1] = fq[2*i+1];
+      }
+      else {
+	x[0] = dq[2*i];
+	x[1] = dq[2*i+1];
+      }
+      ycols[k][i] = x[0];
+      purify_visibility_setimag(&ycols[k][i], x[1]);
+    }
+    pos += 2*n*p;
+  }
+
+  // Baselines.
+  uq = (unsigned int*)tmp;
+  purify_visibility_unshuffle(tmp, pos, n, sizeof(int));
+  ub = 0;
+  for (i = 0; i < n; i++) {
+    ub += uq[i];
+    vis->baseline[start + i] = (int)ub;
+  }
+  pos += n * sizeof(int);
+
+  // Times.
+  lq = (long long*)tmp;
+  purify_visibility_unshuffle(tmp, pos, n, sizeof(long long));
+  q = 0;
+  for (i = 0; i < n; i++) {
+    q += lq[i];
+    vis->time[start + i] = q * header->tstep;
+  }
+
+}
+
+
+/*!
+ * Shuffle the bytes of an array so that byte j of element i is at
+ * position j*n + i.
+ *
+ * \param[out] dst Shuffled bytes.
+ * \param[in] src Array.
+ * \param[in] n Number of elements.
+ * \param[in] size Size of an element in bytes.
+ */
+void purify_visibility_shuffle(unsigned char *dst, 
+			       const unsigned char *src, 
+			       int n, int size) {
+
+  int i, j;
+
+  for (j = 0; j < size; j++)
+    for (i = 0; i < n; i++)
+      dst[(size_t)j*n + i] = src[(size_t)i*size + j];
+
+}
+
+
+/*!
+ * Restore an array whose bytes were shuffled by \ref
+ * purify_visibility_shuffle.
+ *
+ * \param[out] dst Array.
+ * \param[in] src Shuffled bytes.
+ * \param[in] n Number of elements.
+ * \param[in] size Size of an element in bytes.
+ */
+void purify_visibility_unshuffle(unsigned char *dst, 
+				 const unsigned char *src, 
+				 int n, int size) {
+
+  int i, j;
+
+  for (j = 0; j < size; j++)
+    for (i = 0; i < n; i++)
+      dst[(size_t)i*size + j] = src[(size_t)j*n + i];
+
+}
+
+
+/*!
+ * Convert a single float to a half float (IEEE 754 binary16), rounding
+ * to nearest even.
+ *
+ * \param[in] f Single float.
+ * \retval h Bits of the half float.
+ */
+unsigned short purify_visibility_float2half(float f) {
+
+  unsigned int x, sign, mant, h, rem, halfway;
+  int exp, shift;
+
+  memcpy(&x, &f, sizeof(x));
+  sign = (x >> 16) & 0x8000;
+  mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff)
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  exp = (int)((x >> 23) & 0xff) - 127 + 15;
+  if (exp >= 31)
+    return sign | 0x7c00;
+  if (exp <= 0) {
+    // Subnormal half float.
+    if (exp < -10)
+      return sign;
+    mant |= 0x800000;
+    shift = 14 - exp;
+    h = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1)))
+      h++;
+    return sign | h;
+  }
+  h = ((unsigned int)exp << 10) | (mant >> 13);
+  rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    h++;
+
+  return sign | h;
+
+}
+
+
+/*!
+ * Convert a half float (IEEE 754 binary16) to a single float.
+ *
+ * \param[in] h Bits of the half float.
+ * \retval f Single float.
+ */
+float purify_visibility_half2float(unsigned short h) {
+
+  unsigned int sign, exp, mant, x;
+  float f;
+
+  sign = (unsigned int)(h & 0x8000) << 16;
+  exp = (h >> 10) & 0x1f;
+  mant = h & 0x3ff;
+  if (exp == 0) {
+    f = ldexpf((float)mant, -24);
+    return sign ? -f : f;
+  }
+  if (exp == 31)
+    x = sign | 0x7f800000 | (mant << 13);
+  else
+    x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+  memcpy(&f, &x, sizeof(f));
+
+  return f;
+
+}
+
+
+/*!
+ * Open a visibility file to read it in chunks (see \ref
+ * purify_visibility_reader_next and \ref purify_visibility_reader_pass).
+ *
+ * \param[out] reader Reader of the file.
+ * \param[in] filename Name of the file to read.
+ * \param[in] filetype Type of file to read.
+ * \param[in] chunksize Maximum number of visibilities per chunk.
+ */
+void purify_visibility_init_reader(purify_visibility_reader *reader,
+				   const char *filename,
+				   purify_visibility_filetype filetype,
+				   int chunksize) {
+
+  char buffer[PURIFY_STRLEN];
+
+  reader->filetype = filetype;
+  reader->chunksize = chunksize;
+  reader->file = NULL;
+  reader->buf = NULL;
+  reader->buflen = 0;
+  reader->bufpos = 0;
+  reader->bufcap = 0;
+  reader->eof = 0;
+  reader->fd = -1;
+  reader->nread = 0;
+
+  if (filetype == PURIFY_VISIBILITY_FILETYPE_BIN) {
+    reader->fd = open(filename, O_RDONLY);
+    if (reader->fd < 0) {
+      sprintf(buffer, "Failed to open file %s", filename);
+      PURIFY_ERROR_GENERIC(buffer);
+    }
+    purify_visibility_readbinheader(&reader->header, reader->fd, filename);
+  }
+  else {
+    reader->file = fopen(filename, "r");
+    if (reader->file == NULL) {
+      sprintf(buffer, "Failed to open file %s", filename);
+      PURIFY_ERROR_GENERIC(buffer);
+    }
+    // Room for a chunk of typical lines, grown for longer lines.
+    reader->bufcap = (size_t)chunksize * 128;
+    reader->buf = (char*)malloc(reader->bufcap);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(reader->buf);
+  }
+
+  purify_visibility_alloc(&reader->chunk[0], chunksize);
+  purify_visibility_alloc(&reader->chunk[1], chunksize);
+
+}
+
+
+/*!
+ * Close a visibility file opened with \ref purify_visibility_init_reader.
+ *
+ * \param[in,out] reader Reader of the file.
+ */
+void purify_visibility_free_reader(purify_visibility_reader *reader) {
+
+  if (reader->file != NULL) fclose(reader->file);
+  if (reader->fd >= 0) close(reader->fd);
+  if (reader->buf != NULL) free(reader->buf);
+  purify_visibility_free(&reader->chunk[0]);
+  purify_visibility_free(&reader->chunk[1]);
+
+}
+
+
+/*!
+ * Read the next chunk of visibilities of a file.
+ *
+ * \param[in,out] reader Reader of the file.
+ * \param[out] chunk Visibilities read, with space for reader->chunksize
+ * visibilities (chunk->nmeas is set to the number read).
+ * \retval n Number of visibilities read, zero at the end of the file.
+ */
+int purify_visibility_reader_next(purify_visibility_reader *reader,
+				  purify_visibility *chunk) {
+
+  int k, n;
+  size_t r;
+  size_t colsize[PURIFY_VISIBILITY_BINNCOLS];
+  void *cols[PURIFY_VISIBILITY_BINNCOLS];
+  char *q;
+  const char *line;
+
+  n = 0;
+  if (reader->filetype == PURIFY_VISIBILITY_FILETYPE_BIN) {
+    n = (int)purify_min(reader->chunksize, 
+			reader->header.nmeas - reader->nread);
+    purify_visibility_bincolsize(colsize);
+    cols[0] = chunk->u;
+    cols[1] = chunk->v;
+    cols[2] = chunk->w;
+    cols[3] = chunk->y;
+    cols[4] = chunk->noise_std;
+    cols[5] = chunk->baseline;
+    cols[6] = chunk->time;
+    for (k = 0; k < PURIFY_VISIBILITY_BINNCOLS && n > 0; k++)
+      if (pread(reader->fd, cols[k], n * colsize[k], 
+		reader->header.offset[k] + reader->nread * colsize[k]) 
+	  != (ssize_t)(n * colsize[k]))
+	PURIFY_ERROR_GENERIC("Failed to read binary visibility file");
+  }
+  else {
+    while (n < reader->chunksize) {
+      line = reader->buf + reader->bufpos;
+      q = (char*)memchr(line, '\n', reader->buflen - reader->bufpos);
+      if (q == NULL && !reader->eof) {
+	// Move the partial line to the front and refill the buffer.
+	memmove(reader->buf, line, reader->buflen - reader->bufpos);
+	reader->buflen -= reader->bufpos;
+	reader->bufpos = 0;
+	if (reader->buflen == reader->bufcap) {
+	  reader->bufcap *= 2;
+	  reader->buf = (char*)realloc(reader->buf, reader->bufcap);
+	  PURIFY_ERROR_MEM_ALLOC_CHECK(reader->buf);
+	}
+	r = fread(reader->buf + reader->buflen, 1, 
+		  reader->bufcap - reader->buflen, reader->file);
+	reader->buflen += r;
+	if (r == 0) reader->eof = 1;
+	continue;
+      }
+      if (q == NULL && reader->bufpos == reader->buflen)
+	break;
+      // Fields that are not in the file keep their default value.
+      chunk->u[n] = 0.0;
+      chunk->v[n] = 0.0;
+      chunk->w[n] = 0.0;
+      chunk->y[n] = 0.0;
+      chunk->noise_std[n] = 0.0;
+      chunk->baseline[n] = -1;
+      chunk->time[n] = 0.0;
+      if (q == NULL) {
+	// Last line without a newline.
+	purify_visibility_parsespan(chunk, n++, line, 
+				    reader->buf + reader->buflen, 
+				    reader->filetype);
+	reader->bufpos = reader->buflen;
+      }
+      else {
+	purify_visibility_parsespan(chunk, n++, line, q + 1, 
+				    reader->filetype);
+	reader->bufpos = q + 1 - reader->buf;
+      }
+    }
+  }
+
+  reader->nread += n;
+  chunk->nmeas = n;
+
+  return n;
+
+}
+
+
+/*!
+ * Apply a function to every chunk of a visibility file, in a single
+ * pass over the file. The next chunk is read while the function
+ * processes the current one, so the pass runs at the speed of the
+ * slowest of the two. Nested parallelism is enabled during the pass
+ * so that the function can still use all threads.
+ *
+ * \param[in,out] reader Reader of the file, at the position to start.
+ * \param[in] fn Function applied to each chunk.
+ * \param[in] data Data passed to the function.
+ * \retval n Number of visibilities processed.
+ */
+long long purify_visibility_reader_pass(purify_visibility_reader *reader,
+					void (*fn)(purify_visibility *chunk, 
+						   void **data),
+					void **data) {
+
+  int cur;
+  long long n;
+#ifdef _OPENMP
+  int levels;
+#endif
+
+#ifdef _OPENMP
+  levels = omp_get_max_active_levels();
+  if (levels < 2) omp_set_max_active_levels(2);
+#endif
+
+  n = 0;
+  cur = 0;
+  purify_visibility_reader_next(reader, &reader->chunk[cur]);
+  while (reader->chunk[cur].nmeas > 0) {
+    #pragma omp parallel sections num_threads(2)
+    {
+      #pragma omp section
+      fn(&reader->chunk[cur], data);
+      #pragma omp section
+      purify_visibility_reader_next(reader, &reader->chunk[1 - cur]);
+    }
+    n += reader->chunk[cur].nmeas;
+    cur = 1 - cur;
+  }
+
+#ifdef _OPENMP
+  omp_set_max_active_levels(levels);
+#endif
+
+  return n;
+
+}
+
+
+/*!
+ * Accumulate the natural weights of visibilities in a histogram of the
+ * cells of the oversampled grid (the density used by \ref
+ * purify_visibility_weights).
+ *
+ * \param[in,out] hist Histogram of size nx2*ny2.
+ * \param[in] vis Visibilities.
+ * \param[in] umax Maximum u frequency of the grid.
+ * \param[in] vmax Maximum v frequency of the grid.
+ * \param[in] nx2 Size of the oversampled grid along u.
+ * \param[in] ny2 Size of the oversampled grid along v.
+ */
+void purify_visibility_histogram_add(double *hist,
+				     purify_visibility *vis,
+				     double umax, double vmax,
+				     int nx2, int ny2) {
+
+  int i, t, nt, lo, hi;
+  int *cell;
+  double uinc, vinc, wk;
+
+  uinc = umax / (nx2 / 2);
+  vinc = vmax / (ny2 / 2);
+  cell = (int*)malloc(vis->nmeas * sizeof(int));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(cell);
+
+  // Each thread owns a contiguous range of cells, so the sums are those
+  // of the serial loop.
+  #pragma omp parallel private(i, t, nt, lo, hi, wk)
+  {
+    #pragma omp for schedule(static)
+    for (i = 0; i < vis->nmeas; i++)
+      cell[i] = purify_visibility_cellind(vis->u[i], vis->v[i], 
+					  uinc, vinc, nx2, ny2);
+    #ifdef _OPENMP
+      t = omp_get_thread_num();
+      nt = omp_get_num_threads();
+    #else
+      t = 0;
+      nt = 1;
+    #endif
+    lo = (long long)nx2 * ny2 * t / nt;
+    hi = (long long)nx2 * ny2 * (t + 1) / nt;
+    for (i = 0; i < vis->nmeas; i++) {
+      if (cell[i] < lo || cell[i] >= hi) continue;
+      wk = cabs(vis->noise_std[i]);
+      hist[cell[i]] += wk > 0.0 ? 1.0 / (wk * wk) : 1.0;
+    }
+  }
+
+  free(cell);
+
+}
+
+
+/*!
+ * Cell of the oversampled grid of a visibility, wrapped as in the
+ * gridding matrix.
+ *
+ * \param[in] u u coordinate of the visibility.
+ * \param[in] v v coordinate of the visibility.
+ * \param[in] uinc Size of a cell along u.
+ * \param[in] vinc Size of a cell along v.
+ * \param[in] nx2 Size of the oversampled grid along u.
+ * \param[in] ny2 Size of the oversampled grid along v.
+ * \retval ind Index of the cell.
+ */
+int purify_visibility_cellind(double u, double v, double uinc, double vinc,
+			      int nx2, int ny2) {
+
+  int iu, iv;
+
+  iu = (int)floor(u / uinc + 0.5) % nx2;
+  iv = (int)floor(v / vinc + 0.5) % ny2;
+  if (iu < 0) iu += nx2;
+  if (iv < 0) iv += ny2;
+
+  return iv * nx2 + iu;
+
+}
+
+
+/*!
+ * Parse one line of a visibility file into a visibility.
+ *
+ * \param[in,out] vis Visibilities (memory must already be allocated).
+ * \param[in] i Index of the visibility to set.
+ * \param[in] line Line of the file.
+ * \param[in] filetype Type of file the line was read from.
+ */
+void purify_visibility_parseline(purify_visibility *vis, int i,
+				 const char *line,
+				 purify_visibility_filetype filetype) {
+
+  purify_visibility_parsespan(vis, i, line, line + strlen(line), 
+			      filetype);
+
+}
+
+
+/*!
+ * Count the lines of a chunk of a visibility file. A last line
+ * without a trailing newline is counted.
+ *
+ * \param[in] p Start of the chunk (start of a line).
+ * \param[in] end End of the chunk.
+ * \retval n Number of lines.
+ */
+int purify_visibility_countlines(const char *p, const char *end) {
+
+  int n;
+  const char *q;
+
+  if (p >= end) return 0;
+  n = 1;
+  while ((q = (const char*)memchr(p, '\n', end - 1 - p)) != NULL) {
+    n++;
+    p = q + 1;
+  }
+
+  return n;
+
+}
+
+
+/*!
+ * Parse the lines of a chunk of a visibility file.
+ *
+ * \param[in,out] vis Visibilities (memory must already be allocated).
+ * \param[in] i Index of the visibility of the first line.
+ * \param[in] p Start of the chunk (start of a line).
+ * \param[in] end End of the chunk.
+ * \param[in] filetype Type of file the chunk was read from.
+ */
+void purify_visibility_parsechunk(purify_visibility *vis, int i,
+				  const char *p, const char *end,
+				  purify_visibility_filetype filetype) {
+
+  const char *q, *eol;
+
+  while (p < end) {
+    q = (const char*)memchr(p, '\n', end - p);
+    eol = q != NULL ? q + 1 : end;
+    purify_visibility_parsespan(vis, i++, p, eol, filetype);
+    p = eol;
+  }
+
+}
+
+
+/*!
+ * Parse one line of a visibility file, given by its first and one
+ * past its last character, into a visibility. Fields are separated
+ * by spaces or commas, as for strtok.
+ *
+ * \param[in,out] vis Visibilities (memory must already be allocated).
+ * \param[in] i Index of the visibility to set.
+ * \param[in] p Start of the line.
+ * \param[in] end End of the line.
+ * \param[in] filetype Type of file the line was read from.
+ */
+void purify_visibility_parsespan(purify_visibility *vis, int i,
+				 const char *p, const char *end,
+				 purify_visibility_filetype filetype) {
+
+  int itok;
+  const char *tok;
+
+  itok = 0;
+  while (1) {
+    while (p < end && (*p == ' ' || *p == ',')) p++;
+    if (p == end) break;
+    tok = p;
+    while (p < end && *p != ' ' && *p != ',') p++;
+    purify_visibility_parsefield(vis, i, itok++, tok, p, filetype);
+  }
+
+}
+
+
+/*!
+ * Set one field of a visibility from a token of a visibility file.
+ *
+ * \param[in,out] vis Visibilities (memory must already be allocated).
+ * \param[in] i Index of the visibility to set.
+ * \param[in] itok Column of the token.
+ * \param[in] tok Start of the token.
+ * \param[in] end End of the token.
+ * \param[in] filetype Type of file the token was read from.
+ */
+void purify_visibility_parsefield(purify_visibility *vis, int i, int itok,
+				  const char *tok, const char *end,
+				  purify_visibility_filetype filetype) {
+
+  char buffer[PURIFY_STRLEN];
+
+  switch (filetype) {
+  case PURIFY_VISIBILITY_FILETYPE_UV:
+    switch (itok) {
+      case 0:
+	vis->u[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 1:
+	vis->v[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 2:
+	vis->w[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 3:
+	vis->y[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 4:
+	purify_visibility_setimag(&vis->y[i], 
+				  purify_visibility_strtod(tok, end));
+	break;
+      case 5:
+	vis->noise_std[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 6:
+	vis->baseline[i] = purify_visibility_strtoi(tok, end);
+	break;
+      case 7:
+	vis->time[i] = purify_visibility_strtod(tok, end);
+	break;
+      default:
+	break;
+    }
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_VIS:
+    switch (itok) {
+      case 0:
+	// dummy
+	break;
+      case 1:
+	vis->u[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 2:
+	vis->v[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 3:
+	vis->w[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 4:
+	vis->y[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 5:
+	purify_visibility_setimag(&vis->y[i], 
+				  purify_visibility_strtod(tok, end));
+	break;
+      case 6:
+	vis->noise_std[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 7:
+	vis->noise_std[i] = I * purify_visibility_strtod(tok, end);
+	break;
+      default:
+	break;
+    }
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS:
+    switch (itok) {
+      case 0:
+	// dummy
+	break;
+      case 1:
+	vis->u[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 2:
+	vis->v[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 3:
+	vis->y[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 4:
+	purify_visibility_setimag(&vis->y[i], 
+				  purify_visibility_strtod(tok, end));
+	break;
+      case 5:
+	vis->noise_std[i] = (1 + I) * purify_visibility_strtod(tok, end) 
+	  / PURIFY_SQRT2;
+	break;
+      default:
+	break;
+    }
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS:
+    switch (itok) {
+      case 0:
+	// dummy
+	break;
+      case 1:
+	vis->u[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 2:
+	vis->v[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 3:
+	vis->w[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 4:
+	vis->y[i] = purify_visibility_strtod(tok, end);
+	break;
+      case 5:
+	purify_visibility_setimag(&vis->y[i], 
+				  purify_visibility_strtod(tok, end));
+	break;
+      case 6:
+	vis->noise_std[i] = (1 + I) * purify_visibility_strtod(tok, end) 
+	  / PURIFY_SQRT2;
+	break;
+      default:
+	break;
+    }
+    break;
+
+  default:
+    sprintf(buffer, 
+	    "Visibility filetype with id %d is not supported", 
+	    filetype);
+    PURIFY_ERROR_GENERIC(buffer);
+    break;
+
+  }
+
+}
+
+
+/*!
+ * Convert a token that is not null terminated to a double, with the
+ * same result as strtod. Decimal numbers with at most 19 significant
+ * digits whose mantissa and power of ten are exactly representable
+ * are converted with a single correctly rounded operation; anything
+ * else is handed to strtod.
+ *
+ * \param[in] tok Start of the token.
+ * \param[in] end End of the token.
+ * \retval x Value of the token.
+ */
+double purify_visibility_strtod(const char *tok, const char *end) {
+
+  char buffer[PURIFY_STRLEN];
+  char *copy;
+  const char *p, *q;
+  unsigned long long m;
+  int neg, eneg, fast, nd, nsig, e10, ex;
+  double x;
+  size_t len;
+
+  p = tok;
+  m = 0;
+  neg = 0;
+  fast = 1;
+  nd = 0;
+  nsig = 0;
+  e10 = 0;
+  while (p < end && isspace((unsigned char)*p)) p++;
+  if (p < end && (*p == '+' || *p == '-')) 
+    neg = *p++ == '-';
+  for (; p < end && *p >= '0' && *p <= '9'; p++, nd++) {
+    if (m == 0 && *p == '0') continue;
+    if (nsig++ < 19) m = 10*m + (*p - '0');
+    else fast = 0;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, nd++) {
+      if (m == 0 && *p == '0') {
+	e10--;
+	continue;
+      }
+      if (nsig++ < 19) {
+	m = 10*m + (*p - '0');
+	e10--;
+      }
+      else fast = 0;
+    }
+  }
+  // No digits (inf, nan, empty) or a hexadecimal number.
+  if (nd == 0 || (p < end && (*p == 'x' || *p == 'X')))
+    fast = 0;
+  if (fast && p < end && (*p == 'e' || *p == 'E')) {
+    q = p + 1;
+    eneg = 0;
+    if (q < end && (*q == '+' || *q == '-')) 
+      eneg = *q++ == '-';
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (ex = 0; q < end && *q >= '0' && *q <= '9'; q++)
+	if (ex < 100000) ex = 10*ex + (*q - '0');
+      e10 += eneg ? -ex : ex;
+    }
+  }
+
+  if (fast && m == 0)
+    return neg ? -0.0 : 0.0;
+  if (fast && m <= (1ULL << 53) && e10 >= -22 && e10 <= 22) {
+    x = e10 < 0 ? (double)m / purify_visibility_pow10[-e10] 
+      : (double)m * purify_visibility_pow10[e10];
+    return neg ? -x : x;
+  }
+
+  len = end - tok;
+  copy = len < PURIFY_STRLEN ? buffer : (char*)malloc(len + 1);
+  PURIFY_ERROR_MEM_ALLOC_CHECK(copy);
+  memcpy(copy, tok, len);
+  copy[len] = '\0';
+  x = strtod(copy, NULL);
+  if (copy != buffer) free(copy);
+
+  return x;
+
+}
+
+
+/*!
+ * Convert a token that is not null terminated to an integer, with the
+ * same result as atoi.
+ *
+ * \param[in] tok Start of the token.
+ * \param[in] end End of the token.
+ * \retval n Value of the token.
+ */
+int purify_visibility_strtoi(const char *tok, const char *end) {
+
+  const char *p;
+  long n;
+  int neg;
+
+  p = tok;
+  n = 0;
+  neg = 0;
+  while (p < end && isspace((unsigned char)*p)) p++;
+  if (p < end && (*p == '+' || *p == '-')) 
+    neg = *p++ == '-';
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    n = 10*n + (*p - '0');
+
+  return (int)(neg ? -n : n);
+
+}
+
+
+/*!
+ * Wall clock time used to measure the parsing throughput.
+ *
+ * \retval t Time in seconds.
+ */
+double purify_visibility_time(void) {
+
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+
+}
+
+
+/*!
+ * Write continuous visibilities to file.
+ * 
+ * \param[in] vis Visibilities to write to the file.
+ * \param[in] filename Name of the file to write.
+ * \param[in] filetype Type of file to write.
+ * \retval error Zero return indicates no errors.
+ *
+ * \authors <a href="http://www.jasonmcewen.org">Jason McEwen</a>
+ */
+int purify_visibility_writefile(purify_visibility *vis, 
+				const char *filename, 
+				purify_visibility_filetype filetype) {
+
+
+  FILE *file;
+  char buffer[PURIFY_STRLEN];
+  int error = 0;
+  purify_visibility_zparam zparam;
+
+  // Open file.
+  file = fopen(filename, 
+	       filetype == PURIFY_VISIBILITY_FILETYPE_BIN 
+	       || filetype == PURIFY_VISIBILITY_FILETYPE_ZVIS ? "wb" : "w");
+  if (file == NULL) {
+    sprintf(buffer, "Failed to create file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Write file.
+  switch (filetype) {
+
+  case PURIFY_VISIBILITY_FILETYPE_BIN:
+    error = purify_visibility_writebin(vis, file);
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_ZVIS:
+    purify_visibility_init_zparam(&zparam);
+    error = purify_visibility_writezstream(vis, file, &zparam);
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_VIS:
+  case PURIFY_VISIBILITY_FILETYPE_UV:
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS:
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS:
+    error = purify_visibility_writetext(vis, file, filetype);
+    break;
+
+  default:
+    sprintf(buffer, 
+	    "Visibility filetype with id %d is not supported", 
+	    filetype);
+    PURIFY_ERROR_GENERIC(buffer);
+
+    break;
+  }
+  if (error) {
+    sprintf(buffer, "Failed to write file %s", filename);
+    PURIFY_ERROR_GENERIC(buffer);
+  }
+
+  // Close file.
+  fclose(file);
+
+  return 0;
+
+}
+
+
+/*!
+ * Write visibilities to an open file in one of the text formats. The
+ * rows are formatted in parallel, one block of rows per thread, and
+ * the blocks are written in order with one write each. Values are
+ * written with the fewest digits (15 or 17) that read back to the same
+ * double with \ref purify_visibility_readfile.
+ *
+ * \param[in] vis Visibilities to write to the file.
+ * \param[in] file File to write.
+ * \param[in] filetype Type of file to write.
+ * \retval error Zero return indicates no errors.
+ *
+ * \note The VIS reader keeps only the imaginary part of noise_std
+ * and the PROFILE formats store its modulus, so noise_std only
+ * round-trips for the UV format and for values these formats
+ * represent.
+ */
+int purify_visibility_writetext(purify_visibility *vis, FILE *file,
+				purify_visibility_filetype filetype) {
+
+  int i, t, b, first, nblocks, nround, nthreads, error;
+  size_t *len;
+  char **bufs;
+  char *s;
+
+  nthreads = 1;
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  nblocks = (vis->nmeas + PURIFY_VISIBILITY_WRITEBLOCK - 1) 
+    / PURIFY_VISIBILITY_WRITEBLOCK;
+  nthreads = purify_max(purify_min(nthreads, nblocks), 1);
+  bufs = (char**)malloc(nthreads * sizeof(char*));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(bufs);
+  len = (size_t*)malloc(nthreads * sizeof(size_t));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(len);
+  for (t = 0; t < nthreads; t++) {
+    bufs[t] = (char*)malloc(PURIFY_VISIBILITY_WRITEBLOCK 
+			    * PURIFY_VISIBILITY_MAXROW);
+    PURIFY_ERROR_MEM_ALLOC_CHECK(bufs[t]);
+  }
+
+  error = 0;
+  for (first = 0; first < nblocks && !error; first += nthreads) {
+    nround = purify_min(nthreads, nblocks - first);
+    #pragma omp parallel for schedule(static, 1) private(b, i, s)
+    for (t = 0; t < nround; t++) {
+      b = first + t;
+      s = bufs[t];
+      for (i = b * PURIFY_VISIBILITY_WRITEBLOCK; 
+	   i < vis->nmeas && i < (b + 1) * PURIFY_VISIBILITY_WRITEBLOCK; i++)
+	s = purify_visibility_formatrow(s, vis, i, filetype);
+      len[t] = s - bufs[t];
+    }
+    for (t = 0; t < nround; t++)
+      if (fwrite(bufs[t], 1, len[t], file) != len[t])
+	error = 1;
+  }
+
+  for (t = 0; t < nthreads; t++)
+    free(bufs[t]);
+  free(bufs);
+  free(len);
+
+  return error;
+
+}
+
+
+/*!
+ * Format one visibility as a row of a text file.
+ *
+ * \param[out] s Output, with room for PURIFY_VISIBILITY_MAXROW
+ * characters.
+ * \param[in] vis Visibilities.
+ * \param[in] i Index of the visibility to format.
+ * \param[in] filetype Type of file.
+ * \retval end End of the row written.
+ */
+char *purify_visibility_formatrow(char *s, purify_visibility *vis, int i,
+				  purify_visibility_filetype filetype) {
+
+  switch (filetype) {
+
+  case PURIFY_VISIBILITY_FILETYPE_VIS:
+    *s++ = ' ';
+    s = purify_visibility_itoa(s, i+1);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->u[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->v[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->w[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, creal(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, cimag(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, creal(vis->noise_std[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, cimag(vis->noise_std[i]));
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_UV:
+    s = purify_visibility_dtoa(s, vis->u[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->v[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->w[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, creal(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, cimag(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, creal(vis->noise_std[i]));
+    *s++ = ' ';
+    s = purify_visibility_itoa(s, vis->baseline[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->time[i]);
+    break;
+
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_VIS:
+  case PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS:
+    *s++ = ' ';
+    s = purify_visibility_itoa(s, i+1);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->u[i]);
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, vis->v[i]);
+    if (filetype == PURIFY_VISIBILITY_FILETYPE_PROFILE_WIS) {
+      *s++ = ' ';
+      s = purify_visibility_dtoa(s, vis->w[i]);
+    }
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, creal(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, cimag(vis->y[i]));
+    *s++ = ' ';
+    s = purify_visibility_dtoa(s, cabs(vis->noise_std[i]));
+    break;
+
+  default:
+    break;
+
+  }
+  *s++ = '\n';
+
+  return s;
+
+}
+
+
+/*!
+ * Set the imaginary part of a complex number, keeping the sign of
+ * zero and infinities, which adding I*x to the real part loses.
+ *
+ * \param[in,out] z Complex number.
+ * \param[in] x Imaginary part.
+ */
+void purify_visibility_setimag(complex double *z, double x) {
+
+  ((double*)z)[1] = x;
+
+}
+
+
+/*!
+ * Format a double with the fewest digits that convert back to the
+ * same double. Values with at most 15 significant digits and a
+ * decimal exponent in [-8, 36] are formatted with integer arithmetic
+ * and checked with a single exact operation; other values are
+ * formatted with printf and 17 significant digits.
+ *
+ * \param[out] s Output, with room for 25 characters.
+ * \param[in] x Value to format.
+ * \retval end End of the characters written.
+ */
+char *purify_visibility_dtoa(char *s, double x) {
+
+  char digits[15];
+  int e, k, nd, iter;
+  long long n;
+  double ax, y;
+
+  ax = fabs(x);
+  if (ax > 0.0 && ax <= DBL_MAX) {
+    e = (int)floor(log10(ax));
+    for (iter = 0; iter < 3; iter++) {
+      k = 14 - e;
+      if (k > 22 || k < -22) break;
+      y = k >= 0 ? ax * purify_visibility_pow10[k] 
+	: ax / purify_visibility_pow10[-k];
+      n = llround(y);
+      if (n >= 1000000000000000LL) e++;
+      else if (n < 100000000000000LL) e--;
+      else {
+	// Accept the digits only if they convert back exactly.
+	y = k >= 0 ? (double)n / purify_visibility_pow10[k] 
+	  : (double)n * purify_visibility_pow10[-k];
+	if (y != ax) break;
+	for (nd = 14; nd >= 0; nd--) {
+	  digits[nd] = '0' + n % 10;
+	  n /= 10;
+	}
+	for (nd = 15; nd > 1 && digits[nd-1] == '0'; nd--) ;
+	if (x < 0.0) *s++ = '-';
+	*s++ = digits[0];
+	if (nd > 1) {
+	  *s++ = '.';
+	  memcpy(s, digits + 1, nd - 1);
+	  s += nd - 1;
+	}
+	*s++ = 'e';
+	*s++ = e < 0 ? '-' : '+';
+	e = abs(e);
+	if (e >= 10) *s++ = '0' + e / 10;
+	else *s++ = '0';
+	*s++ = '0' + e % 10;
+	return s;
+      }
+    }
+  }
+
+  return s + sprintf(s, "%.17g", x);
+
+}
+
+
+/*!
+ * Format an integer in decimal.
+ *
+ * \param[out] s Output, with room for 12 characters.
+ * \param[in] n Value to format.
+ * \retval end End of the characters written.
+ */
+char *purify_visibility_itoa(char *s, int n) {
+
+  char digits[12];
+  int nd;
+  unsigned int m;
+
+  m = n < 0 ? 0u - (unsigned int)n : (unsigned int)n;
+  nd = 0;
+  do {
+    digits[nd++] = '0' + m % 10;
+    m /= 10;
+  } while (m > 0);
+  if (n < 0) *s++ = '-';
+  while (nd > 0)
+    *s++ = digits[--nd];
+
+  return s;
 
 }
 
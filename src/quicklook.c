@@ -0,0 +1,189 @@
+/*!
+ * \file quicklook.c
+ * Low latency dirty image of a visibility file. The visibilities are
+ * gridded in chunks while the file is read, the next chunk being read
+ * while the current one is gridded, followed by a single FFT, without
+ * any of the set up of the reconstruction drivers. Only two chunks are
+ * in memory at any time, so the file can be larger than the memory.
+ * The PSF and the weight histogram are accumulated in the same pass.
+ * The time of each stage is reported. Compile with PURIFY_FFTW_OMP
+ * (see the makefile) to use the threaded FFTW.
+ *
+ * Usage: quicklook [visibility file (.uv or .bin)] [image size]
+ *                  [output file (.fits)] [oversampling]
+ *                  [PSF output file (.fits)]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex.h>  // Must be before fftw3.h
+#include <fftw3.h>
+#include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+#include "purify_visibility.h"
+#include "purify_sparsemat.h"
+#include "purify_image.h"
+#include "purify_measurement.h"
+#include "purify_utils.h"
+#include "purify_types.h"
+#include "purify_error.h"
+
+#define QUICKLOOK_CHUNK 65536
+
+double quicklook_time(void) {
+  #ifdef _OPENMP
+    return omp_get_wtime();
+  #else
+    return (double)clock()/CLOCKS_PER_SEC;
+  #endif
+}
+
+void quicklook_writeimage(complex double *x, int dim, double res_rad,
+                          const char *filename) {
+
+  int i;
+  purify_image img;
+
+  img.fov_x = dim * res_rad;
+  img.fov_y = dim * res_rad;
+  img.nx = dim;
+  img.ny = dim;
+  img.pix = (double*)malloc(dim * dim * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(img.pix);
+  for (i = 0; i < dim*dim; i++)
+    img.pix[i] = creal(x[i]);
+  purify_image_writefile(&img, filename, PURIFY_IMAGE_FILETYPE_FITS);
+  purify_image_free(&img);
+
+}
+
+int main(int argc, char *argv[]) {
+
+  char filename[PURIFY_STRLEN];
+  char outfile[PURIFY_STRLEN];
+  char psffile[PURIFY_STRLEN];
+  int i, dim, of, Nx, Ngrid, ncells;
+  long long nvis;
+  double res_mas, res_rad, peak, t0, t1, tgrid, tfft, twrite;
+  size_t len;
+  purify_visibility_filetype filetype;
+  purify_visibility_reader reader;
+  purify_measurement_cparam param;
+  double *deconv, *hist;
+  complex double *grid, *psf, *xout;
+  fftw_plan planadj;
+  void *datagrid[5];
+
+  strcpy(filename, argc > 1 ? argv[1] : "bk.uv");
+  dim = argc > 2 ? atoi(argv[2]) : 256;
+  strcpy(outfile, argc > 3 ? argv[3] : "quicklook.fits");
+  of = argc > 4 ? atoi(argv[4]) : 2;
+  strcpy(psffile, argc > 5 ? argv[5] : "");
+  len = strlen(filename);
+  filetype = len > 4 && strcmp(filename + len - 4, ".bin") == 0 ?
+    PURIFY_VISIBILITY_FILETYPE_BIN : PURIFY_VISIBILITY_FILETYPE_UV;
+
+  t0 = quicklook_time();
+
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * PURIFY_PI;
+
+  purify_measurement_init_cparam(&param);
+  param.nx1 = dim;
+  param.ny1 = dim;
+  param.ofx = of;
+  param.ofy = of;
+  param.umax = 1.0 / res_rad / 2.;
+  param.vmax = param.umax;
+
+  Nx = dim*dim;
+  Ngrid = Nx*of*of;
+  deconv = (double*)malloc(Nx * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
+  xout = (complex double*)malloc(Nx * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
+  grid = (complex double*)purify_utils_malloc(Ngrid * sizeof(complex double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(grid);
+  psf = NULL;
+  if (strlen(psffile) > 0) {
+    psf = (complex double*)purify_utils_malloc(Ngrid * sizeof(complex double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(psf);
+  }
+  hist = (double*)calloc(Ngrid, sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(hist);
+
+  //Plan while nothing depends on it yet.
+  #ifdef PURIFY_FFTW_OMP
+    fftw_init_threads();
+    fftw_plan_with_nthreads(omp_get_max_threads());
+  #endif
+  planadj = fftw_plan_dft_2d(param.nx1*param.ofx, param.ny1*param.ofy,
+                             grid, grid, FFTW_BACKWARD, FFTW_ESTIMATE);
+  for (i = 0; i < Ngrid; i++) grid[i] = 0.0;
+  if (psf != NULL)
+    for (i = 0; i < Ngrid; i++) psf[i] = 0.0;
+  purify_measurement_init_deconv(deconv, &param);
+
+  //Grid the visibilities chunk by chunk while reading the file.
+  datagrid[0] = (void*)&param;
+  datagrid[1] = (void*)deconv;
+  datagrid[2] = (void*)grid;
+  datagrid[3] = (void*)psf;
+  datagrid[4] = (void*)hist;
+  purify_visibility_init_reader(&reader, filename, filetype, 
+                                QUICKLOOK_CHUNK);
+  nvis = purify_visibility_reader_pass(&reader, 
+                                       purify_measurement_cftgrid_chunk,
+                                       datagrid);
+  purify_visibility_free_reader(&reader);
+  t1 = quicklook_time();
+  tgrid = t1 - t0;
+
+  //Dirty image.
+  purify_measurement_cftgrid_image(xout, grid, deconv, &param, &planadj);
+  tfft = quicklook_time() - t1;
+
+  t1 = quicklook_time();
+  quicklook_writeimage(xout, dim, res_rad, outfile);
+  twrite = quicklook_time() - t1;
+
+  //PSF normalised to unit peak.
+  if (psf != NULL) {
+    purify_measurement_cftgrid_image(xout, psf, deconv, &param, &planadj);
+    peak = 0.0;
+    for (i = 0; i < Nx; i++)
+      if (creal(xout[i]) > peak) peak = creal(xout[i]);
+    for (i = 0; i < Nx; i++)
+      xout[i] /= peak > 0.0 ? peak : 1.0;
+    quicklook_writeimage(xout, dim, res_rad, psffile);
+  }
+
+  ncells = 0;
+  for (i = 0; i < Ngrid; i++)
+    if (hist[i] > 0.0) ncells++;
+
+  printf("Number of visibilities: %lld \n", nvis);
+  printf("Occupied grid cells: %i of %i \n", ncells, Ngrid);
+  printf("Time read and grid: %f \n", tgrid);
+  printf("Time FFT: %f \n", tfft);
+  printf("Time write: %f \n", twrite);
+  printf("Total latency: %f \n", tgrid + tfft + twrite);
+
+  fftw_destroy_plan(planadj);
+  #ifdef PURIFY_FFTW_OMP
+    fftw_cleanup_threads();
+  #endif
+  purify_utils_free(grid);
+  if (psf != NULL) purify_utils_free(psf);
+  free(hist);
+  free(deconv);
+  free(xout);
+
+  return 0;
+
+}
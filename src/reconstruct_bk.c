@@ -56,6 +56,25 @@ int main(int argc, char *argv[]) {
         printf("Use default source: %s\n", src);
     }
     char buf[128];
+    //Number of fractional offset bins used to merge visibilities in
+    //the same grid cell (0: no merging, 1: exact for the NGB kernel)
+    int nsub = argc > 2 ? atoi(argv[2]) : 0;
+    //Density weighting (natural, uniform or briggs) and robustness,
+    //visibilities are unweighted if it is not given or none
+    purify_visibility_weighting weighting = 
+      PURIFY_VISIBILITY_WEIGHTING_NATURAL;
+    int weighted = argc > 3 && strcmp(argv[3], "none") != 0;
+    if (argc > 3 && strcmp(argv[3], "uniform") == 0)
+      weighting = PURIFY_VISIBILITY_WEIGHTING_UNIFORM;
+    if (argc > 3 && strcmp(argv[3], "briggs") == 0)
+      weighting = PURIFY_VISIBILITY_WEIGHTING_BRIGGS;
+    double robust = argc > 4 ? atof(argv[4]) : 0.0;
+    //Directory of the PSF cache (the PSF is only computed if given)
+    char psfdir[PURIFY_STRLEN];
+    psfdir[0] = '\0';
+    if (argc > 5 
+        && snprintf(psfdir, PURIFY_STRLEN, "%s", argv[5]) >= PURIFY_STRLEN)
+      PURIFY_ERROR_GENERIC("PSF directory path too long");
 
   int i, j, Nx, Ny, Nr, Nb;
   int seedn=54;
@@ -93,11 +112,15 @@ int main(int argc, char *argv[]) {
   purify_measurement_cparam param_m1;
   purify_measurement_cparam param_m2;
   complex double *fft_temp1;
-  complex double *fft_temp2;
+  purify_measurement_workspace fft_ws;
   void *datafwd[5];
   void *dataadj[5];
   fftw_plan planfwd;
   fftw_plan planadj;
+  double *gdiag;
+  void *datagram[6];
+  purify_measurement_opnormparam param_on;
+  double bound;
 
   //Structures for sparsity operator
   sopt_wavelet_type *dict_types;
@@ -137,6 +160,12 @@ int main(int argc, char *argv[]) {
   filetype_vis = PURIFY_VISIBILITY_FILETYPE_UV;
   filetype_img = PURIFY_IMAGE_FILETYPE_FITS;
 
+  //Maximum frequency of the grid for the image resolution
+  double res_mas, res_rad, umax;
+  res_mas = 0.1; // in milli arcsec
+  res_rad = res_mas * 1E-3 / 3600. / 180. * M_PI;
+  umax = 1.0 / res_rad / 2.;
+
   //Read coverage
   sprintf(buf, "%s.uv", src);
   purify_visibility_readfile(&vis_test,
@@ -144,6 +173,29 @@ int main(int argc, char *argv[]) {
              filetype_vis); 
   printf("Number of visibilities: %i \n\n", vis_test.nmeas);  
 
+  //Drop non-finite, zero weight and out of grid visibilities
+  purify_visibility_filterreport filter;
+  purify_visibility_filter(&filter, NULL, &vis_test, NULL, umax, umax, 1);
+  printf("Visibilities kept: %i (non-finite %i, zero weight %i, "
+         "out of grid %i, %.3f s) \n\n", filter.nkept, filter.nnonfinite,
+         filter.nzeroweight, filter.noutofgrid, filter.time);
+
+  //Configuration selected by the autotune program, if available
+  purify_measurement_tuneconfig tune;
+  sprintf(buf, "%s.tune", src);
+  int tuned = purify_measurement_tune_read(&tune, buf) == 0;
+  int of = tuned ? tune.oversampling : 2;
+
+  //Merge visibilities in the same cell of the oversampled grid
+  if (nsub > 0) {
+    purify_visibility vis_coal;
+    purify_visibility_coalesce(&vis_coal, NULL, &vis_test, umax, umax,
+                               of*dimx, of*dimy, nsub);
+    purify_visibility_free(&vis_test);
+    vis_test = vis_coal;
+    printf("Number of merged visibilities: %i \n\n", vis_test.nmeas);
+  }
+
    
 /*
   // Input image.
@@ -157,6 +209,7 @@ int main(int argc, char *argv[]) {
   printf("Image dimension: %i, %i \n\n", img.nx, img.ny); 
 */
 
+  purify_measurement_init_cparam(&param_m1);
   param_m1.nmeas = vis_test.nmeas;
   param_m1.ny1 = dimy;
   param_m1.nx1 = dimx;
@@ -164,7 +217,9 @@ int main(int argc, char *argv[]) {
   param_m1.ofx = 2;
   param_m1.ky = 1;
   param_m1.kx = 1;
+  param_m1.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
+  purify_measurement_init_cparam(&param_m2);
   param_m2.nmeas = vis_test.nmeas;
   param_m2.ny1 = dimy;
   param_m2.nx1 = dimx;
@@ -172,6 +227,16 @@ int main(int argc, char *argv[]) {
   param_m2.ofx = 2;
   param_m2.ky = 1;
   param_m2.kx = 1;
+  param_m2.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
+
+  if (tuned) {
+    purify_measurement_tune_apply(&param_m1, &tune);
+    purify_measurement_tune_apply(&param_m2, &tune);
+    #ifdef _OPENMP
+      omp_set_num_threads(tune.nthreads);
+    #endif
+    printf("Using tuned configuration from %s.tune \n\n", src);
+  }
 
   Nb = 9;
   Nx=param_m2.ny1*param_m2.nx1;
@@ -179,44 +244,40 @@ int main(int argc, char *argv[]) {
   Ny=param_m2.nmeas;
 
   //Memory allocation for the different variables
-  deconv = (double*)malloc((Nx) * sizeof(double));
+  deconv = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
-  xinc = (complex double*)malloc((Nx) * sizeof(complex double));
+  xinc = (complex double*)purify_utils_malloc((Nx) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xinc);
-  xout = (double*)malloc((Nx) * sizeof(double));
+  xout = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
-  y = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  y = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(y);
-  y0 = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  y0 = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(y0);
-  noise = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  noise = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(noise);
-  w = (double*)malloc((Nr) * sizeof(double));
+  w = (double*)purify_utils_malloc((Nr) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(w);
-  error = (double*)malloc((Nx) * sizeof(double));
+  error = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(error);
-  xoutc = (complex double*)malloc((Nx) * sizeof(complex double));
+  xoutc = (complex double*)purify_utils_malloc((Nx) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xoutc);
 
-  complex double * ytmp = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  complex double * ytmp = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(ytmp);
  
-  wdx = (double*)malloc((Nx) * sizeof(double));
+  wdx = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(wdx);
-  wdy = (double*)malloc((Nx) * sizeof(double));
+  wdy = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(wdy);
 
-  dummyr = malloc(Nr * sizeof(double));
+  dummyr = purify_utils_malloc(Nr * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(dummyr);
-  dummyc = malloc(Nr * sizeof(complex double));
+  dummyc = purify_utils_malloc(Nr * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(dummyc);
 
 
-    double res_mas, res_rad;
-    res_mas = 0.1; // in milli arcsec
-    res_rad = res_mas * 1E-3 / 3600. / 180. * M_PI;
-
-    param_m1.umax = 1.0 / res_rad / 2.;
+    param_m1.umax = umax;
 //    param_m1.umax = 1.0 * M_PI;
     param_m1.vmax = param_m1.umax;
 
@@ -230,12 +291,10 @@ int main(int argc, char *argv[]) {
   t = (double) (stop-start)/CLOCKS_PER_SEC;
   printf("Time initalization: %f \n\n", t);
 
-  //Memory allocation for the fft
+  //Pool of grids for the fft, shared by both operators
   i = Nx*param_m1.ofy*param_m1.ofx;
-  fft_temp1 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp1);
-  fft_temp2 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp2);
+  purify_measurement_init_workspace(&fft_ws, i);
+  fft_temp1 = purify_measurement_workspace_acquire(&fft_ws);
 
   //FFT plan  
   planfwd = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
@@ -243,21 +302,23 @@ int main(int argc, char *argv[]) {
               FFTW_FORWARD, FFTW_MEASURE);
 
   planadj = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
-              fft_temp2, fft_temp2, 
+              fft_temp1, fft_temp1, 
               FFTW_BACKWARD, FFTW_MEASURE);
 
+  purify_measurement_workspace_release(&fft_ws, fft_temp1);
+
 
   datafwd[0] = (void*)&param_m1;
   datafwd[1] = (void*)deconv;
   datafwd[2] = (void*)&gmat;
   datafwd[3] = (void*)&planfwd;
-  datafwd[4] = (void*)fft_temp1;
+  datafwd[4] = (void*)&fft_ws;
 
   dataadj[0] = (void*)&param_m2;
   dataadj[1] = (void*)deconv;
   dataadj[2] = (void*)&gmat;
   dataadj[3] = (void*)&planadj;
-  dataadj[4] = (void*)fft_temp2;
+  dataadj[4] = (void*)&fft_ws;
 
 
   printf("FFT plan done \n\n");
@@ -272,6 +333,38 @@ int main(int argc, char *argv[]) {
   for(i = 0; i < Ny; ++i){
     y0[i] = vis_test.y[i];     
   }
+
+  //Noise whitening and density weighting
+  double *wvis = NULL;
+  if (weighted) {
+    wvis = (double*)malloc((Ny) * sizeof(double));
+    PURIFY_ERROR_MEM_ALLOC_CHECK(wvis);
+    purify_visibility_weights(wvis, &vis_test, param_m1.umax, param_m1.vmax,
+                              param_m1.nx1*param_m1.ofx, 
+                              param_m1.ny1*param_m1.ofy, weighting, robust);
+  }
+
+  //Point spread function on a 2x extended field, cached between runs
+  if (strlen(psfdir) > 0) {
+    purify_image psf;
+    purify_measurement_beam beam;
+    i = purify_measurement_psf(&psf, &beam, vis_test.u, vis_test.v, wvis,
+                               &param_m1, 2, psfdir);
+    printf("PSF %s, beam fwhm %f x %f pixels, angle %f \n\n", 
+           i ? "read from cache" : "computed", beam.bmaj, beam.bmin, 
+           beam.bpa);
+    purify_image_free(&psf);
+  }
+
+  //Weights folded into the rows of the gridding matrix once
+  if (wvis != NULL) {
+    for (i = 0; i < Ny; i++) {
+      wvis[i] = sqrt(wvis[i]);
+      y0[i] *= wvis[i];
+    }
+    purify_sparsemat_scalerows(&gmat, wvis);
+    free(wvis);
+  }
   
   //Noise realization
   //Input snr
@@ -310,6 +403,28 @@ int main(int argc, char *argv[]) {
     deconv[i] = deconv[i]/sqrt(aux4);
 //      deconv[i] = 1.0;
   }
+
+  //Squared operator norm through the Gram operator, cached between
+  //runs under the fingerprint of the (weighted) operator
+  gdiag = (double*)malloc((gmat.ncols) * sizeof(double));
+  PURIFY_ERROR_MEM_ALLOC_CHECK(gdiag);
+  purify_measurement_init_gram(gdiag, &gmat);
+  datagram[0] = (void*)&param_m1;
+  datagram[1] = (void*)deconv;
+  datagram[2] = (void*)gdiag;
+  datagram[3] = (void*)&planfwd;
+  datagram[4] = (void*)&planadj;
+  datagram[5] = (void*)&fft_ws;
+  purify_measurement_init_opnormparam(&param_on);
+  param_on.verbose = 1;
+  sprintf(buf, "%s.opnorm", src);
+  param_on.cachefile = buf;
+  param_on.key = purify_measurement_fingerprint(&gmat, deconv, &param_m1);
+  bound = purify_measurement_opnorm(NULL, NULL, NULL, NULL,
+                                    &purify_measurement_cftgram, datagram,
+                                    Nx, Ny, &param_on);
+  printf("Operator norm bound: %f \n\n", bound);
+  free(gdiag);
   
   
   // Output image.
@@ -902,18 +1017,18 @@ int main(int argc, char *argv[]) {
   //Free all memory
 //  purify_image_free(&img);
   purify_image_free(&img_copy);
-  free(deconv);
+  purify_utils_free(deconv);
   purify_visibility_free(&vis_test);
-  free(y);
-  free(xinc);
-  free(xout);
-  free(w);
-  free(noise);
-  free(y0);
-  free(error);
-  free(xoutc);
-  free(wdx);
-  free(wdy);
+  purify_utils_free(y);
+  purify_utils_free(xinc);
+  purify_utils_free(xout);
+  purify_utils_free(w);
+  purify_utils_free(noise);
+  purify_utils_free(y0);
+  purify_utils_free(error);
+  purify_utils_free(xoutc);
+  purify_utils_free(wdx);
+  purify_utils_free(wdy);
 
   sopt_sara_free(&param1);
   sopt_sara_free(&param2);
@@ -922,14 +1037,13 @@ int main(int argc, char *argv[]) {
   free(dict_types1);
   free(dict_types2);
 
-  free(fft_temp1);
-  free(fft_temp2);
+  purify_measurement_free_workspace(&fft_ws);
   fftw_destroy_plan(planfwd);
   fftw_destroy_plan(planadj);
   purify_sparsemat_freer(&gmat);
 
-  free(dummyr);
-  free(dummyc);
+  purify_utils_free(dummyr);
+  purify_utils_free(dummyc);
 
 
   return 0;
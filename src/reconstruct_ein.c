@@ -94,7 +94,7 @@ int main(int argc, char *argv[]) {
   purify_measurement_cparam param_m1;
   purify_measurement_cparam param_m2;
   complex double *fft_temp1;
-  complex double *fft_temp2;
+  purify_measurement_workspace fft_ws;
   void *datafwd[5];
   void *dataadj[5];
   fftw_plan planfwd;
@@ -154,6 +154,7 @@ int main(int argc, char *argv[]) {
   printf("Image dimension: %i, %i \n\n", img.nx, img.ny); 
 */
 
+  purify_measurement_init_cparam(&param_m1);
   param_m1.nmeas = vis_test.nmeas;
   param_m1.ny1 = dimy;
   param_m1.nx1 = dimx;
@@ -161,7 +162,9 @@ int main(int argc, char *argv[]) {
   param_m1.ofx = 2;
   param_m1.ky = 1;
   param_m1.kx = 1;
+  param_m1.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
+  purify_measurement_init_cparam(&param_m2);
   param_m2.nmeas = vis_test.nmeas;
   param_m2.ny1 = dimy;
   param_m2.nx1 = dimx;
@@ -169,6 +172,7 @@ int main(int argc, char *argv[]) {
   param_m2.ofx = 2;
   param_m2.ky = 1;
   param_m2.kx = 1;
+  param_m2.kernel = PURIFY_MEASUREMENT_KERNEL_NGB;
 
   Nb = 9;
   Nx=param_m2.ny1*param_m2.nx1;
@@ -176,36 +180,36 @@ int main(int argc, char *argv[]) {
   Ny=param_m2.nmeas;
 
   //Memory allocation for the different variables
-  deconv = (double*)malloc((Nx) * sizeof(double));
+  deconv = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(deconv);
-  xinc = (complex double*)malloc((Nx) * sizeof(complex double));
+  xinc = (complex double*)purify_utils_malloc((Nx) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xinc);
-  xout = (double*)malloc((Nx) * sizeof(double));
+  xout = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xout);
-  y = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  y = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(y);
-  y0 = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  y0 = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(y0);
-  noise = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  noise = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(noise);
-  w = (double*)malloc((Nr) * sizeof(double));
+  w = (double*)purify_utils_malloc((Nr) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(w);
-  error = (double*)malloc((Nx) * sizeof(double));
+  error = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(error);
-  xoutc = (complex double*)malloc((Nx) * sizeof(complex double));
+  xoutc = (complex double*)purify_utils_malloc((Nx) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(xoutc);
 
-  complex double * ytmp = (complex double*)malloc((vis_test.nmeas) * sizeof(complex double));
+  complex double * ytmp = (complex double*)purify_utils_malloc((vis_test.nmeas) * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(ytmp);
  
-  wdx = (double*)malloc((Nx) * sizeof(double));
+  wdx = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(wdx);
-  wdy = (double*)malloc((Nx) * sizeof(double));
+  wdy = (double*)purify_utils_malloc((Nx) * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(wdy);
 
-  dummyr = malloc(Nr * sizeof(double));
+  dummyr = purify_utils_malloc(Nr * sizeof(double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(dummyr);
-  dummyc = malloc(Nr * sizeof(complex double));
+  dummyc = purify_utils_malloc(Nr * sizeof(complex double));
   PURIFY_ERROR_MEM_ALLOC_CHECK(dummyc);
 
 
@@ -227,12 +231,10 @@ int main(int argc, char *argv[]) {
   t = (double) (stop-start)/CLOCKS_PER_SEC;
   printf("Time initalization: %f \n\n", t);
 
-  //Memory allocation for the fft
+  //Pool of grids for the fft, shared by both operators
   i = Nx*param_m1.ofy*param_m1.ofx;
-  fft_temp1 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp1);
-  fft_temp2 = (complex double*)malloc((i) * sizeof(complex double));
-  PURIFY_ERROR_MEM_ALLOC_CHECK(fft_temp2);
+  purify_measurement_init_workspace(&fft_ws, i);
+  fft_temp1 = purify_measurement_workspace_acquire(&fft_ws);
 
   //FFT plan  
   planfwd = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
@@ -240,21 +242,23 @@ int main(int argc, char *argv[]) {
               FFTW_FORWARD, FFTW_MEASURE);
 
   planadj = fftw_plan_dft_2d(param_m1.nx1*param_m1.ofx, param_m1.ny1*param_m1.ofy, 
-              fft_temp2, fft_temp2, 
+              fft_temp1, fft_temp1, 
               FFTW_BACKWARD, FFTW_MEASURE);
 
+  purify_measurement_workspace_release(&fft_ws, fft_temp1);
+
 
   datafwd[0] = (void*)&param_m1;
   datafwd[1] = (void*)deconv;
   datafwd[2] = (void*)&gmat;
   datafwd[3] = (void*)&planfwd;
-  datafwd[4] = (void*)fft_temp1;
+  datafwd[4] = (void*)&fft_ws;
 
   dataadj[0] = (void*)&param_m2;
   dataadj[1] = (void*)deconv;
   dataadj[2] = (void*)&gmat;
   dataadj[3] = (void*)&planadj;
-  dataadj[4] = (void*)fft_temp2;
+  dataadj[4] = (void*)&fft_ws;
 
 
   printf("FFT plan done \n\n");
@@ -899,18 +903,18 @@ int main(int argc, char *argv[]) {
   //Free all memory
 //  purify_image_free(&img);
   purify_image_free(&img_copy);
-  free(deconv);
+  purify_utils_free(deconv);
   purify_visibility_free(&vis_test);
-  free(y);
-  free(xinc);
-  free(xout);
-  free(w);
-  free(noise);
-  free(y0);
-  free(error);
-  free(xoutc);
-  free(wdx);
-  free(wdy);
+  purify_utils_free(y);
+  purify_utils_free(xinc);
+  purify_utils_free(xout);
+  purify_utils_free(w);
+  purify_utils_free(noise);
+  purify_utils_free(y0);
+  purify_utils_free(error);
+  purify_utils_free(xoutc);
+  purify_utils_free(wdx);
+  purify_utils_free(wdy);
 
   sopt_sara_free(&param1);
   sopt_sara_free(&param2);
@@ -919,14 +923,13 @@ int main(int argc, char *argv[]) {
   free(dict_types1);
   free(dict_types2);
 
-  free(fft_temp1);
-  free(fft_temp2);
+  purify_measurement_free_workspace(&fft_ws);
   fftw_destroy_plan(planfwd);
   fftw_destroy_plan(planadj);
   purify_sparsemat_freer(&gmat);
 
-  free(dummyr);
-  free(dummyc);
+  purify_utils_free(dummyr);
+  purify_utils_free(dummyc);
 
 
   return 0;